@@ -8,6 +8,18 @@
 #endif
 
 #include "hlsltype.h"
+#include "TaskPool.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <vector>
 #include <type_traits>
 
@@ -16,9 +28,48 @@ using namespace HLSLType;
 template <typename Number>
 concept IndexType = std::is_same<std::uint16_t, Number>::value || std::is_same<std::uint32_t, Number>::value;
 
+// Batched height field for GeometryGenerator::CreateGrid:
+//     fn(x, z, count, heights, normals)
+// writes the height and unit normal at each of the count points (x[i], z[i]).
+template <typename Fn>
+concept HeightFieldFunction = std::invocable<const Fn&, const float*, const float*, std::size_t, float*, float3*>;
+
+// Vertex format of the generators' output, see GeometryGenerator::VertexLayout.
+template <typename Layout>
+concept VertexLayoutType = requires
+{
+    typename Layout::VertexType;
+    { Layout::ElementCount } -> std::convertible_to<std::size_t>;
+};
+
+// Every generator comes in two forms. The MeshData form allocates the exact output size once,
+// from a std::pmr memory resource (the default resource unless one is given). The other form
+// writes into caller-provided arrays, sized with the matching *Size() function, e.g. straight
+// into a staging buffer that holds many meshes.
 class GeometryGenerator
 {
 public:
+    // How Subdivide splits triangles. Duplicate gives every new triangle its own copies of
+    // its vertices, six per input triangle. SharedEdges keeps the input vertices and creates
+    // each edge midpoint once, so a closed mesh with V vertices and E edges ends up with
+    // V + E vertices instead of 6 per triangle.
+    enum class SubdivisionMode
+    {
+        Duplicate,
+        SharedEdges
+    };
+
+    static constexpr std::uint32_t MaxSubdivisions = 13;
+
+    // Points per call of a height-field function.
+    static constexpr std::uint32_t HeightFieldBatch = 256;
+
+    struct MeshSize
+    {
+        std::size_t VertexCount = 0;
+        std::size_t IndexCount = 0;
+    };
+
     struct Vertex
     {
         float3 Position;
@@ -52,53 +103,317 @@ public:
         }
     };
 
-    template <typename Index> requires IndexType<Index>
-    struct MeshData
+    // Attributes the generators compute.
+    enum class VertexAttribute
+    {
+        Position,
+        Normal,
+        TangentU,
+        TexC
+    };
+
+    // One attribute of a VertexLayout and the member of the target vertex it is written to.
+    template <VertexAttribute AttributeT, auto MemberT>
+    struct VertexElement
     {
-        std::vector<Vertex> Vertices;
-        std::vector<Index> Indices;
+        static constexpr VertexAttribute Attribute = AttributeT;
+        static constexpr auto Member = MemberT;
+    };
+
+    // What an input layout needs to know about one element (see DirectXHelper::MakeInputLayout).
+    // Every attribute is made of 32-bit floats.
+    struct VertexElementDesc
+    {
+        const char* SemanticName;
+        std::uint32_t ComponentCount;
+        std::uint32_t ByteOffset;
+    };
 
-        std::vector<std::uint16_t>& GetIndices16()
+private:
+    template <VertexAttribute Attribute>
+    struct AttributeTraits
+    {
+        static constexpr bool IsTexC = Attribute == VertexAttribute::TexC;
+
+        using Type = std::conditional_t<IsTexC, float2, float3>;
+
+        static constexpr std::uint32_t ComponentCount = IsTexC ? 2 : 3;
+
+        static constexpr const char* SemanticName =
+            Attribute == VertexAttribute::Position ? "POSITION" :
+            Attribute == VertexAttribute::Normal ? "NORMAL" :
+            Attribute == VertexAttribute::TangentU ? "TANGENT" : "TEXCOORD";
+
+        // The attribute's member of a (const) Vertex.
+        template <typename VertexRef>
+        static auto& Get(VertexRef& vertex)
         {
-            if(mIndices16.empty())
-            {
-                mIndices16.resize(Indices.size());
-                for(size_t i = 0; i < Indices.size(); i++)
-                {
-                    mIndices16[i] = (std::uint16_t)Indices[i];
-                }
-            }
-            return mIndices16;
+            if constexpr(Attribute == VertexAttribute::Position)
+                return vertex.Position;
+            else if constexpr(Attribute == VertexAttribute::Normal)
+                return vertex.Normal;
+            else if constexpr(Attribute == VertexAttribute::TangentU)
+                return vertex.TangentU;
+            else
+                return vertex.TexC;
         }
+    };
+
+    template <auto Member>
+    struct MemberTraits;
+
+    template <typename Class, typename Type, Type Class::* Member>
+    struct MemberTraits<Member>
+    {
+        using ClassType = Class;
+        using MemberType = Type;
+    };
+
+public:
+    // Output format of the generators: the vertex type they write and which of its members
+    // receive which attribute. Only the listed attributes are stored, and generators skip the
+    // work for the others with if constexpr, so an app can generate straight into its own
+    // vertex type:
+    //
+    //     using Layout = GeometryGenerator::VertexLayout<Vertex,
+    //         GeometryGenerator::VertexElement<GeometryGenerator::VertexAttribute::Position, &Vertex::Pos>,
+    //         GeometryGenerator::VertexElement<GeometryGenerator::VertexAttribute::TexC, &Vertex::TexC>>;
+    //
+    //     auto grid = GeometryGenerator::CreateGrid<std::uint32_t, Layout>(160.0f, 160.0f, 160, 160);
+    //
+    // Every layout has a position. Members outside the layout are left as they are.
+    template <typename VertexT, typename... Elements>
+    struct VertexLayout
+    {
+        using VertexType = VertexT;
+
+        static constexpr std::size_t ElementCount = sizeof...(Elements);
+
+        template <VertexAttribute Attribute>
+        static constexpr bool Has = ((Elements::Attribute == Attribute) || ...);
+
+        static_assert(Has<VertexAttribute::Position>, "A vertex layout needs a position.");
+        static_assert(
+            (std::is_same_v<typename MemberTraits<Elements::Member>::ClassType, VertexT> && ...),
+            "Every element must be a member of the layout's vertex type.");
+        static_assert(
+            (std::is_same_v<typename MemberTraits<Elements::Member>::MemberType,
+                            typename AttributeTraits<Elements::Attribute>::Type> && ...),
+            "Positions, normals and tangents are float3 and texture coordinates float2.");
 
-        std::vector<std::uint32_t>& GetIndices32()
+        // Writes the layout's attributes of src into dst.
+        static void Store(VertexT& dst, const Vertex& src)
         {
-            if(mIndices32.empty())
+            ((dst.*Elements::Member = AttributeTraits<Elements::Attribute>::Get(src)), ...);
+        }
+
+        // The layout's attributes of src as a Vertex; the other attributes are zero.
+        static Vertex Load(const VertexT& src)
+        {
+            Vertex vertex{};
+            ((AttributeTraits<Elements::Attribute>::Get(vertex) = src.*Elements::Member), ...);
+            return vertex;
+        }
+
+        static std::array<VertexElementDesc, ElementCount> Describe()
+        {
+            static const VertexT probe{};
+            auto offset = [](auto member)
             {
-                mIndices32.resize(Indices.size());
-                for(size_t i = 0; i < Indices.size(); i++)
-                {
-                    mIndices32[i] = (std::uint32_t)Indices[i];
-                }
-            }
-            return mIndices32;
+                return (std::uint32_t)(reinterpret_cast<const char*>(&(probe.*member)) - reinterpret_cast<const char*>(&probe));
+            };
+
+            return { VertexElementDesc{
+                AttributeTraits<Elements::Attribute>::SemanticName,
+                AttributeTraits<Elements::Attribute>::ComponentCount,
+                offset(Elements::Member) }... };
+        }
+    };
+
+    // Every attribute, into Vertex.
+    using DefaultVertexLayout = VertexLayout<Vertex,
+        VertexElement<VertexAttribute::Position, &Vertex::Position>,
+        VertexElement<VertexAttribute::Normal, &Vertex::Normal>,
+        VertexElement<VertexAttribute::TangentU, &Vertex::TangentU>,
+        VertexElement<VertexAttribute::TexC, &Vertex::TexC>>;
+
+    // Read-only view of an index list that converts each index to To on access; narrowing
+    // truncates like a cast. Copy it out with CopyTo() or by converting to a std::vector.
+    template <typename From, typename To>
+    class IndexView
+    {
+    public:
+        class Iterator
+        {
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = To;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = To;
+
+            Iterator() = default;
+            explicit Iterator(const From* index) : mIndex(index) {}
+
+            To operator*() const { return (To)*mIndex; }
+            To operator[](difference_type n) const { return (To)mIndex[n]; }
+
+            Iterator& operator++() { ++mIndex; return *this; }
+            Iterator operator++(int) { Iterator it = *this; ++mIndex; return it; }
+            Iterator& operator--() { --mIndex; return *this; }
+            Iterator operator--(int) { Iterator it = *this; --mIndex; return it; }
+            Iterator& operator+=(difference_type n) { mIndex += n; return *this; }
+            Iterator& operator-=(difference_type n) { mIndex -= n; return *this; }
+
+            friend Iterator operator+(Iterator it, difference_type n) { return it += n; }
+            friend Iterator operator+(difference_type n, Iterator it) { return it += n; }
+            friend Iterator operator-(Iterator it, difference_type n) { return it -= n; }
+            friend difference_type operator-(const Iterator& a, const Iterator& b) { return a.mIndex - b.mIndex; }
+
+            bool operator==(const Iterator&) const = default;
+            auto operator<=>(const Iterator&) const = default;
+
+        private:
+            const From* mIndex = nullptr;
+        };
+
+        IndexView(const From* indices, std::size_t count) : mIndices(indices), mCount(count)
+        {
+        }
+
+        Iterator begin() const { return Iterator(mIndices); }
+        Iterator end() const { return Iterator(mIndices + mCount); }
+        std::size_t size() const { return mCount; }
+        bool empty() const { return mCount == 0; }
+        To operator[](std::size_t i) const { return (To)mIndices[i]; }
+
+        void CopyTo(To* dst) const
+        {
+            std::copy(begin(), end(), dst);
+        }
+
+        operator std::vector<To>() const
+        {
+            return std::vector<To>(begin(), end());
         }
 
     private:
-        std::vector<std::uint16_t> mIndices16;
-        std::vector<std::uint32_t> mIndices32;
+        const From* mIndices = nullptr;
+        std::size_t mCount = 0;
+    };
+
+    template <typename Index, typename VertexT = Vertex> requires IndexType<Index>
+    struct MeshData
+    {
+        std::pmr::vector<VertexT> Vertices;
+        std::pmr::vector<Index> Indices;
+
+        MeshData() = default;
 
-        friend class GeometryGenerator;
+        explicit MeshData(std::pmr::memory_resource* resource) : Vertices(resource), Indices(resource)
+        {
+        }
+
+        MeshData(const MeshSize& size, std::pmr::memory_resource* resource) :
+            Vertices(size.VertexCount, resource),
+            Indices(size.IndexCount, resource)
+        {
+        }
+
+        IndexView<Index, std::uint16_t> GetIndices16() const
+        {
+            return IndexView<Index, std::uint16_t>(Indices.data(), Indices.size());
+        }
+
+        IndexView<Index, std::uint32_t> GetIndices32() const
+        {
+            return IndexView<Index, std::uint32_t>(Indices.data(), Indices.size());
+        }
     };
 
-    template <typename Index> requires IndexType<Index>
-    static MeshData<Index> CreateBox(
-        float width, float height, float depth, std::uint32_t numSubdivisions)
+    // Size of a mesh with the given counts after `levels` rounds of Subdivide. baseEdges is
+    // only needed for SharedEdges.
+    static MeshSize SubdividedSize(
+        std::size_t baseVertices, std::size_t baseEdges, std::size_t baseTriangles,
+        std::uint32_t levels, SubdivisionMode mode)
     {
-        MeshData<Index> meshData;
+        std::size_t vertexCount = baseVertices;
+        std::size_t edgeCount = baseEdges;
+        std::size_t triangleCount = baseTriangles;
+
+        // Every edge splits in two and every triangle adds three inner edges.
+        for(std::uint32_t i = 0; i < levels; i++)
+        {
+            vertexCount = mode == SubdivisionMode::SharedEdges ? vertexCount + edgeCount : triangleCount * 6;
+            edgeCount = edgeCount * 2 + triangleCount * 3;
+            triangleCount *= 4;
+        }
 
-        if(numSubdivisions > 13)
-            numSubdivisions = 13;
+        return MeshSize{ vertexCount, triangleCount * 3 };
+    }
+
+    static MeshSize BoxSize(std::uint32_t numSubdivisions, SubdivisionMode mode = SubdivisionMode::SharedEdges)
+    {
+        // Six faces of four vertices, five edges and two triangles.
+        return SubdividedSize(24, 30, 12, std::min(numSubdivisions, MaxSubdivisions), mode);
+    }
+
+    static MeshSize CylinderSize(std::uint32_t sliceCount, std::uint32_t stackCount)
+    {
+        std::size_t ringVertexCount = sliceCount + 1;
+        return MeshSize{
+            (stackCount + 1) * ringVertexCount + 2 * (ringVertexCount + 1),
+            6 * (std::size_t)stackCount * sliceCount + 6 * (std::size_t)sliceCount };
+    }
+
+    static MeshSize SphereSize(std::uint32_t sliceCount, std::uint32_t stackCount)
+    {
+        return MeshSize{
+            (std::size_t)(sliceCount + 1) * (stackCount + 1),
+            6 * (std::size_t)sliceCount * stackCount };
+    }
+
+    static MeshSize GeosphereSize(std::uint32_t numSubdivisions, SubdivisionMode mode = SubdivisionMode::SharedEdges)
+    {
+        // The icosahedron: 12 vertices, 30 edges, 20 triangles.
+        return SubdividedSize(12, 30, 20, std::min(numSubdivisions, MaxSubdivisions), mode);
+    }
+
+    static MeshSize GridSize(std::uint32_t m, std::uint32_t n)
+    {
+        return MeshSize{ (std::size_t)m * n, 6 * (std::size_t)(m - 1) * (n - 1) };
+    }
+
+    static MeshSize QuadSize()
+    {
+        return MeshSize{ 4, 6 };
+    }
+
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static MeshData<Index, typename Layout::VertexType> CreateBox(
+        float width, float height, float depth, std::uint32_t numSubdivisions,
+        SubdivisionMode mode = SubdivisionMode::SharedEdges,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    {
+        MeshData<Index, typename Layout::VertexType> meshData(BoxSize(numSubdivisions, mode), resource);
+        CreateBox<Index, Layout>(
+            width, height, depth, numSubdivisions,
+            meshData.Vertices.data(), meshData.Indices.data(), mode, resource);
+
+        return meshData;
+    }
+
+    // vertices and indices hold BoxSize(numSubdivisions, mode). Subdivision runs in place;
+    // scratch provides its temporary memory.
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static void CreateBox(
+        float width, float height, float depth, std::uint32_t numSubdivisions,
+        typename Layout::VertexType* vertices, Index* indices,
+        SubdivisionMode mode = SubdivisionMode::SharedEdges,
+        std::pmr::memory_resource* scratch = std::pmr::get_default_resource())
+    {
+        if(numSubdivisions > MaxSubdivisions)
+            numSubdivisions = MaxSubdivisions;
 
         Vertex v[24];
 
@@ -142,9 +457,10 @@ public:
         v[22] = Vertex(+w2, +h2, +d2, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f);
         v[23] = Vertex(+w2, -h2, +d2, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f);
 
-        meshData.Vertices.assign(&v[0], &v[24]);
+        for(std::size_t k = 0; k < 24; k++)
+            Layout::Store(vertices[k], v[k]);
 
-        Index i[36];
+        Index* i = indices;
 
         // Fill in the front face index data
         i[0] = 0; i[1] = 1; i[2] = 2;
@@ -170,21 +486,40 @@ public:
         i[30] = 20; i[31] = 21; i[32] = 22;
         i[33] = 20; i[34] = 22; i[35] = 23;
 
-        meshData.Indices.assign(&i[0], &i[36]);
+        std::size_t vertexCount = 24;
+        std::size_t triangleCount = 12;
+        for(std::uint32_t level = 0; level < numSubdivisions; level++)
+        {
+            vertexCount = SubdivideInPlace<Index, Layout>(vertices, vertexCount, indices, triangleCount, mode, scratch);
+            triangleCount *= 4;
+        }
+    }
 
-        for(std::uint32_t i = 0; i < numSubdivisions; i++)
-            Subdivide<Index>(meshData);
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static MeshData<Index, typename Layout::VertexType> CreateCylinder(
+        float bottomRadius, float topRadius,
+        float height, std::uint32_t sliceCount, std::uint32_t stackCount,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    )
+    {
+        MeshData<Index, typename Layout::VertexType> meshData(CylinderSize(sliceCount, stackCount), resource);
+        CreateCylinder<Index, Layout>(
+            bottomRadius, topRadius, height, sliceCount, stackCount,
+            meshData.Vertices.data(), meshData.Indices.data());
 
         return meshData;
     }
 
-    template <typename Index> requires IndexType<Index>
-    static MeshData<Index> CreateCylinder(
+    // vertices and indices hold CylinderSize(sliceCount, stackCount).
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static void CreateCylinder(
         float bottomRadius, float topRadius,
-        float height, std::uint32_t sliceCount, std::uint32_t stackCount
+        float height, std::uint32_t sliceCount, std::uint32_t stackCount,
+        typename Layout::VertexType* vertices, Index* indices
     )
     {
-        MeshData<Index> meshData;
+        std::size_t vertexCount = 0;
+        std::size_t indexCount = 0;
 
         float stackHeight = height / stackCount;
         float radiusStep = (topRadius - bottomRadius) / stackCount;
@@ -198,7 +533,7 @@ public:
 
             for(std::uint32_t j = 0; j <= sliceCount; j++)
             {
-                Vertex vertex;
+                Vertex vertex{};
 
                 float c = cosf(j * dTheta);
                 float s = sinf(j * dTheta);
@@ -208,15 +543,18 @@ public:
                 vertex.TexC.y = 1 - (float)i / stackCount;
                 vertex.TangentU = float3(-s, 0, c);
 
-                float dr = bottomRadius - topRadius;
-                float3 bitangent(dr * c, -height, dr * s);
+                if constexpr(Layout::template Has<VertexAttribute::Normal>)
+                {
+                    float dr = bottomRadius - topRadius;
+                    float3 bitangent(dr * c, -height, dr * s);
 
-                XMVECTOR T = XMLoadFloat3(&vertex.TangentU);
-                XMVECTOR B = XMLoadFloat3(&bitangent);
-                XMVECTOR N = XMVector3Normalize(XMVector3Cross(T, B));
-                XMStoreFloat3(&vertex.Normal, N);
+                    XMVECTOR T = XMLoadFloat3(&vertex.TangentU);
+                    XMVECTOR B = XMLoadFloat3(&bitangent);
+                    XMVECTOR N = XMVector3Normalize(XMVector3Cross(T, B));
+                    XMStoreFloat3(&vertex.Normal, N);
+                }
 
-                meshData.Vertices.push_back(vertex);
+                Layout::Store(vertices[vertexCount++], vertex);
             }
         }
 
@@ -226,27 +564,27 @@ public:
         {
             for(std::uint32_t j = 0; j < sliceCount; j++)
             {
-                meshData.Indices.push_back((Index)(i * n + j));
-                meshData.Indices.push_back((Index)((i + 1) * n + j));
-                meshData.Indices.push_back((Index)((i + 1) * n + j + 1));
+                indices[indexCount++] = (Index)(i * n + j);
+                indices[indexCount++] = (Index)((i + 1) * n + j);
+                indices[indexCount++] = (Index)((i + 1) * n + j + 1);
 
-                meshData.Indices.push_back((Index)(i * n + j));
-                meshData.Indices.push_back((Index)((i + 1) * n + j + 1));
-                meshData.Indices.push_back((Index)(i * n + j + 1));
+                indices[indexCount++] = (Index)(i * n + j);
+                indices[indexCount++] = (Index)((i + 1) * n + j + 1);
+                indices[indexCount++] = (Index)(i * n + j + 1);
             }
         }
 
 
 
-        std::uint32_t baseIndex = (std::uint32_t)meshData.Vertices.size();
+        std::uint32_t baseIndex = (std::uint32_t)vertexCount;
 
         float y = 0.5f * height;
         float dTheta = 2 * XM_PI / sliceCount;
 
-        meshData.Vertices.push_back(Vertex(
+        Layout::Store(vertices[vertexCount++], Vertex(
             float3(0, y, 0), float3(0, 1, 0), float3(1, 0, 0), float2(0.5f, 0.5f)
         ));
-        
+
         for(std::uint32_t i = 0; i <= sliceCount; i++)
         {
             float x = topRadius * cosf(i * dTheta);
@@ -255,24 +593,24 @@ public:
             float u = x / height + 0.5f;
             float v = z / height + 0.5f;
 
-            meshData.Vertices.push_back(Vertex(
+            Layout::Store(vertices[vertexCount++], Vertex(
                 float3(x, y, z), float3(0, 1, 0), float3(1, 0, 0), float2(u, v)
             ));
         }
 
         for(std::uint32_t i = 0; i < sliceCount; i++)
         {
-            meshData.Indices.push_back((Index)baseIndex);
-            meshData.Indices.push_back((Index)baseIndex + 1 + i + 1);
-            meshData.Indices.push_back((Index)baseIndex + 1 + i);
+            indices[indexCount++] = (Index)baseIndex;
+            indices[indexCount++] = (Index)(baseIndex + 1 + i + 1);
+            indices[indexCount++] = (Index)(baseIndex + 1 + i);
         }
 
 
 
-        baseIndex = (std::uint32_t)meshData.Vertices.size();
+        baseIndex = (std::uint32_t)vertexCount;
         y = -0.5f * height;
 
-        meshData.Vertices.push_back(Vertex(
+        Layout::Store(vertices[vertexCount++], Vertex(
             float3(0, y, 0), float3(0, -1, 0), float3(1, 0, 0), float2(0.5f, 0.5f)
         ));
 
@@ -284,33 +622,49 @@ public:
             float u = x / height + 0.5f;
             float v = z / height + 0.5f;
 
-            meshData.Vertices.push_back(Vertex(
+            Layout::Store(vertices[vertexCount++], Vertex(
                 float3(x, y, z), float3(0, -1, 0), float3(1, 0, 0), float2(u, v)
             ));
         }
 
         for(std::uint32_t i = 0; i < sliceCount; i++)
         {
-            meshData.Indices.push_back((Index)baseIndex);
-            meshData.Indices.push_back((Index)baseIndex + 1 + i);
-            meshData.Indices.push_back((Index)baseIndex + 1 + i + 1);
+            indices[indexCount++] = (Index)baseIndex;
+            indices[indexCount++] = (Index)(baseIndex + 1 + i);
+            indices[indexCount++] = (Index)(baseIndex + 1 + i + 1);
         }
 
+        assert(vertexCount == CylinderSize(sliceCount, stackCount).VertexCount);
+        assert(indexCount == CylinderSize(sliceCount, stackCount).IndexCount);
+    }
+
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static MeshData<Index, typename Layout::VertexType> CreateSphere(
+        float radius, std::uint32_t sliceCount, std::uint32_t stackCount,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    )
+    {
+        MeshData<Index, typename Layout::VertexType> meshData(SphereSize(sliceCount, stackCount), resource);
+        CreateSphere<Index, Layout>(radius, sliceCount, stackCount, meshData.Vertices.data(), meshData.Indices.data());
+
         return meshData;
     }
 
-    template <typename Index> requires IndexType<Index>
-    static MeshData<Index> CreateSphere(
-        float radius, std::uint32_t sliceCount, std::uint32_t stackCount
+    // vertices and indices hold SphereSize(sliceCount, stackCount).
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static void CreateSphere(
+        float radius, std::uint32_t sliceCount, std::uint32_t stackCount,
+        typename Layout::VertexType* vertices, Index* indices
     )
     {
-        MeshData<Index> meshData;
+        std::size_t vertexCount = 0;
+        std::size_t indexCount = 0;
 
         for(std::uint32_t i = 0; i <= sliceCount; i++)
         {
             for(std::uint32_t j = 0; j <= stackCount; j++)
             {
-                Vertex vertex;
+                Vertex vertex{};
 
                 float theta = XM_PI * j / stackCount;
                 float phi = XM_PI * 2 * i / sliceCount;
@@ -326,7 +680,7 @@ public:
                 vertex.TexC.x = (float)i / sliceCount;
                 vertex.TexC.y = (float)j / stackCount;
 
-                meshData.Vertices.push_back(vertex);
+                Layout::Store(vertices[vertexCount++], vertex);
             }
         }
 
@@ -341,106 +695,99 @@ public:
                 Index v2 = (Index)((i + 1) * sliceVertexCount + j + 1);
                 Index v3 = (Index)((i + 1) * sliceVertexCount + j);
 
-                meshData.Indices.push_back(v0);
-                meshData.Indices.push_back(v3);
-                meshData.Indices.push_back(v1);
+                indices[indexCount++] = v0;
+                indices[indexCount++] = v3;
+                indices[indexCount++] = v1;
 
-                meshData.Indices.push_back(v3);
-                meshData.Indices.push_back(v2);
-                meshData.Indices.push_back(v1);
+                indices[indexCount++] = v3;
+                indices[indexCount++] = v2;
+                indices[indexCount++] = v1;
             }
         }
-
-        return meshData;
     }
 
-    template <typename Index> requires IndexType<Index>
-    static MeshData<Index> CreateGeosphere(
-        float radius, std::uint32_t numSubdivisions
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static MeshData<Index, typename Layout::VertexType> CreateGeosphere(
+        float radius, std::uint32_t numSubdivisions,
+        SubdivisionMode mode = SubdivisionMode::SharedEdges,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
     )
     {
-        MeshData<Index> meshData;
-
-        if(numSubdivisions > 13)
-            numSubdivisions = 13;
-
-        constexpr float X = 0.525731f;
-        constexpr float Z = 0.850651f;
-
-        float3 pos[12] =
-        {
-            float3(-X, 0.0f, Z),  float3(X, 0.0f, Z),
-            float3(-X, 0.0f, -Z), float3(X, 0.0f, -Z),
-            float3(0.0f, Z, X),   float3(0.0f, Z, -X),
-            float3(0.0f, -Z, X),  float3(0.0f, -Z, -X),
-            float3(Z, X, 0.0f),   float3(-Z, X, 0.0f),
-            float3(Z, -X, 0.0f),  float3(-Z, -X, 0.0f)
-        };
-
-        Index k[60] = 
-        {
-            1,4,0,  4,9,0,  4,5,9,  8,5,4,  1,8,4,
-            1,10,8, 10,3,8, 8,3,5,  3,2,5,  3,7,2,
-            3,10,7, 10,6,7, 6,11,7, 6,0,11, 6,1,0,
-            10,1,6, 11,0,9, 2,11,9, 5,2,9,  11,2,7
-        };
-
-        meshData.Vertices.resize(12);
-        meshData.Indices.assign(&k[0], &k[60]);
-
-        for(std::uint32_t i = 0; i < 12; i++)
-        {
-            meshData.Vertices[i].Position = pos[i];
-        }
-
-        for(std::uint32_t i = 0; i < numSubdivisions; i++)
-        {
-            Subdivide<Index>(meshData);
-        }
+        MeshData<Index, typename Layout::VertexType> meshData(GeosphereSize(numSubdivisions, mode), resource);
+        CreateGeosphere<Index, Layout>(
+            radius, numSubdivisions, meshData.Vertices.data(), meshData.Indices.data(), mode, resource);
 
-        for(std::uint32_t i = 0; i < meshData.Vertices.size(); i++)
-        {
-            XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&meshData.Vertices[i].Position));
-            XMVECTOR p = radius * n;
-
-            XMStoreFloat3(&meshData.Vertices[i].Position, p);
-            XMStoreFloat3(&meshData.Vertices[i].Normal, n);
-
-            float phi = atan2f(meshData.Vertices[i].Position.z, meshData.Vertices[i].Position.x);
-            if(phi < 0)
-                phi += XM_2PI;
+        return meshData;
+    }
 
-            float theta = acosf(meshData.Vertices[i].Position.y / radius);
+    // vertices and indices hold GeosphereSize(numSubdivisions, mode). The unit geosphere for
+    // each level, mode and index type is built once per process (see GeosphereCache); a call
+    // copies its indices and scales its vertices. scratch provides temporary memory for the
+    // subdivision when the level is not cached yet.
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static void CreateGeosphere(
+        float radius, std::uint32_t numSubdivisions,
+        typename Layout::VertexType* vertices, Index* indices,
+        SubdivisionMode mode = SubdivisionMode::SharedEdges,
+        std::pmr::memory_resource* scratch = std::pmr::get_default_resource()
+    )
+    {
+        std::shared_ptr<const MeshData<Index>> unit =
+            GeosphereCache<Index>::Shared().Get(std::min(numSubdivisions, MaxSubdivisions), mode, scratch);
+
+        std::copy(unit->Indices.begin(), unit->Indices.end(), indices);
+
+        // Normals, texture coordinates and tangents do not depend on the radius, so only the
+        // position is scaled on the way out.
+        const Vertex* src = unit->Vertices.data();
+        int blockCount = (int)((unit->Vertices.size() + GeosphereBlock - 1) / GeosphereBlock);
+        ParallelFor(blockCount, [=](int block)
+                    {
+                        std::size_t begin = (std::size_t)block * GeosphereBlock;
+                        std::size_t end = std::min(begin + GeosphereBlock, unit->Vertices.size());
+
+                        XMVECTOR scale = XMVectorReplicate(radius);
+                        for(std::size_t i = begin; i < end; i++)
+                        {
+                            Vertex vertex = src[i];
+                            XMStoreFloat3(&vertex.Position, XMVectorMultiply(XMLoadFloat3(&vertex.Position), scale));
+                            Layout::Store(vertices[i], vertex);
+                        }
+                    });
+    }
 
-            meshData.Vertices[i].TexC.x = phi / XM_2PI;
-            meshData.Vertices[i].TexC.y = theta / XM_PI;
+    // Drops every cached unit geosphere. Meshes already created are not affected.
+    static void ClearGeosphereCache()
+    {
+        GeosphereCache<std::uint16_t>::Shared().Clear();
+        GeosphereCache<std::uint32_t>::Shared().Clear();
+    }
 
-            meshData.Vertices[i].TangentU.x = -sinf(phi);
-            meshData.Vertices[i].TangentU.y = 0;
-            meshData.Vertices[i].TangentU.z = cosf(phi);
-        }
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static MeshData<Index, typename Layout::VertexType> CreateGrid(
+        float width, float depth, std::uint32_t m, std::uint32_t n,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    )
+    {
+        MeshData<Index, typename Layout::VertexType> meshData(GridSize(m, n), resource);
+        CreateGrid<Index, Layout>(width, depth, m, n, meshData.Vertices.data(), meshData.Indices.data());
 
         return meshData;
     }
 
-    template <typename Index> requires IndexType<Index>
-    static MeshData<Index> CreateGrid(
-        float width, float depth, std::uint32_t m, std::uint32_t n
+    // vertices and indices hold GridSize(m, n).
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static void CreateGrid(
+        float width, float depth, std::uint32_t m, std::uint32_t n,
+        typename Layout::VertexType* vertices, Index* indices
     )
     {
-        MeshData<Index> meshData;
-
-        std::uint32_t vertexCount = m * n;
-        std::uint32_t faceCount = (m - 1) * (n - 1) * 2;
-
         float halfWidth = 0.5f * width;
         float halfDepth = 0.5f * depth;
 
         float dx = width / (n - 1);
         float dz = depth / (m - 1);
 
-        meshData.Vertices.resize(vertexCount);
-
         for(std::uint32_t i = 0; i < m; i++)
         {
             float z = halfDepth - i * dz;
@@ -448,164 +795,537 @@ public:
             {
                 float x = -halfWidth + j * dx;
 
-                meshData.Vertices[i * n + j].Position = float3(x, 0, z);
-                meshData.Vertices[i * n + j].Normal = float3(0, 1, 0);
-                meshData.Vertices[i * n + j].TangentU = float3(1, 0, 0);
-                meshData.Vertices[i * n + j].TexC = float2((float)j / (n-1), (float)i / (m - 1));
+                Layout::Store(vertices[i * n + j], Vertex(
+                    float3(x, 0, z), float3(0, 1, 0), float3(1, 0, 0),
+                    float2((float)j / (n - 1), (float)i / (m - 1))));
             }
         }
 
-        meshData.Indices.resize(faceCount * 3);
-
-        std::uint32_t k = 0;
+        std::size_t k = 0;
 
         for(std::uint32_t i = 0; i < m - 1; i++)
         {
             for(std::uint32_t j = 0; j < n - 1; j++)
             {
-                meshData.Indices[k] = (Index)(i * n + j);
-                meshData.Indices[k + 1] = (Index)(i * n + j + 1);
-                meshData.Indices[k + 2] = (Index)((i + 1) * n + j);
+                indices[k] = (Index)(i * n + j);
+                indices[k + 1] = (Index)(i * n + j + 1);
+                indices[k + 2] = (Index)((i + 1) * n + j);
 
-                meshData.Indices[k + 3] = (Index)((i + 1) * n + j);
-                meshData.Indices[k + 4] = (Index)(i * n + j + 1);
-                meshData.Indices[k + 5] = (Index)((i + 1) * n + j + 1);
+                indices[k + 3] = (Index)((i + 1) * n + j);
+                indices[k + 4] = (Index)(i * n + j + 1);
+                indices[k + 5] = (Index)((i + 1) * n + j + 1);
 
                 k += 6;
             }
         }
+    }
+
+    template <typename Index, typename Layout = DefaultVertexLayout, typename HeightField>
+        requires IndexType<Index> && VertexLayoutType<Layout> && HeightFieldFunction<HeightField>
+    static MeshData<Index, typename Layout::VertexType> CreateGrid(
+        float width, float depth, std::uint32_t m, std::uint32_t n, const HeightField& heightField,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    )
+    {
+        MeshData<Index, typename Layout::VertexType> meshData(GridSize(m, n), resource);
+        CreateGrid<Index, Layout>(width, depth, m, n, heightField, meshData.Vertices.data(), meshData.Indices.data());
 
         return meshData;
     }
 
-    template <typename Index> requires IndexType<Index>
-    static MeshData<Index> CreateQuad(
-        float x, float y, float w, float h, float depth
+    // Grid displaced by a height field in one pass. Rows are built in parallel; each row
+    // calls heightField on runs of up to HeightFieldBatch points, so it can evaluate them
+    // with vector math, and takes positions and normals from it. TangentU follows the
+    // surface along +x. vertices and indices hold GridSize(m, n).
+    template <typename Index, typename Layout = DefaultVertexLayout, typename HeightField>
+        requires IndexType<Index> && VertexLayoutType<Layout> && HeightFieldFunction<HeightField>
+    static void CreateGrid(
+        float width, float depth, std::uint32_t m, std::uint32_t n, const HeightField& heightField,
+        typename Layout::VertexType* vertices, Index* indices
+    )
+    {
+        float halfWidth = 0.5f * width;
+        float halfDepth = 0.5f * depth;
+
+        float dx = width / (n - 1);
+        float dz = depth / (m - 1);
+
+        ParallelFor((int)m, [=, &heightField](int row)
+                    {
+                        alignas(16) float x[HeightFieldBatch];
+                        alignas(16) float z[HeightFieldBatch];
+                        alignas(16) float heights[HeightFieldBatch];
+                        float3 normals[HeightFieldBatch];
+
+                        std::uint32_t i = (std::uint32_t)row;
+                        float rowZ = halfDepth - i * dz;
+                        float v = (float)i / (m - 1);
+
+                        for(std::uint32_t j0 = 0; j0 < n; j0 += HeightFieldBatch)
+                        {
+                            std::uint32_t count = std::min(HeightFieldBatch, n - j0);
+                            for(std::uint32_t k = 0; k < count; k++)
+                            {
+                                x[k] = -halfWidth + (j0 + k) * dx;
+                                z[k] = rowZ;
+                            }
+
+                            heightField(x, z, count, heights, normals);
+
+                            typename Layout::VertexType* out = vertices + (std::size_t)i * n + j0;
+                            for(std::uint32_t k = 0; k < count; k++)
+                            {
+                                const float3& normal = normals[k];
+
+                                Vertex vertex{};
+                                vertex.Position = float3(x[k], heights[k], z[k]);
+                                vertex.Normal = normal;
+                                vertex.TexC = float2((float)(j0 + k) / (n - 1), v);
+
+                                if constexpr(Layout::template Has<VertexAttribute::TangentU>)
+                                {
+                                    float lengthSq = normal.x * normal.x + normal.y * normal.y;
+                                    float invLength = lengthSq > 0.0f ? 1.0f / sqrtf(lengthSq) : 0.0f;
+                                    vertex.TangentU = lengthSq > 0.0f ?
+                                        float3(normal.y * invLength, -normal.x * invLength, 0.0f) : float3(1, 0, 0);
+                                }
+
+                                Layout::Store(out[k], vertex);
+                            }
+                        }
+
+                        if(i + 1 == m)
+                            return;
+
+                        Index* tri = indices + (std::size_t)i * (n - 1) * 6;
+                        for(std::uint32_t j = 0; j < n - 1; j++, tri += 6)
+                        {
+                            tri[0] = (Index)(i * n + j);
+                            tri[1] = (Index)(i * n + j + 1);
+                            tri[2] = (Index)((i + 1) * n + j);
+
+                            tri[3] = (Index)((i + 1) * n + j);
+                            tri[4] = (Index)(i * n + j + 1);
+                            tri[5] = (Index)((i + 1) * n + j + 1);
+                        }
+                    });
+    }
+
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static MeshData<Index, typename Layout::VertexType> CreateQuad(
+        float x, float y, float w, float h, float depth,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
     )
     {
-        MeshData<Index> meshData;
+        MeshData<Index, typename Layout::VertexType> meshData(QuadSize(), resource);
+        CreateQuad<Index, Layout>(x, y, w, h, depth, meshData.Vertices.data(), meshData.Indices.data());
 
-        meshData.Vertices.resize(4);
-        meshData.Indices.resize(6);
+        return meshData;
+    }
 
-        meshData.Vertices[0] = Vertex(
+    // vertices and indices hold QuadSize().
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static void CreateQuad(
+        float x, float y, float w, float h, float depth,
+        typename Layout::VertexType* vertices, Index* indices
+    )
+    {
+        Layout::Store(vertices[0], Vertex(
             x, y - h, depth,
             0.0f, 0.0f, -1.0f,
             1.0f, 0.0f, 0.0f,
-            0.0f, 1.0f);
+            0.0f, 1.0f));
 
-        meshData.Vertices[1] = Vertex(
+        Layout::Store(vertices[1], Vertex(
             x, y, depth,
             0.0f, 0.0f, -1.0f,
             1.0f, 0.0f, 0.0f,
-            0.0f, 0.0f);
+            0.0f, 0.0f));
 
-        meshData.Vertices[2] = Vertex(
+        Layout::Store(vertices[2], Vertex(
             x + w, y, depth,
             0.0f, 0.0f, -1.0f,
             1.0f, 0.0f, 0.0f,
-            1.0f, 0.0f);
+            1.0f, 0.0f));
 
-        meshData.Vertices[3] = Vertex(
+        Layout::Store(vertices[3], Vertex(
             x + w, y - h, depth,
             0.0f, 0.0f, -1.0f,
             1.0f, 0.0f, 0.0f,
-            1.0f, 1.0f);
+            1.0f, 1.0f));
 
-        meshData.Indices[0] = (Index)0;
-        meshData.Indices[1] = (Index)1;
-        meshData.Indices[2] = (Index)2;
-                              (Index)
-        meshData.Indices[3] = (Index)0;
-        meshData.Indices[4] = (Index)2;
-        meshData.Indices[5] = (Index)3;
+        indices[0] = (Index)0;
+        indices[1] = (Index)1;
+        indices[2] = (Index)2;
 
-        return meshData;
+        indices[3] = (Index)0;
+        indices[4] = (Index)2;
+        indices[5] = (Index)3;
     }
 
-    template <typename Index> requires IndexType<Index>
-    static void Subdivide(MeshData<Index>& meshData)
-    {
-        MeshData<Index> inputCopy = meshData;
-
-        meshData.Vertices.resize(0);
-        meshData.Indices.resize(0);
-        meshData.mIndices16.resize(0);
-        meshData.mIndices32.resize(0);
-
-        //       v1
-        //       *
-        //      / \
-	    //     /   \
-	    //  m0*-----*m1
-        //   / \   / \
-	    //  /   \ /   \
-	    // *-----*-----*
-        // v0    m2     v2
-
-        std::uint32_t numTris = (std::uint32_t)inputCopy.Indices.size() / 3;
-        for(std::uint32_t i = 0; i < numTris; i++)
-        {
-            Vertex v0 = inputCopy.Vertices[inputCopy.Indices[i * 3]];
-            Vertex v1 = inputCopy.Vertices[inputCopy.Indices[i * 3 + 1]];
-            Vertex v2 = inputCopy.Vertices[inputCopy.Indices[i * 3 + 2]];
-
-            Vertex m0 = MidPoint(v0, v1);
-            Vertex m1 = MidPoint(v1, v2);
-            Vertex m2 = MidPoint(v0, v2);
-
-            meshData.Vertices.push_back(v0); // 0
-            meshData.Vertices.push_back(v1); // 1
-            meshData.Vertices.push_back(v2); // 2
-            meshData.Vertices.push_back(m0); // 3
-            meshData.Vertices.push_back(m1); // 4
-            meshData.Vertices.push_back(m2); // 5
-
-            meshData.Indices.push_back(i * 6);
-            meshData.Indices.push_back(i * 6 + 3);
-            meshData.Indices.push_back(i * 6 + 5);
-
-            meshData.Indices.push_back(i * 6 + 3);
-            meshData.Indices.push_back(i * 6 + 4);
-            meshData.Indices.push_back(i * 6 + 5);
-
-            meshData.Indices.push_back(i * 6 + 5);
-            meshData.Indices.push_back(i * 6 + 4);
-            meshData.Indices.push_back(i * 6 + 2);
-
-            meshData.Indices.push_back(i * 6 + 3);
-            meshData.Indices.push_back(i * 6 + 1);
-            meshData.Indices.push_back(i * 6 + 4);
+    // Subdivides meshData in place. Duplicate output is sized exactly; SharedEdges reserves
+    // room for every edge being unshared and trims the vertex list afterwards. Scratch memory
+    // comes from the mesh's own memory resource.
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static void Subdivide(
+        MeshData<Index, typename Layout::VertexType>& meshData, SubdivisionMode mode = SubdivisionMode::SharedEdges)
+    {
+        std::size_t vertexCount = meshData.Vertices.size();
+        std::size_t triangleCount = meshData.Indices.size() / 3;
+
+        std::size_t maxVertexCount = mode == SubdivisionMode::SharedEdges ?
+            vertexCount + triangleCount * 3 : std::max(vertexCount, triangleCount * 6);
+        meshData.Vertices.resize(maxVertexCount);
+        meshData.Indices.resize(triangleCount * 12);
+
+        vertexCount = SubdivideInPlace<Index, Layout>(
+            meshData.Vertices.data(), vertexCount, meshData.Indices.data(), triangleCount, mode,
+            meshData.Vertices.get_allocator().resource());
+        meshData.Vertices.resize(vertexCount);
+    }
+
+    // One round of subdivision of triangleCount triangles over vertexCount vertices, in place:
+    // indices must have room for 4x the triangles and vertices for the new vertex count,
+    // which is returned.
+    //
+    //       v1
+    //       *
+    //      / \
+    //     /   \
+    //  m0*-----*m1
+    //   / \   / \
+    //  /   \ /   \
+    // *-----*-----*
+    // v0    m2     v2
+    //
+    // Triangle i becomes triangles 4i..4i+3. They are written from the last triangle back, so
+    // the larger output never overwrites input that has not been read yet.
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static std::size_t SubdivideInPlace(
+        typename Layout::VertexType* vertices, std::size_t vertexCount, Index* indices, std::size_t triangleCount,
+        SubdivisionMode mode, std::pmr::memory_resource* scratch)
+    {
+        if(mode == SubdivisionMode::SharedEdges)
+            return SubdivideSharedEdges<Index, Layout>(vertices, vertexCount, indices, triangleCount, scratch);
+
+        // Every output vertex block may land on input vertices that are still needed.
+        using VertexT = typename Layout::VertexType;
+        std::pmr::vector<VertexT> input(vertices, vertices + vertexCount, scratch);
+
+        for(std::size_t i = triangleCount; i-- > 0;)
+        {
+            VertexT v0 = input[indices[i * 3]];
+            VertexT v1 = input[indices[i * 3 + 1]];
+            VertexT v2 = input[indices[i * 3 + 2]];
+
+            VertexT* out = vertices + i * 6;
+            out[0] = v0;
+            out[1] = v1;
+            out[2] = v2;
+            out[3] = MidPoint<Layout>(v0, v1);
+            out[4] = MidPoint<Layout>(v1, v2);
+            out[5] = MidPoint<Layout>(v0, v2);
+
+            std::size_t base = i * 6;
+            Index* tri = indices + i * 12;
+            tri[0] = (Index)base;       tri[1] = (Index)(base + 3);  tri[2] = (Index)(base + 5);
+            tri[3] = (Index)(base + 3); tri[4] = (Index)(base + 4);  tri[5] = (Index)(base + 5);
+            tri[6] = (Index)(base + 5); tri[7] = (Index)(base + 4);  tri[8] = (Index)(base + 2);
+            tri[9] = (Index)(base + 3); tri[10] = (Index)(base + 1); tri[11] = (Index)(base + 4);
+        }
+
+        return triangleCount * 6;
+    }
+
+    // The input vertices keep their indices and every edge midpoint is appended once, by the
+    // first triangle that reaches the edge.
+    template <typename Index, typename Layout = DefaultVertexLayout> requires IndexType<Index> && VertexLayoutType<Layout>
+    static std::size_t SubdivideSharedEdges(
+        typename Layout::VertexType* vertices, std::size_t vertexCount, Index* indices, std::size_t triangleCount,
+        std::pmr::memory_resource* scratch)
+    {
+        EdgeMidpointCache cache(triangleCount * 3, scratch);
+        auto midPoint = [&](std::uint32_t a, std::uint32_t b)
+        {
+            bool inserted = false;
+            std::uint32_t& index = cache.Find(a, b, inserted);
+            if(inserted)
+            {
+                index = (std::uint32_t)vertexCount;
+                vertices[vertexCount++] = MidPoint<Layout>(vertices[a], vertices[b]);
+            }
+            return (Index)index;
+        };
+
+        for(std::size_t i = triangleCount; i-- > 0;)
+        {
+            Index v0 = indices[i * 3];
+            Index v1 = indices[i * 3 + 1];
+            Index v2 = indices[i * 3 + 2];
+
+            Index m0 = midPoint(v0, v1);
+            Index m1 = midPoint(v1, v2);
+            Index m2 = midPoint(v0, v2);
+
+            Index* tri = indices + i * 12;
+            tri[0] = v0; tri[1] = m0;  tri[2] = m2;
+            tri[3] = m0; tri[4] = m1;  tri[5] = m2;
+            tri[6] = m2; tri[7] = m1;  tri[8] = v2;
+            tri[9] = m0; tri[10] = v1; tri[11] = m1;
         }
+
+        assert(vertexCount - 1 <= std::numeric_limits<Index>::max());
+
+        return vertexCount;
     }
 
     static Vertex MidPoint(const Vertex& v0, const Vertex& v1)
     {
-        XMVECTOR p0 = XMLoadFloat3(&v0.Position);
-        XMVECTOR p1 = XMLoadFloat3(&v1.Position);
+        return MidPoint<DefaultVertexLayout>(v0, v1);
+    }
+
+    // Midpoint of the layout's attributes; members outside the layout are copied from v0.
+    template <typename Layout> requires VertexLayoutType<Layout>
+    static typename Layout::VertexType MidPoint(
+        const typename Layout::VertexType& v0, const typename Layout::VertexType& v1)
+    {
+        Vertex a = Layout::Load(v0);
+        Vertex b = Layout::Load(v1);
+        Vertex v{};
+
+        XMVECTOR p0 = XMLoadFloat3(&a.Position);
+        XMVECTOR p1 = XMLoadFloat3(&b.Position);
+        XMStoreFloat3(&v.Position, 0.5f * (p0 + p1));
+
+        if constexpr(Layout::template Has<VertexAttribute::Normal>)
+        {
+            XMVECTOR n0 = XMLoadFloat3(&a.Normal);
+            XMVECTOR n1 = XMLoadFloat3(&b.Normal);
+            XMStoreFloat3(&v.Normal, XMVector3Normalize(0.5f * (n0 + n1)));
+        }
+
+        if constexpr(Layout::template Has<VertexAttribute::TangentU>)
+        {
+            XMVECTOR tan0 = XMLoadFloat3(&a.TangentU);
+            XMVECTOR tan1 = XMLoadFloat3(&b.TangentU);
+            XMStoreFloat3(&v.TangentU, XMVector3Normalize(0.5f * (tan0 + tan1)));
+        }
+
+        if constexpr(Layout::template Has<VertexAttribute::TexC>)
+        {
+            XMVECTOR tex0 = XMLoadFloat2(&a.TexC);
+            XMVECTOR tex1 = XMLoadFloat2(&b.TexC);
+            XMStoreFloat2(&v.TexC, 0.5f * (tex0 + tex1));
+        }
+
+        typename Layout::VertexType result = v0;
+        Layout::Store(result, v);
+
+        return result;
+    }
+
+private:
+    // Row- and batch-parallel passes run on the shared work-stealing pool (see TaskPool.h),
+    // which works with and without the concurrency runtime.
+    template <typename Fn>
+    static void ParallelFor(int count, const Fn& fn)
+    {
+        TaskPool::WorkStealingPool::Shared().ParallelFor(count, fn);
+    }
 
-        XMVECTOR n0 = XMLoadFloat3(&v0.Normal);
-        XMVECTOR n1 = XMLoadFloat3(&v1.Normal);
+    // Vertices per task when scaling a cached geosphere.
+    static constexpr std::size_t GeosphereBlock = 16384;
 
-        XMVECTOR tan0 = XMLoadFloat3(&v0.TangentU);
-        XMVECTOR tan1 = XMLoadFloat3(&v1.TangentU);
+    using PositionLayout = VertexLayout<Vertex, VertexElement<VertexAttribute::Position, &Vertex::Position>>;
 
-        XMVECTOR tex0 = XMLoadFloat2(&v0.TexC);
-        XMVECTOR tex1 = XMLoadFloat2(&v1.TexC);
+    // Geosphere of radius 1 with every attribute. Subdivision only carries positions; the
+    // other attributes follow from the normalized position.
+    template <typename Index> requires IndexType<Index>
+    static MeshData<Index> BuildUnitGeosphere(
+        std::uint32_t numSubdivisions, SubdivisionMode mode, std::pmr::memory_resource* scratch)
+    {
+        constexpr float X = 0.525731f;
+        constexpr float Z = 0.850651f;
 
-        XMVECTOR p = 0.5f * (p0 + p1);
-        XMVECTOR n = XMVector3Normalize(0.5f * (n0 + n1));
-        XMVECTOR tan = XMVector3Normalize(0.5f * (tan0 + tan1));
-        XMVECTOR tex = 0.5f * (tex0 + tex1);
+        float3 pos[12] =
+        {
+            float3(-X, 0.0f, Z),  float3(X, 0.0f, Z),
+            float3(-X, 0.0f, -Z), float3(X, 0.0f, -Z),
+            float3(0.0f, Z, X),   float3(0.0f, Z, -X),
+            float3(0.0f, -Z, X),  float3(0.0f, -Z, -X),
+            float3(Z, X, 0.0f),   float3(-Z, X, 0.0f),
+            float3(Z, -X, 0.0f),  float3(-Z, -X, 0.0f)
+        };
+
+        Index k[60] =
+        {
+            1,4,0,  4,9,0,  4,5,9,  8,5,4,  1,8,4,
+            1,10,8, 10,3,8, 8,3,5,  3,2,5,  3,7,2,
+            3,10,7, 10,6,7, 6,11,7, 6,0,11, 6,1,0,
+            10,1,6, 11,0,9, 2,11,9, 5,2,9,  11,2,7
+        };
 
-        Vertex v;
-        XMStoreFloat3(&v.Position, p);
-        XMStoreFloat3(&v.Normal, n);
-        XMStoreFloat3(&v.TangentU, tan);
-        XMStoreFloat2(&v.TexC, tex);
+        // Cached meshes outlive any caller's memory resource.
+        MeshData<Index> meshData(GeosphereSize(numSubdivisions, mode), std::pmr::new_delete_resource());
+        Vertex* vertices = meshData.Vertices.data();
+        Index* indices = meshData.Indices.data();
 
-        return v;
+        std::copy(&k[0], &k[60], indices);
+
+        for(std::uint32_t i = 0; i < 12; i++)
+        {
+            vertices[i] = Vertex();
+            vertices[i].Position = pos[i];
+        }
+
+        std::size_t vertexCount = 12;
+        std::size_t triangleCount = 20;
+        for(std::uint32_t i = 0; i < numSubdivisions; i++)
+        {
+            vertexCount = SubdivideInPlace<Index, PositionLayout>(vertices, vertexCount, indices, triangleCount, mode, scratch);
+            triangleCount *= 4;
+        }
+
+        assert(vertexCount == meshData.Vertices.size());
+
+        ParallelFor((int)((vertexCount + GeosphereBlock - 1) / GeosphereBlock), [=](int block)
+                    {
+                        std::size_t begin = (std::size_t)block * GeosphereBlock;
+                        std::size_t end = std::min(begin + GeosphereBlock, vertexCount);
+
+                        for(std::size_t i = begin; i < end; i++)
+                        {
+                            Vertex& vertex = vertices[i];
+
+                            XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&vertex.Position));
+                            XMStoreFloat3(&vertex.Position, n);
+                            XMStoreFloat3(&vertex.Normal, n);
+
+                            float phi = atan2f(vertex.Position.z, vertex.Position.x);
+                            if(phi < 0)
+                                phi += XM_2PI;
+
+                            float theta = acosf(std::clamp(vertex.Position.y, -1.0f, 1.0f));
+
+                            vertex.TexC.x = phi / XM_2PI;
+                            vertex.TexC.y = theta / XM_PI;
+
+                            vertex.TangentU.x = -sinf(phi);
+                            vertex.TangentU.y = 0;
+                            vertex.TangentU.z = cosf(phi);
+                        }
+                    });
+
+        return meshData;
     }
+
+    // Process-wide cache of unit geospheres for one index type, one entry per subdivision
+    // level and mode. The map lock is only held to find the entry; the first caller of a
+    // level builds it under the entry's once_flag while callers of other levels go ahead.
+    // Entries are immutable and shared, so Clear() never invalidates a mesh in use.
+    template <typename Index> requires IndexType<Index>
+    class GeosphereCache
+    {
+    public:
+        static GeosphereCache& Shared()
+        {
+            static GeosphereCache cache;
+            return cache;
+        }
+
+        std::shared_ptr<const MeshData<Index>> Get(
+            std::uint32_t numSubdivisions, SubdivisionMode mode, std::pmr::memory_resource* scratch)
+        {
+            std::shared_ptr<Entry> entry;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                std::shared_ptr<Entry>& slot = mEntries[numSubdivisions * 2 + (mode == SubdivisionMode::SharedEdges)];
+                if(!slot)
+                    slot = std::make_shared<Entry>();
+                entry = slot;
+            }
+
+            std::call_once(entry->Built, [&]()
+                           {
+                               entry->Mesh = std::make_shared<const MeshData<Index>>(
+                                   BuildUnitGeosphere<Index>(numSubdivisions, mode, scratch));
+                           });
+
+            return entry->Mesh;
+        }
+
+        void Clear()
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for(std::shared_ptr<Entry>& entry : mEntries)
+                entry.reset();
+        }
+
+    private:
+        struct Entry
+        {
+            std::once_flag Built;
+            std::shared_ptr<const MeshData<Index>> Mesh;
+        };
+
+        std::mutex mMutex;
+        std::array<std::shared_ptr<Entry>, (MaxSubdivisions + 1) * 2> mEntries;
+    };
+
+    // Open-addressing map from an undirected edge to the index of its midpoint vertex. The
+    // key packs the smaller vertex index into the high half, so (a, b) and (b, a) meet in
+    // the same slot. The table is sized for maxEdges and stays at most 3/4 full.
+    class EdgeMidpointCache
+    {
+    public:
+        EdgeMidpointCache(std::size_t maxEdges, std::pmr::memory_resource* resource) :
+            mKeys(resource),
+            mValues(resource)
+        {
+            std::size_t capacity = 16;
+            int bits = 4;
+            while(capacity * 3 < maxEdges * 4)
+            {
+                capacity <<= 1;
+                bits++;
+            }
+
+            mKeys.assign(capacity, EmptyKey);
+            mValues.resize(capacity);
+            mMask = capacity - 1;
+            mShift = 64 - bits;
+        }
+
+        // Slot holding the midpoint of edge (a, b). inserted is set when the edge was not
+        // cached yet, in which case the caller stores the new vertex index in the slot.
+        std::uint32_t& Find(std::uint32_t a, std::uint32_t b, bool& inserted)
+        {
+            std::uint64_t key = a < b ? ((std::uint64_t)a << 32) | b : ((std::uint64_t)b << 32) | a;
+            std::size_t slot = (std::size_t)((key * 0x9E3779B97F4A7C15ull) >> mShift);
+
+            while(mKeys[slot] != key)
+            {
+                if(mKeys[slot] == EmptyKey)
+                {
+                    mKeys[slot] = key;
+                    inserted = true;
+                    break;
+                }
+                slot = (slot + 1) & mMask;
+            }
+
+            return mValues[slot];
+        }
+
+    private:
+        // a == b never forms an edge, so this key is free.
+        static constexpr std::uint64_t EmptyKey = ~0ull;
+
+        std::pmr::vector<std::uint64_t> mKeys;
+        std::pmr::vector<std::uint32_t> mValues;
+        std::size_t mMask = 0;
+        int mShift = 0;
+    };
 };
 
-#endif
\ No newline at end of file
+#endif
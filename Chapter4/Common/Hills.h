@@ -0,0 +1,72 @@
+#pragma once
+
+#ifndef D3D12BOOK_HILLS_H
+#define D3D12BOOK_HILLS_H
+
+#include "GeometryGenerator.h"
+#include <cmath>
+#include <cstddef>
+
+// The rolling hills of the land-and-waves demos, y = 0.3 * (z * sin(0.1 * x) + x * cos(0.1 * z)).
+class Hills
+{
+public:
+    static float Height(float x, float z)
+    {
+        return 0.3f * (z * sinf(0.1f * x) + x * cosf(0.1f * z));
+    }
+
+    static float3 Normal(float x, float z)
+    {
+        float3 n(
+            -0.03f * z * cosf(0.1f * x) - 0.3f * cosf(0.1f * z),
+            1.0f,
+            -0.3f * sinf(0.1f * x) + 0.03f * x * sinf(0.1f * z));
+
+        XMVECTOR unitNormal = XMVector3Normalize(XMLoadFloat3(&n));
+        XMStoreFloat3(&n, unitNormal);
+
+        return n;
+    }
+
+    // Height and Normal for a batch of points, four at a time with DirectXMath's vector sine
+    // and cosine. Matches HeightFieldFunction, so it can be passed to
+    // GeometryGenerator::CreateGrid directly.
+    static void Surface(const float* x, const float* z, std::size_t count, float* heights, float3* normals)
+    {
+        std::size_t i = 0;
+        for(; i + 4 <= count; i += 4)
+        {
+            XMVECTOR px = XMLoadFloat4(reinterpret_cast<const float4*>(x + i));
+            XMVECTOR pz = XMLoadFloat4(reinterpret_cast<const float4*>(z + i));
+
+            XMVECTOR sinX, cosX, sinZ, cosZ;
+            XMVectorSinCos(&sinX, &cosX, 0.1f * px);
+            XMVectorSinCos(&sinZ, &cosZ, 0.1f * pz);
+
+            XMStoreFloat4(reinterpret_cast<float4*>(heights + i), 0.3f * (pz * sinX + px * cosZ));
+
+            XMVECTOR nx = -0.03f * pz * cosX - 0.3f * cosZ;
+            XMVECTOR nz = -0.3f * sinX + 0.03f * px * sinZ;
+            XMVECTOR invLength = XMVectorReciprocalSqrt(nx * nx + nz * nz + XMVectorSplatOne());
+
+            float4 ex, ey, ez;
+            XMStoreFloat4(&ex, nx * invLength);
+            XMStoreFloat4(&ey, invLength);
+            XMStoreFloat4(&ez, nz * invLength);
+
+            normals[i] = float3(ex.x, ey.x, ez.x);
+            normals[i + 1] = float3(ex.y, ey.y, ez.y);
+            normals[i + 2] = float3(ex.z, ey.z, ez.z);
+            normals[i + 3] = float3(ex.w, ey.w, ez.w);
+        }
+
+        for(; i < count; i++)
+        {
+            heights[i] = Height(x[i], z[i]);
+            normals[i] = Normal(x[i], z[i]);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,484 @@
+#pragma once
+
+#ifndef D3D12BOOK_MESHOPTIMIZER_H
+#define D3D12BOOK_MESHOPTIMIZER_H
+
+#include "GeometryGenerator.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Reorders triangle lists for the GPU: triangles for the post-transform vertex cache (Tipsify,
+// Sander et al. 2007), clusters of those triangles front to back against overdraw, and vertices
+// in first-use order for the pre-transform fetch. Each pass works on raw vertex/index arrays;
+// Optimize() runs all three and measures the result with a software cache model, so the effect
+// can be checked without a GPU.
+//
+// The passes take the vertex type as a template parameter and find positions through a pointer
+// to member, e.g. &GeometryGenerator::Vertex::Position.
+class MeshOptimizer
+{
+public:
+    // FIFO matches the fixed-function caches the ACMR literature is written against; LRU is
+    // closer to how current hardware reuses vertices within a wave.
+    enum class CacheModel
+    {
+        Fifo,
+        Lru
+    };
+
+    static constexpr std::uint32_t DefaultCacheSize = 16;
+
+    // A cluster may be split as long as its own ACMR stays within this factor of the ACMR of
+    // the unsplit cluster. Higher values trade vertex reuse for better front-to-back order.
+    static constexpr float DefaultOverdrawThreshold = 1.05f;
+
+    struct VertexCacheStats
+    {
+        std::size_t VertexTransforms = 0;
+
+        // Average cache miss ratio: transforms per triangle, 0.5 at best for large meshes and
+        // 3 at worst.
+        float ACMR = 0.0f;
+
+        // Average transform to vertex ratio: transforms per referenced vertex, 1 at best.
+        float ATVR = 0.0f;
+    };
+
+    struct Report
+    {
+        VertexCacheStats FifoBefore;
+        VertexCacheStats FifoAfter;
+        VertexCacheStats LruBefore;
+        VertexCacheStats LruAfter;
+        std::size_t ClusterCount = 0;
+        std::size_t VertexCountBefore = 0;
+        std::size_t VertexCountAfter = 0;
+    };
+
+    // Simulates a post-transform cache of cacheSize entries over the index list.
+    template <typename Index> requires IndexType<Index>
+    static VertexCacheStats AnalyzeVertexCache(
+        const Index* indices, std::size_t indexCount, std::size_t vertexCount,
+        std::uint32_t cacheSize = DefaultCacheSize, CacheModel model = CacheModel::Fifo)
+    {
+        assert(cacheSize > 0);
+
+        VertexCacheStats stats;
+        if(indexCount < 3)
+            return stats;
+
+        std::vector<char> referenced(vertexCount, 0);
+        std::size_t referencedCount = 0;
+
+        if(model == CacheModel::Fifo)
+        {
+            FifoCache cache(vertexCount, cacheSize);
+            for(std::size_t i = 0; i < indexCount; i++)
+                stats.VertexTransforms += cache.Access(indices[i]);
+        }
+        else
+        {
+            std::vector<std::uint32_t> cache;
+            cache.reserve(cacheSize);
+            for(std::size_t i = 0; i < indexCount; i++)
+            {
+                std::uint32_t v = indices[i];
+                auto it = std::find(cache.begin(), cache.end(), v);
+                if(it == cache.end())
+                {
+                    stats.VertexTransforms++;
+                    if(cache.size() < cacheSize)
+                        cache.push_back(v);
+                    it = cache.end() - 1;
+                    *it = v;
+                }
+
+                std::rotate(cache.begin(), it, it + 1);
+            }
+        }
+
+        for(std::size_t i = 0; i < indexCount; i++)
+        {
+            if(!referenced[indices[i]])
+            {
+                referenced[indices[i]] = 1;
+                referencedCount++;
+            }
+        }
+
+        stats.ACMR = (float)stats.VertexTransforms / (float)(indexCount / 3);
+        stats.ATVR = (float)stats.VertexTransforms / (float)referencedCount;
+        return stats;
+    }
+
+    // Tipsify: fans around a vertex until its triangles are used up, then moves to the
+    // neighbour that was transformed longest ago and is still expected to be in the cache,
+    // falling back to recently emitted vertices and finally to the next unused vertex. Runs in
+    // time linear in the mesh size. dst may be the same array as indices.
+    template <typename Index> requires IndexType<Index>
+    static void OptimizeVertexCache(
+        Index* dst, const Index* indices, std::size_t indexCount, std::size_t vertexCount,
+        std::uint32_t cacheSize = DefaultCacheSize)
+    {
+        std::vector<Index> source;
+        if(dst == indices)
+        {
+            source.assign(indices, indices + indexCount);
+            indices = source.data();
+        }
+
+        TriangleAdjacency adjacency(indices, indexCount, vertexCount);
+        std::vector<std::uint32_t> live(vertexCount);
+        for(std::size_t v = 0; v < vertexCount; v++)
+            live[v] = adjacency.Offsets[v + 1] - adjacency.Offsets[v];
+
+        std::vector<char> emitted(indexCount / 3, 0);
+        std::vector<std::uint32_t> deadEnds;
+        deadEnds.reserve(indexCount);
+
+        FifoCache cache(vertexCount, cacheSize);
+        std::size_t cursor = 0;
+        std::size_t out = 0;
+
+        std::int64_t fan = SkipDeadEnd(live, deadEnds, cursor);
+        while(fan >= 0)
+        {
+            std::size_t candidates = deadEnds.size();
+
+            for(std::uint32_t a = adjacency.Offsets[fan]; a < adjacency.Offsets[fan + 1]; a++)
+            {
+                std::uint32_t t = adjacency.Triangles[a];
+                if(emitted[t])
+                    continue;
+
+                for(int k = 0; k < 3; k++)
+                {
+                    Index v = indices[t * 3 + k];
+                    dst[out++] = v;
+                    deadEnds.push_back(v);
+                    live[v]--;
+                    cache.Access(v);
+                }
+
+                emitted[t] = 1;
+            }
+
+            std::int64_t next = -1;
+            std::int64_t bestPriority = -1;
+            for(std::size_t i = candidates; i < deadEnds.size(); i++)
+            {
+                std::uint32_t v = deadEnds[i];
+                if(live[v] == 0)
+                    continue;
+
+                std::int64_t priority = 0;
+                std::int64_t age = cache.Age(v);
+                if(age + 2 * (std::int64_t)live[v] <= (std::int64_t)cacheSize)
+                    priority = age;
+
+                if(priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    next = v;
+                }
+            }
+
+            fan = next >= 0 ? next : SkipDeadEnd(live, deadEnds, cursor);
+        }
+
+        std::copy(indices + out, indices + indexCount, dst + out);
+    }
+
+    // Splits the triangle list into clusters and draws the clusters that face away from the
+    // mesh centre first, so that the outer surface of a roughly convex mesh fills the depth
+    // buffer before the surfaces behind it. Clusters start wherever the cache model has to
+    // reload a whole triangle, and are split further while each piece keeps its ACMR within
+    // threshold of the whole cluster. Meant to run after OptimizeVertexCache. dst may be the
+    // same array as indices. Returns the number of clusters.
+    template <typename Index, typename VertexT> requires IndexType<Index>
+    static std::size_t OptimizeOverdraw(
+        Index* dst, const Index* indices, std::size_t indexCount,
+        const VertexT* vertices, std::size_t vertexCount, float3 VertexT::* position,
+        std::uint32_t cacheSize = DefaultCacheSize, float threshold = DefaultOverdrawThreshold)
+    {
+        std::size_t triangleCount = indexCount / 3;
+        if(triangleCount == 0)
+            return 0;
+
+        std::vector<Index> source;
+        if(dst == indices)
+        {
+            source.assign(indices, indices + indexCount);
+            indices = source.data();
+        }
+
+        FifoCache cache(vertexCount, cacheSize);
+        auto misses = [&](std::size_t t)
+        {
+            return cache.Access(indices[t * 3]) + cache.Access(indices[t * 3 + 1]) + cache.Access(indices[t * 3 + 2]);
+        };
+
+        std::vector<std::uint32_t> hardClusters;
+        for(std::size_t t = 0; t < triangleCount; t++)
+        {
+            if(misses(t) == 3)
+                hardClusters.push_back((std::uint32_t)t);
+        }
+        if(hardClusters.empty() || hardClusters[0] != 0)
+            hardClusters.insert(hardClusters.begin(), 0);
+        hardClusters.push_back((std::uint32_t)triangleCount);
+
+        std::vector<std::uint32_t> clusters;
+        for(std::size_t c = 0; c + 1 < hardClusters.size(); c++)
+        {
+            std::size_t begin = hardClusters[c];
+            std::size_t end = hardClusters[c + 1];
+
+            cache.Flush();
+            std::size_t total = 0;
+            for(std::size_t t = begin; t < end; t++)
+                total += misses(t);
+            float target = threshold * (float)total / (float)(end - begin);
+
+            cache.Flush();
+            clusters.push_back((std::uint32_t)begin);
+            std::size_t start = begin;
+            std::size_t count = 0;
+            for(std::size_t t = begin; t + 1 < end; t++)
+            {
+                count += misses(t);
+                if((float)count <= target * (float)(t + 1 - start))
+                {
+                    clusters.push_back((std::uint32_t)(t + 1));
+                    start = t + 1;
+                    count = 0;
+                    cache.Flush();
+                }
+            }
+        }
+
+        std::size_t clusterCount = clusters.size();
+        clusters.push_back((std::uint32_t)triangleCount);
+
+        XMVECTOR meshCenter = XMVectorZero();
+        for(std::size_t v = 0; v < vertexCount; v++)
+            meshCenter += XMLoadFloat3(&(vertices[v].*position));
+        if(vertexCount > 0)
+            meshCenter = meshCenter / (float)vertexCount;
+
+        // A cluster's key is the distance of its area-weighted centre along its average normal,
+        // measured from the mesh centre: the further out a cluster faces, the earlier it draws.
+        std::vector<float> keys(clusterCount);
+        for(std::size_t c = 0; c < clusterCount; c++)
+        {
+            XMVECTOR center = XMVectorZero();
+            XMVECTOR normal = XMVectorZero();
+            float area = 0.0f;
+            for(std::size_t t = clusters[c]; t < clusters[c + 1]; t++)
+            {
+                XMVECTOR p0 = XMLoadFloat3(&(vertices[indices[t * 3]].*position));
+                XMVECTOR p1 = XMLoadFloat3(&(vertices[indices[t * 3 + 1]].*position));
+                XMVECTOR p2 = XMLoadFloat3(&(vertices[indices[t * 3 + 2]].*position));
+
+                XMVECTOR n = XMVector3Cross(p1 - p0, p2 - p0);
+                float a = std::sqrt(XMVectorGetX(XMVector3Dot(n, n)));
+
+                center += (p0 + p1 + p2) * (a / 3.0f);
+                normal += n;
+                area += a;
+            }
+
+            float length = std::sqrt(XMVectorGetX(XMVector3Dot(normal, normal)));
+            if(area > 0.0f && length > 0.0f)
+                keys[c] = XMVectorGetX(XMVector3Dot(center / area - meshCenter, normal / length));
+            else
+                keys[c] = 0.0f;
+        }
+
+        std::vector<std::uint32_t> order(clusterCount);
+        for(std::size_t c = 0; c < clusterCount; c++)
+            order[c] = (std::uint32_t)c;
+        std::stable_sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) { return keys[a] > keys[b]; });
+
+        std::size_t out = 0;
+        for(std::uint32_t c : order)
+        {
+            std::size_t first = (std::size_t)clusters[c] * 3;
+            std::size_t last = (std::size_t)clusters[c + 1] * 3;
+            std::copy(indices + first, indices + last, dst + out);
+            out += last - first;
+        }
+
+        std::copy(indices + out, indices + indexCount, dst + out);
+        return clusterCount;
+    }
+
+    // Reorders the vertices into the order the index list first uses them, rewriting the
+    // indices to match, and drops vertices that no triangle references. dstVertices needs room
+    // for vertexCount vertices and may be the same array as vertices. Returns the number of
+    // vertices written.
+    template <typename Index, typename VertexT> requires IndexType<Index>
+    static std::size_t OptimizeVertexFetch(
+        VertexT* dstVertices, Index* indices, std::size_t indexCount,
+        const VertexT* vertices, std::size_t vertexCount)
+    {
+        std::vector<VertexT> source;
+        if(dstVertices == vertices)
+        {
+            source.assign(vertices, vertices + vertexCount);
+            vertices = source.data();
+        }
+
+        constexpr std::uint32_t unused = ~0u;
+        std::vector<std::uint32_t> remap(vertexCount, unused);
+        std::uint32_t next = 0;
+        for(std::size_t i = 0; i < indexCount; i++)
+        {
+            Index v = indices[i];
+            if(remap[v] == unused)
+            {
+                dstVertices[next] = vertices[v];
+                remap[v] = next++;
+            }
+            indices[i] = (Index)remap[v];
+        }
+
+        return next;
+    }
+
+    // Runs OptimizeVertexCache, OptimizeOverdraw and OptimizeVertexFetch in place and reports
+    // the cache behaviour before and after, keeping the input triangle order when it already
+    // beats OptimizeVertexCache. vertexCount is updated to the number of vertices
+    // still referenced.
+    template <typename Index, typename VertexT> requires IndexType<Index>
+    static Report Optimize(
+        VertexT* vertices, std::size_t& vertexCount, Index* indices, std::size_t indexCount,
+        float3 VertexT::* position,
+        std::uint32_t cacheSize = DefaultCacheSize, float threshold = DefaultOverdrawThreshold)
+    {
+        Report report;
+        report.VertexCountBefore = vertexCount;
+        report.FifoBefore = AnalyzeVertexCache(indices, indexCount, vertexCount, cacheSize, CacheModel::Fifo);
+        report.LruBefore = AnalyzeVertexCache(indices, indexCount, vertexCount, cacheSize, CacheModel::Lru);
+
+        // Meshes that come from an offline optimizer can already beat Tipsify; keep their order
+        // then and only cluster it.
+        std::vector<Index> reordered(indexCount);
+        OptimizeVertexCache(reordered.data(), indices, indexCount, vertexCount, cacheSize);
+        if(AnalyzeVertexCache(reordered.data(), indexCount, vertexCount, cacheSize).VertexTransforms < report.FifoBefore.VertexTransforms)
+            std::copy(reordered.begin(), reordered.end(), indices);
+
+        report.ClusterCount = OptimizeOverdraw(indices, indices, indexCount, vertices, vertexCount, position, cacheSize, threshold);
+        vertexCount = OptimizeVertexFetch(vertices, indices, indexCount, vertices, vertexCount);
+
+        report.VertexCountAfter = vertexCount;
+        report.FifoAfter = AnalyzeVertexCache(indices, indexCount, vertexCount, cacheSize, CacheModel::Fifo);
+        report.LruAfter = AnalyzeVertexCache(indices, indexCount, vertexCount, cacheSize, CacheModel::Lru);
+        return report;
+    }
+
+    template <typename Index> requires IndexType<Index>
+    static Report Optimize(
+        GeometryGenerator::MeshData<Index>& meshData,
+        std::uint32_t cacheSize = DefaultCacheSize, float threshold = DefaultOverdrawThreshold)
+    {
+        std::size_t vertexCount = meshData.Vertices.size();
+        Report report = Optimize(
+            meshData.Vertices.data(), vertexCount, meshData.Indices.data(), meshData.Indices.size(),
+            &GeometryGenerator::Vertex::Position, cacheSize, threshold);
+        meshData.Vertices.resize(vertexCount);
+        return report;
+    }
+
+private:
+    // FIFO cache model over vertex timestamps: a vertex is cached while fewer than cacheSize
+    // misses have happened since it was loaded. Flush() empties it in constant time.
+    class FifoCache
+    {
+    public:
+        FifoCache(std::size_t vertexCount, std::uint32_t cacheSize) :
+            mStamps(vertexCount, 0),
+            mCacheSize(cacheSize),
+            mTime((std::uint64_t)cacheSize + 1)
+        {
+        }
+
+        // Returns 1 on a miss.
+        int Access(std::uint32_t v)
+        {
+            if(mTime - mStamps[v] <= mCacheSize)
+                return 0;
+
+            mStamps[v] = mTime++;
+            return 1;
+        }
+
+        // Misses since v was loaded; above the cache size once v has been evicted.
+        std::int64_t Age(std::uint32_t v) const
+        {
+            return (std::int64_t)(mTime - mStamps[v]);
+        }
+
+        void Flush()
+        {
+            mTime += mCacheSize;
+        }
+
+    private:
+        std::vector<std::uint64_t> mStamps;
+        std::uint64_t mCacheSize = 0;
+        std::uint64_t mTime = 0;
+    };
+
+    // Triangles around each vertex in compressed sparse row form: the triangles using vertex v
+    // are Triangles[Offsets[v]] to Triangles[Offsets[v + 1] - 1].
+    struct TriangleAdjacency
+    {
+        std::vector<std::uint32_t> Offsets;
+        std::vector<std::uint32_t> Triangles;
+
+        template <typename Index>
+        TriangleAdjacency(const Index* indices, std::size_t indexCount, std::size_t vertexCount) :
+            Offsets(vertexCount + 1, 0),
+            Triangles(indexCount - indexCount % 3)
+        {
+            std::size_t count = Triangles.size();
+            for(std::size_t i = 0; i < count; i++)
+                Offsets[indices[i] + 1]++;
+            for(std::size_t v = 0; v < vertexCount; v++)
+                Offsets[v + 1] += Offsets[v];
+
+            std::vector<std::uint32_t> fill(Offsets.begin(), Offsets.end() - 1);
+            for(std::size_t i = 0; i < count; i++)
+                Triangles[fill[indices[i]]++] = (std::uint32_t)(i / 3);
+        }
+    };
+
+    // Next fanning vertex once the current fan has no live neighbours: the most recently
+    // emitted vertex that still has triangles, else the next such vertex in index order.
+    static std::int64_t SkipDeadEnd(
+        const std::vector<std::uint32_t>& live, std::vector<std::uint32_t>& deadEnds, std::size_t& cursor)
+    {
+        while(!deadEnds.empty())
+        {
+            std::uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if(live[v] > 0)
+                return v;
+        }
+
+        for(; cursor < live.size(); cursor++)
+        {
+            if(live[cursor] > 0)
+                return (std::int64_t)cursor;
+        }
+
+        return -1;
+    }
+};
+
+#endif
@@ -0,0 +1,515 @@
+#pragma once
+
+#ifndef D3D12BOOK_MESHSIMPLIFIER_H
+#define D3D12BOOK_MESHSIMPLIFIER_H
+
+#include "GeometryGenerator.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <vector>
+
+// Quadric error metric simplification (Garland and Heckbert 1997) by edge collapse onto
+// existing vertices: every simplified index list indexes the original vertex array, so a chain of
+// levels of detail shares one vertex buffer and differs only in its index ranges.
+//
+// Vertices with bit-identical positions are treated as one vertex while collapsing. Mesh borders
+// are kept in place by extra quadrics along border edges. A collapse that would turn a
+// neighbouring triangle over is skipped.
+//
+// Errors are object-space distances: the square root of the area-weighted mean squared distance
+// of the merged vertex from the original planes around it, taken over the worst collapse made.
+class MeshSimplifier
+{
+public:
+    struct Level
+    {
+        std::size_t StartIndex = 0;
+        std::size_t IndexCount = 0;
+        float Error = 0.0f;
+    };
+
+    // Simplifies until at most targetIndexCount indices remain or the next collapse would exceed
+    // targetError. dst needs room for indexCount indices and may be the same array as indices.
+    // Returns the number of indices written.
+    template <typename Index, typename VertexT> requires IndexType<Index>
+    static std::size_t Simplify(
+        Index* dst, const Index* indices, std::size_t indexCount,
+        const VertexT* vertices, std::size_t vertexCount, float3 VertexT::* position,
+        std::size_t targetIndexCount, float targetError = std::numeric_limits<float>::max(),
+        float* resultError = nullptr)
+    {
+        Collapser<Index> collapser(indices, indexCount, vertexCount, [&](std::size_t v) { return vertices[v].*position; });
+        collapser.Run(targetIndexCount / 3, targetError);
+
+        std::size_t count = collapser.Write(dst);
+        if(resultError != nullptr)
+            *resultError = collapser.Error();
+        return count;
+    }
+
+    // Appends coarser levels of the mesh in indices[0, baseIndexCount) to indices, each with
+    // about reduction times the triangles of the one before, until maxLevels levels exist, a
+    // level would exceed maxError or no collapse is left. Every level is reordered for the
+    // vertex cache. The returned levels start with the base mesh itself at error 0.
+    template <typename IndexVector, typename VertexT>
+    static std::vector<Level> BuildLodChain(
+        IndexVector& indices, std::size_t baseIndexCount,
+        const VertexT* vertices, std::size_t vertexCount, float3 VertexT::* position,
+        std::size_t maxLevels = 6, float reduction = 0.5f, float maxError = std::numeric_limits<float>::max())
+    {
+        using Index = typename IndexVector::value_type;
+
+        std::vector<Level> levels;
+        levels.push_back({ 0, baseIndexCount, 0.0f });
+
+        std::vector<Index> base(indices.begin(), indices.begin() + baseIndexCount);
+        Collapser<Index> collapser(base.data(), base.size(), vertexCount, [&](std::size_t v) { return vertices[v].*position; });
+
+        std::vector<Index> level(baseIndexCount);
+        std::size_t triangles = baseIndexCount / 3;
+        while(levels.size() < maxLevels)
+        {
+            triangles = (std::size_t)(triangles * reduction);
+            std::size_t before = collapser.TriangleCount();
+            collapser.Run(triangles, maxError);
+            if(collapser.TriangleCount() == before)
+                break;
+
+            std::size_t count = collapser.Write(level.data());
+            if(count == 0)
+                break;
+
+            MeshOptimizer::OptimizeVertexCache(level.data(), level.data(), count, vertexCount);
+
+            levels.push_back({ indices.size(), count, collapser.Error() });
+            indices.insert(indices.end(), level.begin(), level.begin() + count);
+            triangles = count / 3;
+        }
+
+        return levels;
+    }
+
+    // Object-space error that projects to one pixel at distance 1: scale / distance gives pixels
+    // per unit. proj11 is the [1][1] entry of the projection matrix, 1 / tan(fovY / 2).
+    static float PixelsPerUnitAtUnitDistance(float proj11, float viewportHeight)
+    {
+        return 0.5f * viewportHeight * proj11;
+    }
+
+    // Coarsest level whose error projects to at most maxPixelError at the given distance from the
+    // eye. Works on any list of levels with an Error member, finest first. To avoid flickering
+    // between two levels at a threshold, a switch to a coarser level waits until its error is
+    // below hysteresis times the limit; a switch to a finer level happens as soon as the
+    // current one exceeds the limit.
+    template <typename LevelT>
+    static std::size_t SelectLod(
+        const std::vector<LevelT>& levels, std::size_t currentLevel, float distance,
+        float pixelsPerUnitAtUnitDistance, float maxPixelError = 1.0f, float hysteresis = 0.75f)
+    {
+        if(levels.empty())
+            return 0;
+
+        float pixelsPerUnit = pixelsPerUnitAtUnitDistance / std::max(distance, 1e-6f);
+        currentLevel = std::min(currentLevel, levels.size() - 1);
+
+        while(currentLevel > 0 && levels[currentLevel].Error * pixelsPerUnit > maxPixelError)
+            currentLevel--;
+
+        while(currentLevel + 1 < levels.size() && levels[currentLevel + 1].Error * pixelsPerUnit <= maxPixelError * hysteresis)
+            currentLevel++;
+
+        return currentLevel;
+    }
+
+private:
+    // Symmetric 4x4 quadric over (x, y, z, 1) with the total weight of the planes it holds.
+    struct Quadric
+    {
+        double A00 = 0, A01 = 0, A02 = 0, A11 = 0, A12 = 0, A22 = 0;
+        double B0 = 0, B1 = 0, B2 = 0;
+        double C = 0;
+        double Weight = 0;
+
+        static Quadric FromPlane(double a, double b, double c, double d, double weight)
+        {
+            Quadric q;
+            q.A00 = weight * a * a; q.A01 = weight * a * b; q.A02 = weight * a * c;
+            q.A11 = weight * b * b; q.A12 = weight * b * c; q.A22 = weight * c * c;
+            q.B0 = weight * a * d; q.B1 = weight * b * d; q.B2 = weight * c * d;
+            q.C = weight * d * d;
+            q.Weight = weight;
+            return q;
+        }
+
+        Quadric& operator+=(const Quadric& q)
+        {
+            A00 += q.A00; A01 += q.A01; A02 += q.A02;
+            A11 += q.A11; A12 += q.A12; A22 += q.A22;
+            B0 += q.B0; B1 += q.B1; B2 += q.B2;
+            C += q.C;
+            Weight += q.Weight;
+            return *this;
+        }
+
+        // Weighted mean squared distance of p from the planes.
+        double Error(const float3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double e =
+                A00 * x * x + A11 * y * y + A22 * z * z +
+                2.0 * (A01 * x * y + A02 * x * z + A12 * y * z) +
+                2.0 * (B0 * x + B1 * y + B2 * z) + C;
+            return Weight > 0.0 ? std::max(e, 0.0) / Weight : 0.0;
+        }
+    };
+
+    // Border edges weigh this many times their squared length.
+    static constexpr double BorderWeight = 10.0;
+
+    // Collapse state over one index list. Collapses run in passes: each pass sorts the current
+    // edges by cost and takes the cheapest ones whose neighbourhoods no earlier collapse in the
+    // same pass has touched, so that the flip test sees current geometry.
+    template <typename Index>
+    class Collapser
+    {
+    public:
+        template <typename PositionFn>
+        Collapser(const Index* indices, std::size_t indexCount, std::size_t vertexCount, const PositionFn& position) :
+            mIndices(indices),
+            mTriangleCount(indexCount / 3),
+            mPositions(vertexCount),
+            mWeld(vertexCount),
+            mParent(vertexCount),
+            mQuadrics(vertexCount)
+        {
+            for(std::size_t v = 0; v < vertexCount; v++)
+                mPositions[v] = position(v);
+
+            // Weld vertices with identical positions onto the first of them.
+            std::vector<std::uint32_t> order(vertexCount);
+            for(std::size_t v = 0; v < vertexCount; v++)
+                order[v] = (std::uint32_t)v;
+            auto key = [&](std::uint32_t v) { return std::make_tuple(mPositions[v].x, mPositions[v].y, mPositions[v].z, v); };
+            std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) { return key(a) < key(b); });
+            for(std::size_t i = 0; i < vertexCount; i++)
+            {
+                std::uint32_t v = order[i];
+                bool same = i > 0 &&
+                    mPositions[order[i - 1]].x == mPositions[v].x &&
+                    mPositions[order[i - 1]].y == mPositions[v].y &&
+                    mPositions[order[i - 1]].z == mPositions[v].z;
+                mWeld[v] = same ? mWeld[order[i - 1]] : v;
+                mParent[v] = v;
+            }
+
+            for(std::size_t t = 0; t < mTriangleCount; t++)
+            {
+                std::uint32_t a = mWeld[indices[t * 3]];
+                std::uint32_t b = mWeld[indices[t * 3 + 1]];
+                std::uint32_t c = mWeld[indices[t * 3 + 2]];
+                if(a == b || b == c || a == c)
+                    continue;
+
+                double n[3];
+                double area = Normal(mPositions[a], mPositions[b], mPositions[c], n);
+                if(area == 0.0)
+                    continue;
+
+                const float3& p = mPositions[a];
+                Quadric q = Quadric::FromPlane(n[0], n[1], n[2], -(n[0] * p.x + n[1] * p.y + n[2] * p.z), area);
+                mQuadrics[a] += q;
+                mQuadrics[b] += q;
+                mQuadrics[c] += q;
+            }
+
+            AddBorderQuadrics();
+        }
+
+        std::size_t TriangleCount() const
+        {
+            return mCurrent.size() / 3;
+        }
+
+        float Error() const
+        {
+            return (float)std::sqrt(mError);
+        }
+
+        void Run(std::size_t targetTriangles, float maxError)
+        {
+            double maxCost = (double)maxError * (double)maxError;
+
+            for(;;)
+            {
+                Gather();
+                std::size_t triangles = mCurrent.size() / 3;
+                if(triangles <= targetTriangles)
+                    return;
+
+                // Each collapse removes about two triangles.
+                std::size_t limit = std::max<std::size_t>(1, (triangles - targetTriangles) / 2);
+                if(CollapsePass(limit, maxCost) == 0)
+                    return;
+            }
+        }
+
+        // Writes the current triangles with indices into the original vertex array.
+        std::size_t Write(Index* dst)
+        {
+            Gather();
+
+            std::size_t out = 0;
+            for(std::size_t t = 0; t < mTriangleCount; t++)
+            {
+                Index v[3];
+                std::uint32_t w[3];
+                for(int k = 0; k < 3; k++)
+                {
+                    Index index = mIndices[t * 3 + k];
+                    std::uint32_t welded = mWeld[index];
+                    w[k] = Find(welded);
+                    v[k] = w[k] == welded ? index : (Index)w[k];
+                }
+
+                if(w[0] == w[1] || w[1] == w[2] || w[0] == w[2])
+                    continue;
+
+                dst[out++] = v[0];
+                dst[out++] = v[1];
+                dst[out++] = v[2];
+            }
+
+            return out;
+        }
+
+    private:
+        struct Candidate
+        {
+            double Cost;
+            std::uint32_t From;
+            std::uint32_t To;
+        };
+
+        static double Normal(const float3& p0, const float3& p1, const float3& p2, double n[3])
+        {
+            double ux = p1.x - p0.x, uy = p1.y - p0.y, uz = p1.z - p0.z;
+            double vx = p2.x - p0.x, vy = p2.y - p0.y, vz = p2.z - p0.z;
+            n[0] = uy * vz - uz * vy;
+            n[1] = uz * vx - ux * vz;
+            n[2] = ux * vy - uy * vx;
+
+            double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if(length == 0.0)
+                return 0.0;
+
+            n[0] /= length;
+            n[1] /= length;
+            n[2] /= length;
+            return 0.5 * length;
+        }
+
+        std::uint32_t Find(std::uint32_t v)
+        {
+            while(mParent[v] != v)
+            {
+                mParent[v] = mParent[mParent[v]];
+                v = mParent[v];
+            }
+            return v;
+        }
+
+        // Current triangles as welded, collapsed vertex ids, without the degenerate ones.
+        void Gather()
+        {
+            mCurrent.clear();
+            for(std::size_t t = 0; t < mTriangleCount; t++)
+            {
+                std::uint32_t a = Find(mWeld[mIndices[t * 3]]);
+                std::uint32_t b = Find(mWeld[mIndices[t * 3 + 1]]);
+                std::uint32_t c = Find(mWeld[mIndices[t * 3 + 2]]);
+                if(a == b || b == c || a == c)
+                    continue;
+
+                mCurrent.push_back(a);
+                mCurrent.push_back(b);
+                mCurrent.push_back(c);
+            }
+        }
+
+        // Sorted (min, max) vertex pairs of the current triangles, one entry per triangle side.
+        std::vector<std::uint64_t> SortedEdges() const
+        {
+            std::vector<std::uint64_t> edges;
+            edges.reserve(mCurrent.size());
+            for(std::size_t t = 0; t < mCurrent.size(); t += 3)
+            {
+                for(int k = 0; k < 3; k++)
+                {
+                    std::uint64_t a = mCurrent[t + k];
+                    std::uint64_t b = mCurrent[t + (k + 1) % 3];
+                    edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+                }
+            }
+
+            std::sort(edges.begin(), edges.end());
+            return edges;
+        }
+
+        void AddBorderQuadrics()
+        {
+            Gather();
+            std::vector<std::uint64_t> edges = SortedEdges();
+
+            for(std::size_t t = 0; t < mCurrent.size(); t += 3)
+            {
+                double n[3];
+                if(Normal(mPositions[mCurrent[t]], mPositions[mCurrent[t + 1]], mPositions[mCurrent[t + 2]], n) == 0.0)
+                    continue;
+
+                for(int k = 0; k < 3; k++)
+                {
+                    std::uint32_t a = mCurrent[t + k];
+                    std::uint32_t b = mCurrent[t + (k + 1) % 3];
+                    std::uint64_t key = a < b ? ((std::uint64_t)a << 32) | b : ((std::uint64_t)b << 32) | a;
+                    auto range = std::equal_range(edges.begin(), edges.end(), key);
+                    if(range.second - range.first != 1)
+                        continue;
+
+                    // Plane through the edge, perpendicular to the triangle.
+                    const float3& pa = mPositions[a];
+                    const float3& pb = mPositions[b];
+                    double e[3] = { (double)pb.x - pa.x, (double)pb.y - pa.y, (double)pb.z - pa.z };
+                    double m[3] = { e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0] };
+                    double length = std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+                    if(length == 0.0)
+                        continue;
+
+                    m[0] /= length;
+                    m[1] /= length;
+                    m[2] /= length;
+
+                    double weight = BorderWeight * (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+                    Quadric q = Quadric::FromPlane(m[0], m[1], m[2], -(m[0] * pa.x + m[1] * pa.y + m[2] * pa.z), weight);
+                    mQuadrics[a] += q;
+                    mQuadrics[b] += q;
+                }
+            }
+        }
+
+        // True when moving from to to turns over or flattens a triangle around from.
+        bool Flips(std::uint32_t from, std::uint32_t to) const
+        {
+            const float3& target = mPositions[to];
+            for(std::uint32_t i = mAdjacencyOffsets[from]; i < mAdjacencyOffsets[from + 1]; i++)
+            {
+                const std::uint32_t* tri = mCurrent.data() + mAdjacency[i] * 3;
+                if(tri[0] == to || tri[1] == to || tri[2] == to)
+                    continue;
+
+                float3 p[3] = { mPositions[tri[0]], mPositions[tri[1]], mPositions[tri[2]] };
+                double before[3];
+                if(Normal(p[0], p[1], p[2], before) == 0.0)
+                    continue;
+
+                for(int k = 0; k < 3; k++)
+                {
+                    if(tri[k] == from)
+                        p[k] = target;
+                }
+
+                double after[3];
+                if(Normal(p[0], p[1], p[2], after) == 0.0)
+                    return true;
+                if(before[0] * after[0] + before[1] * after[1] + before[2] * after[2] < 0.25)
+                    return true;
+            }
+
+            return false;
+        }
+
+        std::size_t CollapsePass(std::size_t limit, double maxCost)
+        {
+            std::size_t vertexCount = mPositions.size();
+
+            mAdjacencyOffsets.assign(vertexCount + 1, 0);
+            for(std::uint32_t v : mCurrent)
+                mAdjacencyOffsets[v + 1]++;
+            for(std::size_t v = 0; v < vertexCount; v++)
+                mAdjacencyOffsets[v + 1] += mAdjacencyOffsets[v];
+            mAdjacency.resize(mCurrent.size());
+            std::vector<std::uint32_t> fill(mAdjacencyOffsets.begin(), mAdjacencyOffsets.end() - 1);
+            for(std::size_t i = 0; i < mCurrent.size(); i++)
+                mAdjacency[fill[mCurrent[i]]++] = (std::uint32_t)(i / 3);
+
+            std::vector<std::uint64_t> edges = SortedEdges();
+            edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+            std::vector<Candidate> candidates;
+            candidates.reserve(edges.size());
+            for(std::uint64_t edge : edges)
+            {
+                std::uint32_t a = (std::uint32_t)(edge >> 32);
+                std::uint32_t b = (std::uint32_t)edge;
+
+                Quadric q = mQuadrics[a];
+                q += mQuadrics[b];
+                double toB = q.Error(mPositions[b]);
+                double toA = q.Error(mPositions[a]);
+                if(toB <= toA)
+                    candidates.push_back({ toB, a, b });
+                else
+                    candidates.push_back({ toA, b, a });
+            }
+
+            std::sort(candidates.begin(), candidates.end(), [](const Candidate& x, const Candidate& y)
+            {
+                if(x.Cost != y.Cost)
+                    return x.Cost < y.Cost;
+                return x.From != y.From ? x.From < y.From : x.To < y.To;
+            });
+
+            mLocked.assign(vertexCount, 0);
+            std::size_t collapses = 0;
+            for(const Candidate& c : candidates)
+            {
+                if(c.Cost > maxCost || collapses >= limit)
+                    break;
+                if(mLocked[c.From] || mLocked[c.To] || Flips(c.From, c.To))
+                    continue;
+
+                mParent[c.From] = c.To;
+                mQuadrics[c.To] += mQuadrics[c.From];
+                mError = std::max(mError, c.Cost);
+                collapses++;
+
+                for(std::uint32_t i = mAdjacencyOffsets[c.From]; i < mAdjacencyOffsets[c.From + 1]; i++)
+                {
+                    const std::uint32_t* tri = mCurrent.data() + mAdjacency[i] * 3;
+                    mLocked[tri[0]] = mLocked[tri[1]] = mLocked[tri[2]] = 1;
+                }
+                mLocked[c.To] = 1;
+            }
+
+            return collapses;
+        }
+
+        const Index* mIndices = nullptr;
+        std::size_t mTriangleCount = 0;
+        std::vector<float3> mPositions;
+        std::vector<std::uint32_t> mWeld;
+        std::vector<std::uint32_t> mParent;
+        std::vector<Quadric> mQuadrics;
+        std::vector<std::uint32_t> mCurrent;
+        std::vector<std::uint32_t> mAdjacencyOffsets;
+        std::vector<std::uint32_t> mAdjacency;
+        std::vector<char> mLocked;
+        double mError = 0.0;
+    };
+};
+
+#endif
@@ -0,0 +1,345 @@
+#pragma once
+
+#ifndef D3D12BOOK_MESHTANGENTSPACE_H
+#define D3D12BOOK_MESHTANGENTSPACE_H
+
+#include "GeometryGenerator.h"
+#include "TaskPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Vertex normals and tangent frames for any indexed triangle list, e.g. models loaded from
+// Models/ that come without them.
+//
+// Both passes gather instead of scatter: per-triangle terms are computed in parallel first,
+// then every vertex sums the terms of its own corners, found through a compressed sparse row
+// adjacency (VertexAdjacency). No two tasks write the same vertex, so there are no atomics or
+// per-thread accumulators, and the result does not depend on the thread count.
+//
+// Tangents follow MikkTSpace (Mikkelsen 2008, the reference tangent space for normal maps
+// baked by most tools): each triangle's tangent is the direction of increasing u, flipped on
+// triangles with mirrored UVs; at each corner it is projected into the plane of the vertex
+// normal and weighted by the corner angle in that plane; the sum is normalized, and the
+// bitangent is sign * cross(normal, tangent). MikkTSpace splits a vertex whose triangles
+// disagree on the UV orientation; an index buffer cannot, so such a vertex takes the
+// orientation with the larger total angle.
+//
+// Like MeshOptimizer, the passes take the vertex type as a template parameter and reach the
+// attributes through pointers to members.
+class MeshTangentSpace
+{
+public:
+    enum class NormalWeighting
+    {
+        // Each triangle counts with its area: cheap, but long thin triangles dominate.
+        Area,
+
+        // Each triangle counts with its angle at the vertex, so the result does not depend on
+        // how the surface around the vertex is triangulated.
+        Angle
+    };
+
+    static constexpr std::size_t TrianglesPerTask = 8192;
+
+    // Triangles with twice their area below this times their longest edge squared count as
+    // degenerate and contribute to neither normals nor tangents.
+    static constexpr float DegenerateRatio = 1e-5f;
+    static constexpr std::size_t VerticesPerTask = 4096;
+
+    // Corners around each vertex in compressed sparse row form: the corners of vertex v are
+    // Corners[Offsets[v]] to Corners[Offsets[v + 1] - 1], each the position of v in the index
+    // list, so corner / 3 is the triangle and corner % 3 the vertex's place in it.
+    struct VertexAdjacency
+    {
+        std::vector<std::uint32_t> Offsets;
+        std::vector<std::uint32_t> Corners;
+
+        template <typename Index> requires IndexType<Index>
+        VertexAdjacency(const Index* indices, std::size_t indexCount, std::size_t vertexCount) :
+            Offsets(vertexCount + 1, 0),
+            Corners(indexCount - indexCount % 3)
+        {
+            std::size_t count = Corners.size();
+            for(std::size_t i = 0; i < count; i++)
+                Offsets[indices[i] + 1]++;
+            for(std::size_t v = 0; v < vertexCount; v++)
+                Offsets[v + 1] += Offsets[v];
+
+            std::vector<std::uint32_t> fill(Offsets.begin(), Offsets.end() - 1);
+            for(std::size_t i = 0; i < count; i++)
+                Corners[fill[indices[i]]++] = (std::uint32_t)i;
+        }
+    };
+
+    template <typename VertexT, typename Index> requires IndexType<Index>
+    static void ComputeNormals(
+        VertexT* vertices, std::size_t vertexCount, const Index* indices, std::size_t indexCount,
+        float3 VertexT::* position, float3 VertexT::* normal,
+        NormalWeighting weighting = NormalWeighting::Angle)
+    {
+        VertexAdjacency adjacency(indices, indexCount, vertexCount);
+        ComputeNormals(vertices, vertexCount, indices, indexCount, adjacency, position, normal, weighting);
+    }
+
+    // Vertices without triangles, or only degenerate ones, keep their normal.
+    template <typename VertexT, typename Index> requires IndexType<Index>
+    static void ComputeNormals(
+        VertexT* vertices, std::size_t vertexCount, const Index* indices, std::size_t indexCount,
+        const VertexAdjacency& adjacency, float3 VertexT::* position, float3 VertexT::* normal,
+        NormalWeighting weighting = NormalWeighting::Angle)
+    {
+        std::size_t triangleCount = indexCount / 3;
+        bool angleWeighted = weighting == NormalWeighting::Angle;
+
+        // Face normals, unnormalized for area weighting (their length is twice the area) and
+        // unit length for angle weighting, which also needs the angle at each corner.
+        // Degenerate triangles get a zero normal.
+        std::vector<float3> faceNormals(triangleCount);
+        std::vector<float> cornerAngles(angleWeighted ? triangleCount * 3 : 0);
+        ParallelFor(triangleCount, TrianglesPerTask, [&](std::size_t first, std::size_t last)
+                    {
+                        for(std::size_t t = first; t < last; t++)
+                        {
+                            XMVECTOR p0 = XMLoadFloat3(&(vertices[indices[t * 3]].*position));
+                            XMVECTOR p1 = XMLoadFloat3(&(vertices[indices[t * 3 + 1]].*position));
+                            XMVECTOR p2 = XMLoadFloat3(&(vertices[indices[t * 3 + 2]].*position));
+
+                            XMVECTOR e01 = p1 - p0;
+                            XMVECTOR e12 = p2 - p1;
+                            XMVECTOR e20 = p0 - p2;
+                            XMVECTOR n = XMVector3Cross(e01, -e20);
+                            if(IsDegenerate(n, e01, e12, e20))
+                                n = XMVectorZero();
+
+                            if(!angleWeighted)
+                            {
+                                XMStoreFloat3(&faceNormals[t], n);
+                                continue;
+                            }
+
+                            XMStoreFloat3(&faceNormals[t], XMVector3Normalize(n));
+
+                            e01 = XMVector3Normalize(e01);
+                            e12 = XMVector3Normalize(e12);
+                            e20 = XMVector3Normalize(e20);
+                            cornerAngles[t * 3] = Angle(e01, -e20);
+                            cornerAngles[t * 3 + 1] = Angle(e12, -e01);
+                            cornerAngles[t * 3 + 2] = Angle(e20, -e12);
+                        }
+                    });
+
+        ParallelFor(vertexCount, VerticesPerTask, [&](std::size_t first, std::size_t last)
+                    {
+                        for(std::size_t v = first; v < last; v++)
+                        {
+                            std::uint32_t begin = adjacency.Offsets[v];
+                            std::uint32_t end = adjacency.Offsets[v + 1];
+                            if(begin == end)
+                                continue;
+
+                            XMVECTOR sum = XMVectorZero();
+                            for(std::uint32_t i = begin; i < end; i++)
+                            {
+                                std::uint32_t corner = adjacency.Corners[i];
+                                XMVECTOR n = XMLoadFloat3(&faceNormals[corner / 3]);
+                                sum += angleWeighted ? n * cornerAngles[corner] : n;
+                            }
+
+                            if(XMVectorGetX(XMVector3LengthSq(sum)) > 0.0f)
+                                XMStoreFloat3(&(vertices[v].*normal), XMVector3Normalize(sum));
+                        }
+                    });
+    }
+
+    // MikkTSpace tangents from positions, normals and texture coordinates. A float4 tangent
+    // gets the bitangent sign in w; a float3 tangent (GeometryGenerator::Vertex::TangentU)
+    // assumes the UVs are not mirrored. Vertices whose triangles all have degenerate UVs get
+    // an arbitrary tangent perpendicular to the normal; vertices without triangles keep theirs.
+    template <typename VertexT, typename Index, typename TangentT>
+        requires IndexType<Index> && (std::is_same_v<TangentT, float3> || std::is_same_v<TangentT, float4>)
+    static void ComputeTangents(
+        VertexT* vertices, std::size_t vertexCount, const Index* indices, std::size_t indexCount,
+        float3 VertexT::* position, float3 VertexT::* normal, float2 VertexT::* texC, TangentT VertexT::* tangent)
+    {
+        VertexAdjacency adjacency(indices, indexCount, vertexCount);
+        ComputeTangents(vertices, vertexCount, indices, indexCount, adjacency, position, normal, texC, tangent);
+    }
+
+    template <typename VertexT, typename Index, typename TangentT>
+        requires IndexType<Index> && (std::is_same_v<TangentT, float3> || std::is_same_v<TangentT, float4>)
+    static void ComputeTangents(
+        VertexT* vertices, std::size_t vertexCount, const Index* indices, std::size_t indexCount,
+        const VertexAdjacency& adjacency,
+        float3 VertexT::* position, float3 VertexT::* normal, float2 VertexT::* texC, TangentT VertexT::* tangent)
+    {
+        std::size_t triangleCount = indexCount / 3;
+
+        // Per triangle: the unit direction of increasing u, negated where the UVs are
+        // mirrored, or zero where the UVs are degenerate.
+        std::vector<FaceTangent> faceTangents(triangleCount);
+        ParallelFor(triangleCount, TrianglesPerTask, [&](std::size_t first, std::size_t last)
+                    {
+                        for(std::size_t t = first; t < last; t++)
+                        {
+                            const VertexT& v0 = vertices[indices[t * 3]];
+                            const VertexT& v1 = vertices[indices[t * 3 + 1]];
+                            const VertexT& v2 = vertices[indices[t * 3 + 2]];
+
+                            XMVECTOR p0 = XMLoadFloat3(&(v0.*position));
+                            XMVECTOR d1 = XMLoadFloat3(&(v1.*position)) - p0;
+                            XMVECTOR d2 = XMLoadFloat3(&(v2.*position)) - p0;
+                            bool degenerate = IsDegenerate(XMVector3Cross(d1, d2), d1, d2 - d1, d2);
+
+                            float s1 = (v1.*texC).x - (v0.*texC).x;
+                            float t1 = (v1.*texC).y - (v0.*texC).y;
+                            float s2 = (v2.*texC).x - (v0.*texC).x;
+                            float t2 = (v2.*texC).y - (v0.*texC).y;
+
+                            float signedArea = s1 * t2 - t1 * s2;
+                            FaceTangent& face = faceTangents[t];
+                            face.OrientationPreserving = signedArea > 0.0f;
+
+                            XMVECTOR os = t2 * d1 - t1 * d2;
+                            float length = XMVectorGetX(XMVector3Length(os));
+                            if(degenerate || signedArea == 0.0f || length == 0.0f)
+                            {
+                                face.Direction = float3(0.0f, 0.0f, 0.0f);
+                                continue;
+                            }
+
+                            XMStoreFloat3(&face.Direction, os * ((face.OrientationPreserving ? 1.0f : -1.0f) / length));
+                        }
+                    });
+
+        ParallelFor(vertexCount, VerticesPerTask, [&](std::size_t first, std::size_t last)
+                    {
+                        for(std::size_t v = first; v < last; v++)
+                        {
+                            std::uint32_t begin = adjacency.Offsets[v];
+                            std::uint32_t end = adjacency.Offsets[v + 1];
+                            if(begin == end)
+                                continue;
+
+                            XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&(vertices[v].*normal)));
+
+                            // Index 1 sums the orientation-preserving triangles.
+                            XMVECTOR sums[2] = { XMVectorZero(), XMVectorZero() };
+                            float weights[2] = { 0.0f, 0.0f };
+                            for(std::uint32_t i = begin; i < end; i++)
+                            {
+                                std::uint32_t corner = adjacency.Corners[i];
+                                const FaceTangent& face = faceTangents[corner / 3];
+
+                                XMVECTOR os = XMLoadFloat3(&face.Direction);
+                                XMVECTOR projected = os - XMVector3Dot(n, os) * n;
+                                if(XMVectorGetX(XMVector3LengthSq(projected)) == 0.0f)
+                                    continue;
+
+                                XMVECTOR e0, e1;
+                                CornerEdges(vertices, indices, corner, position, e0, e1);
+                                e0 = XMVector3Normalize(e0 - XMVector3Dot(n, e0) * n);
+                                e1 = XMVector3Normalize(e1 - XMVector3Dot(n, e1) * n);
+                                float angle = Angle(e0, e1);
+
+                                int orientation = face.OrientationPreserving ? 1 : 0;
+                                sums[orientation] += XMVector3Normalize(projected) * angle;
+                                weights[orientation] += angle;
+                            }
+
+                            int orientation = weights[1] >= weights[0] ? 1 : 0;
+                            XMVECTOR t = XMVector3Normalize(sums[orientation]);
+                            if(XMVectorGetX(XMVector3LengthSq(t)) == 0.0f)
+                                t = AnyPerpendicular(n);
+
+                            TangentT& out = vertices[v].*tangent;
+                            if constexpr(std::is_same_v<TangentT, float4>)
+                            {
+                                XMStoreFloat4(&out, XMVectorSetW(t, orientation == 1 ? 1.0f : -1.0f));
+                            }
+                            else
+                            {
+                                XMStoreFloat3(&out, t);
+                            }
+                        }
+                    });
+    }
+
+    // Normals and TangentU of a GeometryGenerator mesh, sharing one adjacency.
+    template <typename Index> requires IndexType<Index>
+    static void Compute(
+        GeometryGenerator::MeshData<Index>& meshData, NormalWeighting weighting = NormalWeighting::Angle)
+    {
+        using Vertex = GeometryGenerator::Vertex;
+
+        VertexAdjacency adjacency(meshData.Indices.data(), meshData.Indices.size(), meshData.Vertices.size());
+        ComputeNormals(
+            meshData.Vertices.data(), meshData.Vertices.size(), meshData.Indices.data(), meshData.Indices.size(),
+            adjacency, &Vertex::Position, &Vertex::Normal, weighting);
+        ComputeTangents(
+            meshData.Vertices.data(), meshData.Vertices.size(), meshData.Indices.data(), meshData.Indices.size(),
+            adjacency, &Vertex::Position, &Vertex::Normal, &Vertex::TexC, &Vertex::TangentU);
+    }
+
+private:
+    struct FaceTangent
+    {
+        float3 Direction;
+        bool OrientationPreserving = true;
+    };
+
+    // Runs fn(first, last) over [0, count) in blocks of blockSize on the shared pool.
+    template <typename Fn>
+    static void ParallelFor(std::size_t count, std::size_t blockSize, const Fn& fn)
+    {
+        int blockCount = (int)((count + blockSize - 1) / blockSize);
+        TaskPool::WorkStealingPool::Shared().ParallelFor(blockCount, [&](int block)
+        {
+            std::size_t first = (std::size_t)block * blockSize;
+            fn(first, std::min(count, first + blockSize));
+        });
+    }
+
+    // The two edges leaving the vertex at corner, towards the triangle's other vertices.
+    template <typename VertexT, typename Index>
+    static void CornerEdges(
+        const VertexT* vertices, const Index* indices, std::uint32_t corner, float3 VertexT::* position,
+        XMVECTOR& e0, XMVECTOR& e1)
+    {
+        std::uint32_t triangle = corner - corner % 3;
+        std::uint32_t next = triangle + (corner + 1) % 3;
+        std::uint32_t prev = triangle + (corner + 2) % 3;
+
+        XMVECTOR p = XMLoadFloat3(&(vertices[indices[corner]].*position));
+        e0 = XMLoadFloat3(&(vertices[indices[next]].*position)) - p;
+        e1 = XMLoadFloat3(&(vertices[indices[prev]].*position)) - p;
+    }
+
+    // A triangle whose area is negligible next to its longest edge, such as the sliver
+    // triangles at the poles of CreateSphere, has a normal that is mostly rounding error.
+    static bool IsDegenerate(FXMVECTOR cross, FXMVECTOR e0, FXMVECTOR e1, GXMVECTOR e2)
+    {
+        float longest = std::max({
+            XMVectorGetX(XMVector3LengthSq(e0)),
+            XMVectorGetX(XMVector3LengthSq(e1)),
+            XMVectorGetX(XMVector3LengthSq(e2)) });
+        return XMVectorGetX(XMVector3Length(cross)) <= DegenerateRatio * longest;
+    }
+
+    // Angle between two unit vectors, clamped so rounding cannot produce NaN.
+    static float Angle(FXMVECTOR u0, FXMVECTOR u1)
+    {
+        return acosf(std::clamp(XMVectorGetX(XMVector3Dot(u0, u1)), -1.0f, 1.0f));
+    }
+
+    static XMVECTOR AnyPerpendicular(FXMVECTOR n)
+    {
+        XMVECTOR axis = fabsf(XMVectorGetX(n)) < 0.9f ? XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+        return XMVector3Normalize(XMVector3Cross(XMVector3Cross(n, axis), n));
+    }
+};
+
+#endif
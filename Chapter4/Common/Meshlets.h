@@ -0,0 +1,438 @@
+#pragma once
+
+#ifndef D3D12BOOK_MESHLETS_H
+#define D3D12BOOK_MESHLETS_H
+
+#include "GeometryGenerator.h"
+#include "d3dUtil.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A meshlet is a run of at most MeshletBuilder::MaxTriangles triangles that together use at
+// most MeshletBuilder::MaxVertices vertices, addressed through its own small vertex list. The
+// layout follows the D3D12 mesh shader samples: the meshlet's vertices are
+// VertexIndices[VertexOffset] to VertexIndices[VertexOffset + VertexCount - 1], and each of its
+// triangles is one entry of PrimitiveIndices holding three indices into that list.
+struct Meshlet
+{
+    std::uint32_t VertexCount = 0;
+    std::uint32_t VertexOffset = 0;
+    std::uint32_t PrimitiveCount = 0;
+    std::uint32_t PrimitiveOffset = 0;
+};
+
+// Culling data for one meshlet. The sphere bounds its vertices. A viewer at e sees only the back
+// faces of the meshlet when dot(normalize(ConeApex - e), ConeAxis) >= ConeCutoff. Meshlets whose
+// triangles face too many ways get a zero axis and are never culled by the cone.
+struct MeshletBounds
+{
+    float3 Center;
+    float Radius = 0.0f;
+    float3 ConeApex;
+    float3 ConeAxis;
+    float ConeCutoff = 1.0f;
+};
+
+struct MeshletData
+{
+    std::vector<Meshlet> Meshlets;
+    std::vector<MeshletBounds> Bounds;
+
+    // Mesh vertex indices, relative to the submesh's BaseVertexLocation.
+    std::vector<std::uint32_t> VertexIndices;
+
+    // Three meshlet-local vertex indices per triangle, 10 bits each (see PackTriangle).
+    std::vector<std::uint32_t> PrimitiveIndices;
+};
+
+// Splits indexed triangle lists into meshlets and computes their culling bounds. Triangles are
+// taken in index-buffer order, so run MeshOptimizer first for well-filled meshlets.
+//
+// The index list is cut into fixed blocks of TrianglesPerTask triangles that are split in
+// parallel and concatenated in order, so the result does not depend on the thread count.
+class MeshletBuilder
+{
+public:
+    static constexpr std::uint32_t MaxVertices = 64;
+    static constexpr std::uint32_t MaxTriangles = 124;
+    static constexpr std::uint32_t TrianglesPerTask = 8192;
+
+    static std::uint32_t PackTriangle(std::uint32_t i0, std::uint32_t i1, std::uint32_t i2)
+    {
+        return (i0 & 0x3FF) | ((i1 & 0x3FF) << 10) | ((i2 & 0x3FF) << 20);
+    }
+
+    static void UnpackTriangle(std::uint32_t packed, std::uint32_t& i0, std::uint32_t& i1, std::uint32_t& i2)
+    {
+        i0 = packed & 0x3FF;
+        i1 = (packed >> 10) & 0x3FF;
+        i2 = (packed >> 20) & 0x3FF;
+    }
+
+    // positions points at the first vertex's float3 position; vertexStride is the distance in
+    // bytes between vertices.
+    template <typename Index> requires IndexType<Index>
+    static MeshletData Build(
+        const Index* indices, std::size_t indexCount,
+        const void* positions, std::size_t vertexStride, std::size_t vertexCount)
+    {
+        PositionReader reader{ static_cast<const std::byte*>(positions), vertexStride };
+        std::size_t triangleCount = indexCount / 3;
+        int taskCount = (int)((triangleCount + TrianglesPerTask - 1) / TrianglesPerTask);
+
+        std::vector<MeshletData> blocks(taskCount);
+        TaskPool::WorkStealingPool::Shared().ParallelFor(taskCount, [&](int task)
+        {
+            std::size_t first = (std::size_t)task * TrianglesPerTask;
+            std::size_t last = std::min(triangleCount, first + TrianglesPerTask);
+            BuildBlock(blocks[task], indices, first, last, vertexCount, reader);
+        });
+
+        MeshletData result;
+        std::size_t meshletCount = 0;
+        std::size_t vertexIndexCount = 0;
+        std::size_t primitiveCount = 0;
+        for(const MeshletData& block : blocks)
+        {
+            meshletCount += block.Meshlets.size();
+            vertexIndexCount += block.VertexIndices.size();
+            primitiveCount += block.PrimitiveIndices.size();
+        }
+
+        result.Meshlets.reserve(meshletCount);
+        result.Bounds.reserve(meshletCount);
+        result.VertexIndices.reserve(vertexIndexCount);
+        result.PrimitiveIndices.reserve(primitiveCount);
+
+        for(const MeshletData& block : blocks)
+        {
+            std::uint32_t vertexOffset = (std::uint32_t)result.VertexIndices.size();
+            std::uint32_t primitiveOffset = (std::uint32_t)result.PrimitiveIndices.size();
+            for(Meshlet meshlet : block.Meshlets)
+            {
+                meshlet.VertexOffset += vertexOffset;
+                meshlet.PrimitiveOffset += primitiveOffset;
+                result.Meshlets.push_back(meshlet);
+            }
+
+            result.Bounds.insert(result.Bounds.end(), block.Bounds.begin(), block.Bounds.end());
+            result.VertexIndices.insert(result.VertexIndices.end(), block.VertexIndices.begin(), block.VertexIndices.end());
+            result.PrimitiveIndices.insert(result.PrimitiveIndices.end(), block.PrimitiveIndices.begin(), block.PrimitiveIndices.end());
+        }
+
+        return result;
+    }
+
+    template <typename Index, typename VertexT> requires IndexType<Index>
+    static MeshletData Build(
+        const Index* indices, std::size_t indexCount,
+        const VertexT* vertices, std::size_t vertexCount, float3 VertexT::* position)
+    {
+        const void* positions = vertexCount > 0 ? &(vertices[0].*position) : nullptr;
+        return Build(indices, indexCount, positions, sizeof(VertexT), vertexCount);
+    }
+
+    template <typename Index> requires IndexType<Index>
+    static MeshletData Build(const GeometryGenerator::MeshData<Index>& meshData)
+    {
+        return Build(
+            meshData.Indices.data(), meshData.Indices.size(),
+            meshData.Vertices.data(), meshData.Vertices.size(), &GeometryGenerator::Vertex::Position);
+    }
+
+    // Builds from the CPU copies of a MeshGeometry's buffers. positionOffset is the byte offset
+    // of the float3 position within a vertex.
+    static MeshletData Build(
+        const DirectXHelper::MeshGeometry& geo,
+        const DirectXHelper::MeshGeometry::SubmeshGeometry& submesh,
+        std::size_t positionOffset = 0)
+    {
+        const std::byte* vertexData = static_cast<const std::byte*>(geo.VertexBufferCPU->GetBufferPointer());
+        const std::byte* indexData = static_cast<const std::byte*>(geo.IndexBufferCPU->GetBufferPointer());
+
+        std::size_t stride = geo.VertexByteStride;
+        std::size_t vertexCount = geo.VertexBufferByteSize / stride - submesh.BaseVertexLocation;
+        const std::byte* positions = vertexData + (std::size_t)submesh.BaseVertexLocation * stride + positionOffset;
+
+        if(geo.IndexFormat == DXGI_FORMAT_R32_UINT)
+        {
+            const std::uint32_t* indices = reinterpret_cast<const std::uint32_t*>(indexData) + submesh.StartIndexLocation;
+            return Build(indices, submesh.IndexCount, positions, stride, vertexCount);
+        }
+
+        const std::uint16_t* indices = reinterpret_cast<const std::uint16_t*>(indexData) + submesh.StartIndexLocation;
+        return Build(indices, submesh.IndexCount, positions, stride, vertexCount);
+    }
+
+    // True when every triangle of the meshlet faces away from a viewer at eyePosition, in the
+    // meshlet's object space.
+    static bool IsBackfacing(const MeshletBounds& bounds, const float3& eyePosition)
+    {
+        XMVECTOR view = XMLoadFloat3(&bounds.ConeApex) - XMLoadFloat3(&eyePosition);
+        float length = std::sqrt(XMVectorGetX(XMVector3Dot(view, view)));
+        if(length == 0.0f)
+            return false;
+
+        return XMVectorGetX(XMVector3Dot(view, XMLoadFloat3(&bounds.ConeAxis))) >= bounds.ConeCutoff * length;
+    }
+
+    // True when the bounding sphere lies entirely outside one of the planes. A plane (a, b, c, d)
+    // has a unit normal (a, b, c) pointing into the frustum.
+    static bool IsOutsideFrustum(const MeshletBounds& bounds, const float4 (&planes)[6])
+    {
+        for(const float4& plane : planes)
+        {
+            float distance = plane.x * bounds.Center.x + plane.y * bounds.Center.y + plane.z * bounds.Center.z + plane.w;
+            if(distance < -bounds.Radius)
+                return true;
+        }
+
+        return false;
+    }
+
+private:
+    struct PositionReader
+    {
+        const std::byte* Data = nullptr;
+        std::size_t Stride = 0;
+
+        XMVECTOR operator()(std::uint32_t v) const
+        {
+            return XMLoadFloat3(reinterpret_cast<const float3*>(Data + v * Stride));
+        }
+    };
+
+    // Maps mesh vertex indices to their slot in the open meshlet: open addressing over twice
+    // MaxVertices entries, emptied in constant time by bumping a generation counter.
+    class LocalVertexMap
+    {
+    public:
+        bool Contains(std::uint32_t v) const
+        {
+            for(std::uint32_t i = Hash(v);; i = (i + 1) & Mask)
+            {
+                if(mGenerations[i] != mGeneration)
+                    return false;
+                if(mKeys[i] == v)
+                    return true;
+            }
+        }
+
+        // Returns the slot of v, giving it nextSlot if it is new.
+        std::uint32_t Insert(std::uint32_t v, std::uint32_t nextSlot, bool& inserted)
+        {
+            for(std::uint32_t i = Hash(v);; i = (i + 1) & Mask)
+            {
+                if(mGenerations[i] != mGeneration)
+                {
+                    mGenerations[i] = mGeneration;
+                    mKeys[i] = v;
+                    mSlots[i] = (std::uint8_t)nextSlot;
+                    inserted = true;
+                    return nextSlot;
+                }
+                if(mKeys[i] == v)
+                {
+                    inserted = false;
+                    return mSlots[i];
+                }
+            }
+        }
+
+        void Clear()
+        {
+            mGeneration++;
+        }
+
+    private:
+        static constexpr std::uint32_t Size = MaxVertices * 2;
+        static constexpr std::uint32_t Mask = Size - 1;
+
+        static std::uint32_t Hash(std::uint32_t v)
+        {
+            return (v * 2654435761u) >> 25;
+        }
+
+        std::uint32_t mKeys[Size] = {};
+        std::uint32_t mGenerations[Size] = {};
+        std::uint8_t mSlots[Size] = {};
+        std::uint32_t mGeneration = 1;
+    };
+
+    // Greedily fills meshlets from triangles [first, last) and computes their bounds. The block
+    // keeps block-relative offsets; Build shifts them when it concatenates the blocks.
+    template <typename Index>
+    static void BuildBlock(
+        MeshletData& block, const Index* indices, std::size_t first, std::size_t last,
+        std::size_t vertexCount, const PositionReader& reader)
+    {
+        std::size_t estimate = (last - first) / (MaxTriangles / 2) + 1;
+        block.Meshlets.reserve(estimate);
+        block.Bounds.reserve(estimate);
+        block.VertexIndices.reserve(estimate * MaxVertices);
+        block.PrimitiveIndices.reserve(last - first);
+
+        Meshlet meshlet;
+        LocalVertexMap local;
+        auto finish = [&]()
+        {
+            if(meshlet.PrimitiveCount == 0)
+                return;
+
+            block.Bounds.push_back(ComputeBounds(block, meshlet, reader));
+            block.Meshlets.push_back(meshlet);
+
+            meshlet = Meshlet();
+            meshlet.VertexOffset = (std::uint32_t)block.VertexIndices.size();
+            meshlet.PrimitiveOffset = (std::uint32_t)block.PrimitiveIndices.size();
+            local.Clear();
+        };
+
+        for(std::size_t t = first; t < last; t++)
+        {
+            std::uint32_t v[3] = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+            assert(v[0] < vertexCount && v[1] < vertexCount && v[2] < vertexCount);
+
+            std::uint32_t added = !local.Contains(v[0]) + (!local.Contains(v[1]) && v[1] != v[0]) +
+                (!local.Contains(v[2]) && v[2] != v[0] && v[2] != v[1]);
+            if(meshlet.VertexCount + added > MaxVertices || meshlet.PrimitiveCount == MaxTriangles)
+                finish();
+
+            std::uint32_t slots[3];
+            for(int k = 0; k < 3; k++)
+            {
+                bool inserted = false;
+                slots[k] = local.Insert(v[k], meshlet.VertexCount, inserted);
+                if(inserted)
+                {
+                    meshlet.VertexCount++;
+                    block.VertexIndices.push_back(v[k]);
+                }
+            }
+
+            block.PrimitiveIndices.push_back(PackTriangle(slots[0], slots[1], slots[2]));
+            meshlet.PrimitiveCount++;
+        }
+
+        finish();
+    }
+
+    static MeshletBounds ComputeBounds(const MeshletData& block, const Meshlet& meshlet, const PositionReader& reader)
+    {
+        const std::uint32_t* local = block.VertexIndices.data() + meshlet.VertexOffset;
+        const std::uint32_t* primitives = block.PrimitiveIndices.data() + meshlet.PrimitiveOffset;
+
+        auto lengthSq = [](XMVECTOR v) { return XMVectorGetX(XMVector3Dot(v, v)); };
+
+        // Ritter's sphere: start from the most distant pair among the axis extremes, then grow
+        // the sphere over any vertex it misses.
+        XMVECTOR points[MaxVertices];
+        float3 coords[MaxVertices];
+        for(std::uint32_t i = 0; i < meshlet.VertexCount; i++)
+        {
+            points[i] = reader(local[i]);
+            XMStoreFloat3(&coords[i], points[i]);
+        }
+
+        std::uint32_t minIndex[3] = { 0, 0, 0 };
+        std::uint32_t maxIndex[3] = { 0, 0, 0 };
+        for(std::uint32_t i = 1; i < meshlet.VertexCount; i++)
+        {
+            for(int axis = 0; axis < 3; axis++)
+            {
+                float c = (&coords[i].x)[axis];
+                if(c < (&coords[minIndex[axis]].x)[axis])
+                    minIndex[axis] = i;
+                if(c > (&coords[maxIndex[axis]].x)[axis])
+                    maxIndex[axis] = i;
+            }
+        }
+
+        int widest = 0;
+        float widestSq = -1.0f;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            float d = lengthSq(points[maxIndex[axis]] - points[minIndex[axis]]);
+            if(d > widestSq)
+            {
+                widestSq = d;
+                widest = axis;
+            }
+        }
+
+        XMVECTOR center = 0.5f * (points[minIndex[widest]] + points[maxIndex[widest]]);
+        float radius = 0.5f * std::sqrt(widestSq);
+        for(std::uint32_t i = 0; i < meshlet.VertexCount; i++)
+        {
+            float d = std::sqrt(lengthSq(points[i] - center));
+            if(d > radius)
+            {
+                float grown = 0.5f * (radius + d);
+                center = center + (points[i] - center) * ((grown - radius) / d);
+                radius = grown;
+            }
+        }
+
+        MeshletBounds bounds;
+        XMStoreFloat3(&bounds.Center, center);
+        bounds.Radius = radius;
+
+        // Normal cone from the unit triangle normals; degenerate triangles do not vote.
+        XMVECTOR normals[MaxTriangles];
+        XMVECTOR corners[MaxTriangles];
+        std::uint32_t normalCount = 0;
+        XMVECTOR axis = XMVectorZero();
+        for(std::uint32_t t = 0; t < meshlet.PrimitiveCount; t++)
+        {
+            std::uint32_t i0, i1, i2;
+            UnpackTriangle(primitives[t], i0, i1, i2);
+
+            XMVECTOR n = XMVector3Cross(points[i1] - points[i0], points[i2] - points[i0]);
+            float length = std::sqrt(lengthSq(n));
+            if(length == 0.0f)
+                continue;
+
+            n = n / length;
+            normals[normalCount] = n;
+            corners[normalCount] = points[i0];
+            normalCount++;
+            axis += n;
+        }
+
+        float axisLength = std::sqrt(lengthSq(axis));
+        bounds.ConeApex = bounds.Center;
+        bounds.ConeAxis = float3(0.0f, 0.0f, 0.0f);
+        bounds.ConeCutoff = 1.0f;
+        if(normalCount == 0 || axisLength == 0.0f)
+            return bounds;
+
+        axis = axis / axisLength;
+        float minDot = 1.0f;
+        for(std::uint32_t t = 0; t < normalCount; t++)
+            minDot = std::min(minDot, XMVectorGetX(XMVector3Dot(normals[t], axis)));
+
+        // Past roughly 84 degrees the cone can hardly ever cull and the apex runs off to infinity.
+        if(minDot <= 0.1f)
+            return bounds;
+
+        // Move the apex back along the axis until it lies behind every triangle's plane.
+        float apexDistance = 0.0f;
+        for(std::uint32_t t = 0; t < normalCount; t++)
+        {
+            float dc = XMVectorGetX(XMVector3Dot(center - corners[t], normals[t]));
+            float dn = XMVectorGetX(XMVector3Dot(axis, normals[t]));
+            apexDistance = std::max(apexDistance, dc / dn);
+        }
+
+        XMStoreFloat3(&bounds.ConeApex, center - axis * apexDistance);
+        XMStoreFloat3(&bounds.ConeAxis, axis);
+        bounds.ConeCutoff = std::sqrt(1.0f - minDot * minDot);
+        return bounds;
+    }
+};
+
+#endif
@@ -0,0 +1,636 @@
+#pragma once
+
+#ifndef D3D12BOOK_OCEANWAVES_H
+#define D3D12BOOK_OCEANWAVES_H
+
+#include "Waves.h"
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Tessendorf-style spectral ocean: a Phillips spectrum of deep-water waves is advanced in
+// closed form and brought back to heights, slopes and horizontal displacements with inverse
+// 2D FFTs. The cost per frame depends only on the grid size, nothing needs disturbing to keep
+// the surface alive, and the patch is periodic, so copies of it tile seamlessly.
+//
+// The vertex grid has one more row and column than the FFT grid; the last row and column
+// repeat the first ones, so a tile's edges match its neighbours'.
+
+struct OceanWavesSettings
+{
+    // Wind speed (m/s) and the direction it blows towards on the xz plane.
+    float WindSpeed = 10.0f;
+    float2 WindDirection = float2(1.0f, 0.0f);
+
+    // Phillips constant. The variance of the heights is Amplitude * pi * L^2 / 2 with
+    // L = WindSpeed^2 / Gravity, independent of the grid size and patch size.
+    float Amplitude = 0.0015f;
+
+    // Horizontal displacement along the wave direction; 0 gives rounded sines, values around
+    // 1 sharpen the crests. Too much makes the surface fold over itself.
+    float Choppiness = 1.0f;
+
+    // Waves shorter than this fraction of L are suppressed.
+    float SmallWaveFraction = 0.001f;
+
+    float Gravity = 9.81f;
+
+    // Frequencies are rounded to multiples of 2 pi / RepeatPeriod, so the animation loops
+    // with this period (seconds) and a frame's phases come from one small table.
+    float RepeatPeriod = 200.0f;
+
+    std::uint32_t Seed = 1;
+};
+
+namespace OceanKernels
+{
+    // Column strips of this many floats per task in the FFT passes.
+    constexpr int StripColumns = 64;
+
+    // Radix-2 inverse FFT along the first index of split complex planes: every butterfly
+    // combines two whole rows, so the transform is vectorized across the columns and
+    // different column ranges can run on different threads.
+    struct FFTPlan
+    {
+        int Size = 0;
+        std::vector<int> BitReverse;
+        std::vector<float> TwiddleRe;
+        std::vector<float> TwiddleIm;
+
+        explicit FFTPlan(int size) : Size(size), BitReverse(size), TwiddleRe(size / 2), TwiddleIm(size / 2)
+        {
+            int bits = 0;
+            while((1 << bits) < size)
+                bits++;
+
+            for(int i = 0; i < size; i++)
+            {
+                int r = 0;
+                for(int b = 0; b < bits; b++)
+                    r |= ((i >> b) & 1) << (bits - 1 - b);
+                BitReverse[i] = r;
+            }
+
+            // Inverse transform: w^k = exp(+2 pi i k / size).
+            for(int k = 0; k < size / 2; k++)
+            {
+                double angle = 2.0 * 3.14159265358979323846 * k / size;
+                TwiddleRe[k] = (float)std::cos(angle);
+                TwiddleIm[k] = (float)std::sin(angle);
+            }
+        }
+    };
+
+    // b = a - w * b, a = a + w * b over [0, count).
+    inline void ButterflyRows(float* ar, float* ai, float* br, float* bi, float wr, float wi, int count)
+    {
+        int j = 0;
+#if defined(WAVES_X86)
+        __m128 vwr = _mm_set1_ps(wr);
+        __m128 vwi = _mm_set1_ps(wi);
+        for(; j + 4 <= count; j += 4)
+        {
+            __m128 xr = _mm_loadu_ps(br + j);
+            __m128 xi = _mm_loadu_ps(bi + j);
+            __m128 tr = _mm_sub_ps(_mm_mul_ps(vwr, xr), _mm_mul_ps(vwi, xi));
+            __m128 ti = _mm_add_ps(_mm_mul_ps(vwr, xi), _mm_mul_ps(vwi, xr));
+            __m128 yr = _mm_loadu_ps(ar + j);
+            __m128 yi = _mm_loadu_ps(ai + j);
+            _mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+            _mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+            _mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+            _mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+        }
+#endif
+        for(; j < count; j++)
+        {
+            float tr = wr * br[j] - wi * bi[j];
+            float ti = wr * bi[j] + wi * br[j];
+            br[j] = ar[j] - tr;
+            bi[j] = ai[j] - ti;
+            ar[j] += tr;
+            ai[j] += ti;
+        }
+    }
+
+    // In-place inverse FFT of columns [c0, c1) of size x size planes with the given pitch.
+    inline void InverseFFTColumns(const FFTPlan& plan, float* re, float* im, std::size_t pitch, int c0, int c1)
+    {
+        int size = plan.Size;
+        int count = c1 - c0;
+        for(int i = 0; i < size; i++)
+        {
+            int r = plan.BitReverse[i];
+            if(r > i)
+            {
+                std::swap_ranges(re + i * pitch + c0, re + i * pitch + c1, re + r * pitch + c0);
+                std::swap_ranges(im + i * pitch + c0, im + i * pitch + c1, im + r * pitch + c0);
+            }
+        }
+
+        for(int half = 1; half < size; half *= 2)
+        {
+            int stride = size / (2 * half);
+            for(int start = 0; start < size; start += 2 * half)
+            {
+                for(int k = 0; k < half; k++)
+                {
+                    std::size_t a = (start + k) * pitch + c0;
+                    std::size_t b = a + half * pitch;
+                    ButterflyRows(re + a, im + a, re + b, im + b, plan.TwiddleRe[k * stride], plan.TwiddleIm[k * stride], count);
+                }
+            }
+        }
+    }
+
+    // dst = transpose(src) for rows [r0, r1) of src; size is a multiple of 4.
+    inline void TransposeRows(float* dst, const float* src, int size, std::size_t pitch, int r0, int r1)
+    {
+        for(int i = r0; i < r1; i += 4)
+        {
+            for(int j = 0; j < size; j += 4)
+            {
+#if defined(WAVES_X86)
+                __m128 a = _mm_loadu_ps(src + i * pitch + j);
+                __m128 b = _mm_loadu_ps(src + (i + 1) * pitch + j);
+                __m128 c = _mm_loadu_ps(src + (i + 2) * pitch + j);
+                __m128 d = _mm_loadu_ps(src + (i + 3) * pitch + j);
+                _MM_TRANSPOSE4_PS(a, b, c, d);
+                _mm_storeu_ps(dst + j * pitch + i, a);
+                _mm_storeu_ps(dst + (j + 1) * pitch + i, b);
+                _mm_storeu_ps(dst + (j + 2) * pitch + i, c);
+                _mm_storeu_ps(dst + (j + 3) * pitch + i, d);
+#else
+                for(int y = 0; y < 4; y++)
+                    for(int x = 0; x < 4; x++)
+                        dst[(j + x) * pitch + i + y] = src[(i + y) * pitch + j + x];
+#endif
+            }
+        }
+    }
+}
+
+class OceanWaves
+{
+private:
+    // Packed fields, each the inverse FFT of one complex spectrum holding two real ones:
+    // height + i * displacement x, slope x + i * slope s, and displacement s. s is the row
+    // direction, which points along -z.
+    enum Field
+    {
+        FieldHeightDisplacementX = 0,
+        FieldSlopes,
+        FieldDisplacementS,
+        FieldCount
+    };
+
+    int mSize = 0;
+    int mPitch = 0;
+    float mPatchSize = 0.0f;
+    float mSpatialStep = 0.0f;
+    float mHalfSize = 0.0f;
+    OceanWavesSettings mSettings;
+
+    float mTime = 0.0f;
+    std::uint64_t mFrameCount = 0;
+
+    WavesExecutor mExecutor = WavesExecutor::Serial;
+    int mThreadCount = 0;
+
+    OceanKernels::FFTPlan mPlan;
+
+    // Per wave vector, stored transposed ([x frequency][s frequency]) so the first FFT pass
+    // runs along x: h0(k), conj(h0(-k)), the frequency as a multiple of 2 pi / RepeatPeriod,
+    // k and 1 / |k|.
+    std::vector<float> mH0Re;
+    std::vector<float> mH0Im;
+    std::vector<float> mH0ConjRe;
+    std::vector<float> mH0ConjIm;
+    std::vector<int> mFrequency;
+    std::vector<float> mKx;
+    std::vector<float> mKs;
+    std::vector<float> mInvK;
+
+    // exp(i n w0 t) for the current time.
+    std::vector<float> mPhaseRe;
+    std::vector<float> mPhaseIm;
+
+    WavesKernels::AlignedFloatArray mRe[FieldCount];
+    WavesKernels::AlignedFloatArray mIm[FieldCount];
+    WavesKernels::AlignedFloatArray mScratchRe[FieldCount];
+    WavesKernels::AlignedFloatArray mScratchIm[FieldCount];
+
+public:
+    // size must be a power of two (the FFT grid is size x size); patchSize is in meters.
+    OceanWaves(int size, float patchSize, const OceanWavesSettings& settings = OceanWavesSettings());
+    OceanWaves(const OceanWaves&) = delete;
+    OceanWaves& operator=(const OceanWaves&) = delete;
+    ~OceanWaves() {}
+
+    int RowCount() const { return mSize + 1; }
+    int ColumnCount() const { return mSize + 1; }
+    int VertexCount() const { return (mSize + 1) * (mSize + 1); }
+    int TriangleCount() const { return mSize * mSize * 2; }
+    float Width() const { return mPatchSize; }
+    float Depth() const { return mPatchSize; }
+
+    const OceanWavesSettings& Settings() const { return mSettings; }
+
+    WavesExecutor Executor() const { return mExecutor; }
+    void SetExecutor(WavesExecutor executor) { mExecutor = WavesKernels::ResolveExecutor(executor); }
+    int ThreadCount() const { return mThreadCount; }
+    void SetThreadCount(int threadCount) { mThreadCount = std::max(threadCount, 0); }
+    bool Multithreaded() const { return mExecutor != WavesExecutor::Serial && mThreadCount != 1; }
+    void SetMultithreaded(bool multithreaded) { SetExecutor(multithreaded ? WavesExecutor::Auto : WavesExecutor::Serial); }
+
+    float Time() const { return mTime; }
+    std::uint64_t FrameCount() const { return mFrameCount; }
+
+    // Surface height at FFT grid cell (row, col); both wrap around.
+    float Height(int row, int col) const { return mRe[FieldHeightDisplacementX][Cell(row, col)]; }
+
+    float3 Position(int i) const;
+    float3 Normal(int i) const;
+    float3 TangentX(int i) const;
+    float2 TexC(int i) const;
+
+    // Writes every vertex as { float3 Pos; float3 Normal; float2 TexC; }.
+    template<typename VertexT>
+    void WriteVertices(VertexT* dst) const;
+
+    // Advances the clock by dt and evaluates the surface; unlike Waves there are no fixed
+    // steps, any dt (including negative ones) is exact.
+    void Update(float dt);
+    template<typename VertexT>
+    void Update(float dt, VertexT* dst);
+
+    // Evaluates the surface at time t (seconds, taken modulo the repeat period).
+    void SetTime(float t);
+
+private:
+    std::size_t Cell(int row, int col) const
+    {
+        return (std::size_t)(row & (mSize - 1)) * mPitch + (col & (mSize - 1));
+    }
+
+    template<typename Fn>
+    void ParallelFor(int count, const Fn& fn) const
+    {
+        WavesKernels::ParallelFor(mExecutor, mThreadCount, count, fn);
+    }
+
+    void Evaluate();
+    void BuildSpectra(int row);
+    void InverseFFT(Field field);
+    void WriteVertexRow(int row, float* dst) const;
+};
+
+inline OceanWaves::OceanWaves(int size, float patchSize, const OceanWavesSettings& settings)
+    : mPlan(size)
+{
+    assert(size >= 8 && (size & (size - 1)) == 0);
+
+    mSize = size;
+    mPitch = size;
+    mPatchSize = patchSize;
+    mSpatialStep = patchSize / size;
+    mHalfSize = 0.5f * patchSize;
+    mSettings = settings;
+
+    std::size_t cellCount = (std::size_t)size * size;
+    mH0Re.resize(cellCount);
+    mH0Im.resize(cellCount);
+    mH0ConjRe.resize(cellCount);
+    mH0ConjIm.resize(cellCount);
+    mFrequency.resize(cellCount);
+    mKx.resize(cellCount);
+    mKs.resize(cellCount);
+    mInvK.resize(cellCount);
+
+    for(int f = 0; f < FieldCount; f++)
+    {
+        mRe[f] = WavesKernels::AllocateFloats(cellCount);
+        mIm[f] = WavesKernels::AllocateFloats(cellCount);
+        mScratchRe[f] = WavesKernels::AllocateFloats(cellCount);
+        mScratchIm[f] = WavesKernels::AllocateFloats(cellCount);
+    }
+
+    // Gaussian draws from a fixed generator and Box-Muller, so a seed gives the same ocean
+    // with every standard library.
+    std::mt19937 random(settings.Seed);
+    auto uniform = [&random]() { return ((random() >> 8) + 0.5f) * (1.0f / 16777216.0f); };
+    std::vector<float> gaussRe(cellCount);
+    std::vector<float> gaussIm(cellCount);
+    for(std::size_t c = 0; c < cellCount; c++)
+    {
+        float radius = std::sqrt(-2.0f * std::log(uniform()));
+        float angle = 6.28318531f * uniform();
+        gaussRe[c] = radius * std::cos(angle);
+        gaussIm[c] = radius * std::sin(angle);
+    }
+
+    // Wind in (x, s) coordinates; s = -z.
+    float windLength = std::sqrt(settings.WindDirection.x * settings.WindDirection.x + settings.WindDirection.y * settings.WindDirection.y);
+    float windX = windLength > 0.0f ? settings.WindDirection.x / windLength : 1.0f;
+    float windS = windLength > 0.0f ? -settings.WindDirection.y / windLength : 0.0f;
+    float largest = settings.WindSpeed * settings.WindSpeed / settings.Gravity;
+    float smallest = largest * settings.SmallWaveFraction;
+    float dk = 6.28318531f / patchSize;
+    float baseFrequency = 6.28318531f / settings.RepeatPeriod;
+
+    // Frequency index m in [-size/2, size/2) lives at array index m mod size.
+    auto frequency = [size](int index) { return index < size / 2 ? index : index - size; };
+    auto phillips = [&](float kx, float ks)
+    {
+        float k2 = kx * kx + ks * ks;
+        if(k2 == 0.0f)
+            return 0.0f;
+
+        float cosine = (kx * windX + ks * windS) / std::sqrt(k2);
+        return settings.Amplitude * std::exp(-1.0f / (k2 * largest * largest)) / (k2 * k2) *
+            cosine * cosine * std::exp(-k2 * smallest * smallest);
+    };
+
+    int maxFrequency = 0;
+    for(int x = 0; x < size; x++)
+    {
+        for(int s = 0; s < size; s++)
+        {
+            std::size_t c = (std::size_t)x * mPitch + s;
+            int mx = frequency(x);
+            int ms = frequency(s);
+            float kx = mx * dk;
+            float ks = ms * dk;
+            float k = std::sqrt(kx * kx + ks * ks);
+
+            mKx[c] = kx;
+            mKs[c] = ks;
+            mInvK[c] = k > 0.0f ? 1.0f / k : 0.0f;
+
+            // The Nyquist row and column have no partner of opposite frequency; leaving them
+            // out keeps every field real.
+            bool nyquist = mx == -size / 2 || ms == -size / 2;
+            std::size_t opposite = (std::size_t)((size - x) & (size - 1)) * mPitch + ((size - s) & (size - 1));
+            float amplitude = nyquist ? 0.0f : std::sqrt(0.5f * phillips(kx, ks)) * dk;
+            float oppositeAmplitude = nyquist ? 0.0f : std::sqrt(0.5f * phillips(-kx, -ks)) * dk;
+
+            mH0Re[c] = gaussRe[c] * amplitude;
+            mH0Im[c] = gaussIm[c] * amplitude;
+            mH0ConjRe[c] = gaussRe[opposite] * oppositeAmplitude;
+            mH0ConjIm[c] = -gaussIm[opposite] * oppositeAmplitude;
+
+            // Deep water: w^2 = g k.
+            int n = (int)std::lround(std::sqrt(settings.Gravity * k) / baseFrequency);
+            mFrequency[c] = n;
+            maxFrequency = std::max(maxFrequency, n);
+        }
+    }
+
+    mPhaseRe.resize(maxFrequency + 1);
+    mPhaseIm.resize(maxFrequency + 1);
+
+    SetExecutor(WavesExecutor::Auto);
+    Evaluate();
+}
+
+inline float3 OceanWaves::Position(int i) const
+{
+    int row = i / (mSize + 1);
+    int col = i - row * (mSize + 1);
+    std::size_t c = Cell(row, col);
+
+    // Choppy displacement pulls vertices towards the crests: x - lambda * D.
+    float lambda = mSettings.Choppiness;
+    return float3(
+        -mHalfSize + col * mSpatialStep - lambda * mIm[FieldHeightDisplacementX][c],
+        mRe[FieldHeightDisplacementX][c],
+        mHalfSize - row * mSpatialStep + lambda * mRe[FieldDisplacementS][c]);
+}
+
+inline float3 OceanWaves::Normal(int i) const
+{
+    int row = i / (mSize + 1);
+    int col = i - row * (mSize + 1);
+    std::size_t c = Cell(row, col);
+
+    // dh/dz = -dh/ds.
+    float3 n(-mRe[FieldSlopes][c], 1.0f, mIm[FieldSlopes][c]);
+    float invLength = 1.0f / sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+
+    return float3(n.x * invLength, n.y * invLength, n.z * invLength);
+}
+
+inline float3 OceanWaves::TangentX(int i) const
+{
+    int row = i / (mSize + 1);
+    int col = i - row * (mSize + 1);
+
+    float y = mRe[FieldSlopes][Cell(row, col)];
+    float invLength = 1.0f / sqrtf(1.0f + y * y);
+
+    return float3(invLength, y * invLength, 0.0f);
+}
+
+inline float2 OceanWaves::TexC(int i) const
+{
+    int row = i / (mSize + 1);
+    int col = i - row * (mSize + 1);
+
+    return float2((float)col / mSize, (float)row / mSize);
+}
+
+template<typename VertexT>
+inline void OceanWaves::WriteVertices(VertexT* dst) const
+{
+    float* vertices = WavesKernels::VertexData(dst);
+    int rowsPerTask = Multithreaded() ? WavesKernels::RowsPerTask : mSize + 1;
+    int taskCount = (mSize + 1 + rowsPerTask - 1) / rowsPerTask;
+    ParallelFor(taskCount, [=, this](int task)
+                {
+                    int begin = task * rowsPerTask;
+                    int end = std::min(begin + rowsPerTask, mSize + 1);
+                    for(int i = begin; i < end; i++)
+                        WriteVertexRow(i, vertices);
+                });
+}
+
+inline void OceanWaves::Update(float dt)
+{
+    SetTime(mTime + dt);
+}
+
+template<typename VertexT>
+inline void OceanWaves::Update(float dt, VertexT* dst)
+{
+    Update(dt);
+    WriteVertices(dst);
+}
+
+inline void OceanWaves::SetTime(float t)
+{
+    float period = mSettings.RepeatPeriod;
+    mTime = std::fmod(t, period);
+    if(mTime < 0.0f)
+        mTime += period;
+
+    Evaluate();
+}
+
+inline void OceanWaves::Evaluate()
+{
+    // exp(i n w0 t) by recurrence in double precision, restarted from sin/cos every 64
+    // entries so rounding never builds up.
+    double angle = 6.283185307179586 / mSettings.RepeatPeriod * mTime;
+    double stepRe = std::cos(angle);
+    double stepIm = std::sin(angle);
+    double re = 1.0;
+    double im = 0.0;
+    for(std::size_t n = 0; n < mPhaseRe.size(); n++)
+    {
+        if(n % 64 == 0)
+        {
+            re = std::cos(angle * n);
+            im = std::sin(angle * n);
+        }
+
+        mPhaseRe[n] = (float)re;
+        mPhaseIm[n] = (float)im;
+
+        double nextRe = re * stepRe - im * stepIm;
+        im = re * stepIm + im * stepRe;
+        re = nextRe;
+    }
+
+    int rowsPerTask = Multithreaded() ? WavesKernels::RowsPerTask : mSize;
+    ParallelFor((mSize + rowsPerTask - 1) / rowsPerTask, [=, this](int task)
+                {
+                    WavesKernels::DenormalGuard flushDenormals;
+                    int end = std::min((task + 1) * rowsPerTask, mSize);
+                    for(int row = task * rowsPerTask; row < end; row++)
+                        BuildSpectra(row);
+                });
+
+    for(int f = 0; f < FieldCount; f++)
+        InverseFFT((Field)f);
+
+    mFrameCount++;
+}
+
+// h(k, t) = h0(k) exp(i w t) + conj(h0(-k)) exp(-i w t), and from it the packed spectra:
+//
+//   height + i * displacement x     (1 + kx / k) h
+//   slope x + i * slope s           (i kx - ks) h
+//   displacement s                  -i (ks / k) h
+inline void OceanWaves::BuildSpectra(int row)
+{
+    std::size_t begin = (std::size_t)row * mPitch;
+    float* re0 = mRe[FieldHeightDisplacementX].get() + begin;
+    float* im0 = mIm[FieldHeightDisplacementX].get() + begin;
+    float* re1 = mRe[FieldSlopes].get() + begin;
+    float* im1 = mIm[FieldSlopes].get() + begin;
+    float* re2 = mRe[FieldDisplacementS].get() + begin;
+    float* im2 = mIm[FieldDisplacementS].get() + begin;
+
+    for(int s = 0; s < mSize; s++)
+    {
+        std::size_t c = begin + s;
+        int n = mFrequency[c];
+        float pr = mPhaseRe[n];
+        float pi = mPhaseIm[n];
+
+        float hr = mH0Re[c] * pr - mH0Im[c] * pi + mH0ConjRe[c] * pr + mH0ConjIm[c] * pi;
+        float hi = mH0Re[c] * pi + mH0Im[c] * pr - mH0ConjRe[c] * pi + mH0ConjIm[c] * pr;
+
+        float kx = mKx[c];
+        float ks = mKs[c];
+        float invK = mInvK[c];
+
+        float packed = 1.0f + kx * invK;
+        re0[s] = packed * hr;
+        im0[s] = packed * hi;
+
+        re1[s] = -kx * hi - ks * hr;
+        im1[s] = kx * hr - ks * hi;
+
+        re2[s] = ks * invK * hi;
+        im2[s] = -ks * invK * hr;
+    }
+}
+
+inline void OceanWaves::InverseFFT(Field field)
+{
+    using OceanKernels::StripColumns;
+
+    float* re = mRe[field].get();
+    float* im = mIm[field].get();
+    float* scratchRe = mScratchRe[field].get();
+    float* scratchIm = mScratchIm[field].get();
+    std::size_t pitch = mPitch;
+    int size = mSize;
+
+    // Spectra are stored [x frequency][s frequency]: transform along x, transpose to
+    // [s frequency][x], transform along s. The result lands in the scratch planes, which
+    // then trade places with the field's.
+    int stripCols = Multithreaded() ? StripColumns : size;
+    int stripCount = (size + stripCols - 1) / stripCols;
+    auto transform = [=, this](float* planeRe, float* planeIm)
+    {
+        ParallelFor(stripCount, [=, this](int strip)
+                    {
+                        WavesKernels::DenormalGuard flushDenormals;
+                        int c0 = strip * stripCols;
+                        OceanKernels::InverseFFTColumns(mPlan, planeRe, planeIm, pitch, c0, std::min(c0 + stripCols, size));
+                    });
+    };
+
+    transform(re, im);
+
+    int rowsPerTask = Multithreaded() ? 16 : size;
+    ParallelFor((size + rowsPerTask - 1) / rowsPerTask, [=](int task)
+                {
+                    int r0 = task * rowsPerTask;
+                    int r1 = std::min(r0 + rowsPerTask, size);
+                    OceanKernels::TransposeRows(scratchRe, re, size, pitch, r0, r1);
+                    OceanKernels::TransposeRows(scratchIm, im, size, pitch, r0, r1);
+                });
+
+    transform(scratchRe, scratchIm);
+
+    std::swap(mRe[field], mScratchRe[field]);
+    std::swap(mIm[field], mScratchIm[field]);
+}
+
+inline void OceanWaves::WriteVertexRow(int row, float* dst) const
+{
+    using WavesKernels::VertexFloats;
+
+    int columns = mSize + 1;
+    float* v = dst + (std::size_t)row * columns * VertexFloats;
+    std::size_t rowStart = (std::size_t)(row & (mSize - 1)) * mPitch;
+    const float* height = mRe[FieldHeightDisplacementX].get() + rowStart;
+    const float* displacementX = mIm[FieldHeightDisplacementX].get() + rowStart;
+    const float* slopeX = mRe[FieldSlopes].get() + rowStart;
+    const float* slopeS = mIm[FieldSlopes].get() + rowStart;
+    const float* displacementS = mRe[FieldDisplacementS].get() + rowStart;
+
+    float lambda = mSettings.Choppiness;
+    float z = mHalfSize - row * mSpatialStep;
+    float v0 = (float)row / mSize;
+    for(int col = 0; col < columns; col++, v += VertexFloats)
+    {
+        int c = col & (mSize - 1);
+        float invLength = 1.0f / sqrtf(slopeX[c] * slopeX[c] + 1.0f + slopeS[c] * slopeS[c]);
+
+        v[0] = -mHalfSize + col * mSpatialStep - lambda * displacementX[c];
+        v[1] = height[c];
+        v[2] = z + lambda * displacementS[c];
+        v[3] = -slopeX[c] * invLength;
+        v[4] = invLength;
+        v[5] = slopeS[c] * invLength;
+        v[6] = (float)col / mSize;
+        v[7] = v0;
+    }
+}
+
+#endif
@@ -0,0 +1,297 @@
+#pragma once
+
+#ifndef D3D12BOOK_TASKPOOL_H
+#define D3D12BOOK_TASKPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Portable parallel_for back ends built on std::thread only, for code that must also run
+// where ppl.h is not available. Both pools are process-wide and start their threads on
+// first use. The calling thread always takes part in the loop.
+//
+// ParallelFor calls may come from several threads at once; a call that finds the pool busy
+// (including a nested call from inside a loop body) runs serially on its own thread.
+namespace TaskPool
+{
+    // Type-erased loop body: fn(context, index). Bodies are called through a const reference,
+    // as with concurrency::parallel_for.
+    struct LoopBody
+    {
+        void (*Invoke)(const void* context, int index);
+        const void* Context;
+    };
+
+    template<typename Fn>
+    LoopBody MakeLoopBody(const Fn& fn)
+    {
+        return { [](const void* context, int index) { (*static_cast<const Fn*>(context))(index); }, &fn };
+    }
+
+    inline int DefaultThreadCount()
+    {
+        return std::max(1, (int)std::thread::hardware_concurrency());
+    }
+
+    // Shared machinery: worker threads that sleep until a loop is published, run their share
+    // of it, and report back.
+    class PoolBase
+    {
+    protected:
+        std::vector<std::thread> mThreads;
+
+        std::mutex mSubmitMutex;
+        std::mutex mMutex;
+        std::condition_variable mWake;
+        std::condition_variable mDone;
+        std::uint64_t mGeneration = 0;
+        int mParticipants = 0;
+        int mRunning = 0;
+        bool mStop = false;
+
+        void Start(int threadCount)
+        {
+            for(int i = 1; i < threadCount; i++)
+                mThreads.emplace_back([this, i]() { WorkerMain(i); });
+        }
+
+        void Stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mStop = true;
+            }
+            mWake.notify_all();
+
+            for(std::thread& thread : mThreads)
+                thread.join();
+        }
+
+        // Publishes a loop to workers 1 .. participants - 1, runs slot 0 on the caller and
+        // waits for the workers.
+        void Run(int participants)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mParticipants = participants;
+                mRunning = participants - 1;
+                mGeneration++;
+            }
+            mWake.notify_all();
+
+            RunSlot(0);
+
+            std::unique_lock<std::mutex> lock(mMutex);
+            mDone.wait(lock, [this]() { return mRunning == 0; });
+        }
+
+        virtual void RunSlot(int slot) = 0;
+
+    private:
+        void WorkerMain(int slot)
+        {
+            std::uint64_t seen = 0;
+            for(;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mMutex);
+                    mWake.wait(lock, [&]() { return mStop || mGeneration != seen; });
+                    if(mStop)
+                        return;
+
+                    seen = mGeneration;
+                    if(slot >= mParticipants)
+                        continue;
+                }
+
+                RunSlot(slot);
+
+                std::lock_guard<std::mutex> lock(mMutex);
+                if(--mRunning == 0)
+                    mDone.notify_one();
+            }
+        }
+
+    public:
+        virtual ~PoolBase() {}
+
+        int ThreadCount() const { return (int)mThreads.size() + 1; }
+    };
+
+    // Classic shared-counter pool: every participant claims the next index from one atomic
+    // counter until the range is used up.
+    class ThreadPool : public PoolBase
+    {
+    private:
+        LoopBody mBody = {};
+        int mCount = 0;
+        std::atomic<int> mNext = 0;
+
+        void RunSlot(int) override
+        {
+            for(int i = mNext.fetch_add(1, std::memory_order_relaxed); i < mCount; i = mNext.fetch_add(1, std::memory_order_relaxed))
+                mBody.Invoke(mBody.Context, i);
+        }
+
+    public:
+        explicit ThreadPool(int threadCount = DefaultThreadCount()) { Start(threadCount); }
+        ~ThreadPool() { Stop(); }
+
+        static ThreadPool& Shared()
+        {
+            static ThreadPool pool;
+            return pool;
+        }
+
+        // Runs fn(i) for i in [0, count) on up to maxThreads threads (0: all of them).
+        template<typename Fn>
+        void ParallelFor(int count, const Fn& fn, int maxThreads = 0)
+        {
+            int participants = std::min(count, maxThreads > 0 ? std::min(maxThreads, ThreadCount()) : ThreadCount());
+            std::unique_lock<std::mutex> submit(mSubmitMutex, std::try_to_lock);
+            if(participants <= 1 || !submit.owns_lock())
+            {
+                for(int i = 0; i < count; i++)
+                    fn(i);
+                return;
+            }
+
+            mBody = MakeLoopBody(fn);
+            mCount = count;
+            mNext.store(0, std::memory_order_relaxed);
+            Run(participants);
+        }
+    };
+
+    // Range-stealing pool: the index range is split evenly across participants up front. Each
+    // one pops indices from the front of its own range and, once that is empty, steals the
+    // back half of the fullest remaining range. Ranges are packed into one 64-bit word so pops
+    // and steals are single compare-and-swaps. Uneven iterations (sparse tiles, boundary
+    // rows) rebalance without a shared counter being hit on every index.
+    class WorkStealingPool : public PoolBase
+    {
+    private:
+        struct alignas(64) Range
+        {
+            std::atomic<std::uint64_t> Bounds;
+        };
+
+        static std::uint64_t Pack(std::uint32_t begin, std::uint32_t end) { return ((std::uint64_t)begin << 32) | end; }
+        static std::uint32_t Begin(std::uint64_t bounds) { return (std::uint32_t)(bounds >> 32); }
+        static std::uint32_t End(std::uint64_t bounds) { return (std::uint32_t)bounds; }
+
+        LoopBody mBody = {};
+        int mParticipantCount = 0;
+        std::unique_ptr<Range[]> mRanges;
+
+        bool PopFront(Range& range, int& index)
+        {
+            std::uint64_t bounds = range.Bounds.load(std::memory_order_acquire);
+            while(Begin(bounds) < End(bounds))
+            {
+                if(range.Bounds.compare_exchange_weak(bounds, Pack(Begin(bounds) + 1, End(bounds)), std::memory_order_acq_rel))
+                {
+                    index = (int)Begin(bounds);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        // Moves the back half of the fullest other range into the thief's (empty) range.
+        bool Steal(int thief)
+        {
+            for(;;)
+            {
+                int victim = -1;
+                std::uint32_t most = 0;
+                for(int i = 0; i < mParticipantCount; i++)
+                {
+                    std::uint64_t bounds = mRanges[i].Bounds.load(std::memory_order_acquire);
+                    std::uint32_t size = End(bounds) - std::min(Begin(bounds), End(bounds));
+                    if(i != thief && size > most)
+                    {
+                        most = size;
+                        victim = i;
+                    }
+                }
+
+                if(victim < 0)
+                    return false;
+
+                std::uint64_t bounds = mRanges[victim].Bounds.load(std::memory_order_acquire);
+                std::uint32_t begin = Begin(bounds);
+                std::uint32_t end = End(bounds);
+                if(begin >= end)
+                    continue;
+
+                std::uint32_t split = end - std::max<std::uint32_t>((end - begin) / 2, 1);
+                if(mRanges[victim].Bounds.compare_exchange_strong(bounds, Pack(begin, split), std::memory_order_acq_rel))
+                {
+                    mRanges[thief].Bounds.store(Pack(split, end), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+
+        void RunSlot(int slot) override
+        {
+            Range& own = mRanges[slot];
+            int index = 0;
+            do
+            {
+                while(PopFront(own, index))
+                    mBody.Invoke(mBody.Context, index);
+            } while(Steal(slot));
+        }
+
+    public:
+        explicit WorkStealingPool(int threadCount = DefaultThreadCount())
+        {
+            mRanges = std::make_unique<Range[]>(threadCount);
+            Start(threadCount);
+        }
+
+        ~WorkStealingPool() { Stop(); }
+
+        static WorkStealingPool& Shared()
+        {
+            static WorkStealingPool pool;
+            return pool;
+        }
+
+        // Runs fn(i) for i in [0, count) on up to maxThreads threads (0: all of them).
+        template<typename Fn>
+        void ParallelFor(int count, const Fn& fn, int maxThreads = 0)
+        {
+            int participants = std::min(count, maxThreads > 0 ? std::min(maxThreads, ThreadCount()) : ThreadCount());
+            std::unique_lock<std::mutex> submit(mSubmitMutex, std::try_to_lock);
+            if(participants <= 1 || !submit.owns_lock())
+            {
+                for(int i = 0; i < count; i++)
+                    fn(i);
+                return;
+            }
+
+            mBody = MakeLoopBody(fn);
+            mParticipantCount = participants;
+            for(int i = 0; i < participants; i++)
+            {
+                std::uint32_t begin = (std::uint32_t)((long long)count * i / participants);
+                std::uint32_t end = (std::uint32_t)((long long)count * (i + 1) / participants);
+                mRanges[i].Bounds.store(Pack(begin, end), std::memory_order_relaxed);
+            }
+
+            Run(participants);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,2816 @@
+#pragma once
+
+#ifndef D3D12BOOK_WAVES_H
+#define D3D12BOOK_WAVES_H
+
+#ifdef WAVES_HEADLESS
+
+// Minimal stand-ins for the DirectXMath-backed vector types of hlsltype.h, so the simulation
+// and its benchmarks build without any Windows or D3D headers.
+namespace HLSLType
+{
+    struct float2
+    {
+        float x;
+        float y;
+
+        float2() = default;
+        constexpr float2(float _x, float _y) : x(_x), y(_y) {}
+    };
+
+    struct float3
+    {
+        float x;
+        float y;
+        float z;
+
+        float3() = default;
+        constexpr float3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+    };
+}
+
+#else
+
+#ifndef HLSLTYPE_USE_VECTORS
+#define HLSLTYPE_USE_VECTORS
+#endif
+
+#include "hlsltype.h"
+
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "TaskPool.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define WAVES_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// The concurrency runtime back end is used on MSVC unless WAVES_NO_PPL is defined.
+#if defined(_MSC_VER) && !defined(WAVES_NO_PPL)
+#define WAVES_HAS_PPL 1
+#include <ppl.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define WAVES_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define WAVES_TARGET_AVX2
+#endif
+
+using namespace HLSLType;
+
+enum class WavesSolver
+{
+    Auto = 0,
+    Scalar,
+    SSE,
+    AVX2
+};
+
+// Time integrator. Explicit is the leapfrog stencil, stable while speed * dt / dx stays
+// below 1 / sqrt(2). ADI is implicit and unconditionally stable: each step solves one
+// tridiagonal system per row and one per column. Auto always picks Explicit and splits a dt
+// above the stability limit into ceil(dt / Waves::MaxExplicitTimeStep()) equal steps: an ADI
+// step costs about six explicit ones and only matches their accuracy up to about twice the
+// limit, so sub-stepping is cheaper at equal quality. Choose ADI explicitly where stability
+// at any dt matters more than accuracy.
+enum class WavesIntegrator
+{
+    Auto = 0,
+    Explicit,
+    ADI
+};
+
+// Where row-parallel passes run. Auto picks WAVES_DEFAULT_EXECUTOR when it is defined (for
+// example -DWAVES_DEFAULT_EXECUTOR=WavesExecutor::ThreadPool), else PPL where it exists and
+// WorkStealing elsewhere. PPL falls back to WorkStealing in builds without ppl.h.
+enum class WavesExecutor
+{
+    Auto = 0,
+    Serial,
+    PPL,
+    ThreadPool,
+    WorkStealing
+};
+
+// Compact vertex streams. Only heights and normals change from frame to frame, so a renderer
+// can keep x/z and uv in an immutable WavesStaticVertex buffer and upload just a compact
+// vertex per frame: the height as R16_SNORM in units of Waves::CompactHeightRange() and the
+// normal octahedral-encoded over the y axis as R8G8_SNORM (4 bytes) or R16G16_SNORM
+// (8 bytes). Decode in the vertex shader with
+//
+//     n = float3(e.x, 1 - abs(e.x) - abs(e.y), e.y);
+//     n.xz += n.xz >= 0 ? -saturate(-n.y) : saturate(-n.y);
+//     n = normalize(n);
+struct WavesStaticVertex
+{
+    float2 PosXZ;
+    float2 TexC;
+};
+
+struct WavesCompactVertex
+{
+    std::int16_t Height;
+    std::int8_t Normal[2];
+};
+
+struct WavesCompactVertex16
+{
+    std::int16_t Height;
+    std::int16_t Pad;
+    std::int16_t Normal[2];
+};
+
+// Result of Waves::IntersectRay.
+struct WavesRayHit
+{
+    float Distance = 0.0f;
+    float3 Position;
+    float3 Normal;
+};
+
+namespace WavesKernels
+{
+    constexpr std::size_t Alignment = 32;
+
+    // Row-parallel passes hand out blocks of this many rows so each task streams a few pages.
+    constexpr int RowsPerTask = 16;
+
+    // Vertices are written as position, normal and texture coordinate: 8 floats.
+    constexpr int VertexFloats = 8;
+
+    // Last-level cache size assumed when CPUID does not report one (non-x86 builds, or CPUs
+    // without the deterministic cache leaves): a desktop CPU with a 32 MB L3.
+    constexpr std::size_t DefaultLastLevelCacheBytes = 32 * 1024 * 1024;
+
+    // Working set a temporally blocked tile (both time levels plus halos) aims to fit in.
+    constexpr std::size_t TileCacheBytes = 1024 * 1024;
+
+    // Frees planes from AllocateFloats. A plane that lives in memory owned by something else
+    // (a mapped checkpoint) carries that owner instead and keeps it alive until released.
+    struct AlignedDelete
+    {
+        std::shared_ptr<const void> Owner;
+
+        void operator()(float* p) const
+        {
+            if(!Owner)
+                ::operator delete[](p, std::align_val_t(Alignment));
+        }
+    };
+
+    using AlignedFloatArray = std::unique_ptr<float[], AlignedDelete>;
+
+    inline AlignedFloatArray AllocateFloats(std::size_t count)
+    {
+        float* p = static_cast<float*>(::operator new[](count * sizeof(float), std::align_val_t(Alignment)));
+        std::fill(p, p + count, 0.0f);
+        return AlignedFloatArray(p);
+    }
+
+    // Heights far ahead of a wave front decay into denormals, which cost around a hundred
+    // cycles per operation on x86. Stepping code flushes them to zero; MXCSR is per thread,
+    // so every task sets up its own guard.
+    class DenormalGuard
+    {
+#ifdef WAVES_X86
+    private:
+        unsigned int mSaved;
+
+    public:
+        DenormalGuard() : mSaved(_mm_getcsr()) { _mm_setcsr(mSaved | 0x8040); }
+        ~DenormalGuard() { _mm_setcsr(mSaved); }
+#else
+    public:
+        DenormalGuard() {}
+#endif
+        DenormalGuard(const DenormalGuard&) = delete;
+        DenormalGuard& operator=(const DenormalGuard&) = delete;
+    };
+
+    // An impulse queued by Waves::QueueDisturb: a smooth bump of the given radius (in cells)
+    // centred on a possibly fractional grid position.
+    struct Impulse
+    {
+        float Row;
+        float Col;
+        float Magnitude;
+        float Radius;
+    };
+
+    // Bounded multi-producer, single-consumer queue (Vyukov's sequence-per-cell design).
+    // Any number of threads may Push() concurrently; only the simulation thread drains it.
+    class ImpulseQueue
+    {
+    private:
+        struct Cell
+        {
+            std::atomic<std::size_t> Sequence;
+            Impulse Data;
+        };
+
+        std::unique_ptr<Cell[]> mCells;
+        std::size_t mMask = 0;
+
+        // Producers and the consumer live on separate cache lines.
+        alignas(64) std::atomic<std::size_t> mEnqueuePos = 0;
+        alignas(64) std::atomic<std::uint64_t> mRejected = 0;
+        alignas(64) std::size_t mDequeuePos = 0;
+
+    public:
+        explicit ImpulseQueue(std::size_t capacity)
+        {
+            assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+
+            mCells = std::make_unique<Cell[]>(capacity);
+            mMask = capacity - 1;
+            for(std::size_t i = 0; i < capacity; i++)
+                mCells[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // Returns false, and counts the impulse as rejected, when the queue is full.
+        bool Push(const Impulse& impulse)
+        {
+            std::size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+            for(;;)
+            {
+                Cell& cell = mCells[pos & mMask];
+                std::size_t sequence = cell.Sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)pos;
+                if(diff == 0)
+                {
+                    if(mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        cell.Data = impulse;
+                        cell.Sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if(diff < 0)
+                {
+                    mRejected.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                else
+                {
+                    pos = mEnqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Moves every impulse published so far to out. Consumer thread only.
+        void Drain(std::vector<Impulse>& out)
+        {
+            for(;;)
+            {
+                Cell& cell = mCells[mDequeuePos & mMask];
+                if(cell.Sequence.load(std::memory_order_acquire) != mDequeuePos + 1)
+                    return;
+
+                out.push_back(cell.Data);
+                cell.Sequence.store(mDequeuePos + mMask + 1, std::memory_order_release);
+                mDequeuePos++;
+            }
+        }
+
+        std::uint64_t Rejected() const { return mRejected.load(std::memory_order_relaxed); }
+    };
+
+    // Adds magnitude * (1 - d^2 / r^2)^2 to cells [c0, c1) of one row, where d is the distance
+    // to (row, col) and dy2 the squared row offset. The polynomial bump is smooth at its edge
+    // and needs no square root or cosine, so it vectorizes.
+    inline void SplatRow(float* h, int c0, int c1, float col, float dy2, float invRadius2, float magnitude)
+    {
+        int j = c0;
+#ifdef WAVES_X86
+        const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+        const __m128 center = _mm_set1_ps(col);
+        const __m128 vdy2 = _mm_set1_ps(dy2);
+        const __m128 scale = _mm_set1_ps(invRadius2);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 mag = _mm_set1_ps(magnitude);
+        for(; j + 4 <= c1; j += 4)
+        {
+            __m128 dx = _mm_sub_ps(_mm_add_ps(_mm_set1_ps((float)j), lane), center);
+            __m128 q = _mm_sub_ps(one, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dx, dx), vdy2), scale));
+            q = _mm_max_ps(q, zero);
+            __m128 w = _mm_mul_ps(q, q);
+            _mm_storeu_ps(h + j, _mm_add_ps(_mm_loadu_ps(h + j), _mm_mul_ps(mag, w)));
+        }
+#endif
+        for(; j < c1; j++)
+        {
+            float dx = j - col;
+            float q = std::max(1.0f - (dx * dx + dy2) * invRadius2, 0.0f);
+            h[j] += magnitude * q * q;
+        }
+    }
+
+    // Sponge layer: scales the change over the step, next[j] - curr[j], by
+    // rowFactor * factors[j] for j in [0, count). Damping the velocity rather than the
+    // height takes energy out of the wave; scaling heights alone would only detune it.
+    inline void DampRow(float* next, const float* curr, const float* factors, float rowFactor, int count)
+    {
+        int j = 0;
+#if defined(WAVES_X86)
+        __m128 row = _mm_set1_ps(rowFactor);
+        for(; j + 4 <= count; j += 4)
+        {
+            __m128 c = _mm_loadu_ps(curr + j);
+            __m128 g = _mm_mul_ps(row, _mm_loadu_ps(factors + j));
+            _mm_storeu_ps(next + j, _mm_add_ps(c, _mm_mul_ps(g, _mm_sub_ps(_mm_loadu_ps(next + j), c))));
+        }
+#endif
+        for(; j < count; j++)
+            next[j] = curr[j] + rowFactor * factors[j] * (next[j] - curr[j]);
+    }
+
+    inline WavesExecutor ResolveExecutor(WavesExecutor executor)
+    {
+        if(executor == WavesExecutor::Auto)
+        {
+#if defined(WAVES_DEFAULT_EXECUTOR)
+            executor = WAVES_DEFAULT_EXECUTOR;
+#elif defined(WAVES_HAS_PPL)
+            executor = WavesExecutor::PPL;
+#else
+            executor = WavesExecutor::WorkStealing;
+#endif
+        }
+
+#if !defined(WAVES_HAS_PPL)
+        if(executor == WavesExecutor::PPL || executor == WavesExecutor::Auto)
+            executor = WavesExecutor::WorkStealing;
+#endif
+        return executor;
+    }
+
+    // Runs fn(i) for i in [0, count) on `executor` (already resolved) with at most
+    // threadCount threads; 0 means all of them.
+    template<typename Fn>
+    void ParallelFor(WavesExecutor executor, int threadCount, int count, const Fn& fn)
+    {
+        if(threadCount != 1 && count > 1)
+        {
+            switch(executor)
+            {
+#if defined(WAVES_HAS_PPL)
+            case WavesExecutor::PPL:
+                concurrency::parallel_for(0, count, fn);
+                return;
+#endif
+            case WavesExecutor::ThreadPool:
+                TaskPool::ThreadPool::Shared().ParallelFor(count, fn, threadCount);
+                return;
+            case WavesExecutor::WorkStealing:
+                TaskPool::WorkStealingPool::Shared().ParallelFor(count, fn, threadCount);
+                return;
+            default:
+                break;
+            }
+        }
+
+        for(int i = 0; i < count; i++)
+            fn(i);
+    }
+
+    inline bool CpuSupportsAVX2()
+    {
+#if defined(WAVES_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if(info[0] < 7)
+            return false;
+
+        // AVX needs both the CPU flag and OS support for saving the ymm registers.
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if(!osxsave || !avx)
+            return false;
+        if((_xgetbv(0) & 0x6) != 0x6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#elif defined(WAVES_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    // Size of the largest data or unified cache, from CPUID leaf 4 (Intel) or 0x8000001D
+    // (AMD); 0 if neither is available.
+    inline std::size_t DetectLastLevelCacheBytes()
+    {
+#if defined(WAVES_X86)
+        auto cpuid = [](unsigned leaf, unsigned subleaf, unsigned (&regs)[4])
+        {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuidex(info, (int)leaf, (int)subleaf);
+            for(int k = 0; k < 4; k++)
+                regs[k] = (unsigned)info[k];
+#else
+            __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        };
+
+        unsigned regs[4];
+        cpuid(0, 0, regs);
+        unsigned maxLeaf = regs[0];
+        cpuid(0x80000000u, 0, regs);
+        unsigned maxExtendedLeaf = regs[0];
+
+        for(unsigned leaf : { 4u, 0x8000001Du })
+        {
+            if(leaf > (leaf < 0x80000000u ? maxLeaf : maxExtendedLeaf))
+                continue;
+
+            std::size_t bytes = 0;
+            unsigned level = 0;
+            for(unsigned index = 0; index < 16; index++)
+            {
+                cpuid(leaf, index, regs);
+                unsigned type = regs[0] & 0x1F;
+                if(type == 0)
+                    break;
+
+                // Type 2 is an instruction cache.
+                unsigned cacheLevel = (regs[0] >> 5) & 0x7;
+                if(type == 2 || cacheLevel < level)
+                    continue;
+
+                std::size_t ways = ((regs[1] >> 22) & 0x3FF) + 1;
+                std::size_t partitions = ((regs[1] >> 12) & 0x3FF) + 1;
+                std::size_t lineSize = (regs[1] & 0xFFF) + 1;
+                std::size_t sets = (std::size_t)regs[2] + 1;
+                level = cacheLevel;
+                bytes = ways * partitions * lineSize * sets;
+            }
+
+            if(bytes > 0)
+                return bytes;
+        }
+#endif
+        return 0;
+    }
+
+    inline std::size_t LastLevelCacheBytes()
+    {
+        static const std::size_t bytes = []
+        {
+            std::size_t detected = DetectLastLevelCacheBytes();
+            return detected > 0 ? detected : DefaultLastLevelCacheBytes;
+        }();
+        return bytes;
+    }
+
+    // Updates one interior row of the wave equation in place:
+    //   out[j] = k1 * out[j] + k2 * curr[j] + k3 * (down[j] + up[j] + curr[j + 1] + curr[j - 1])
+    // out holds the previous solution on entry. All pointers address column 1 of their row,
+    // so curr[-1] and curr[count] are the (fixed) boundary columns.
+    using StepRowFn = void(*)(
+        float* out, const float* up, const float* curr, const float* down,
+        int count, float k1, float k2, float k3);
+
+    inline void StepRowScalar(
+        float* out, const float* up, const float* curr, const float* down,
+        int count, float k1, float k2, float k3)
+    {
+        for(int j = 0; j < count; j++)
+        {
+            out[j] = k1 * out[j] + k2 * curr[j] + k3 * (down[j] + up[j] + curr[j + 1] + curr[j - 1]);
+        }
+    }
+
+#ifdef WAVES_X86
+    inline void StepRowSSE(
+        float* out, const float* up, const float* curr, const float* down,
+        int count, float k1, float k2, float k3)
+    {
+        const __m128 vk1 = _mm_set1_ps(k1);
+        const __m128 vk2 = _mm_set1_ps(k2);
+        const __m128 vk3 = _mm_set1_ps(k3);
+
+        int j = 0;
+        for(; j + 4 <= count; j += 4)
+        {
+            __m128 sum = _mm_add_ps(_mm_loadu_ps(down + j), _mm_loadu_ps(up + j));
+            sum = _mm_add_ps(sum, _mm_loadu_ps(curr + j + 1));
+            sum = _mm_add_ps(sum, _mm_loadu_ps(curr + j - 1));
+
+            __m128 r = _mm_add_ps(
+                _mm_mul_ps(vk1, _mm_loadu_ps(out + j)),
+                _mm_mul_ps(vk2, _mm_loadu_ps(curr + j)));
+            r = _mm_add_ps(r, _mm_mul_ps(vk3, sum));
+
+            _mm_storeu_ps(out + j, r);
+        }
+
+        StepRowScalar(out + j, up + j, curr + j, down + j, count - j, k1, k2, k3);
+    }
+
+    WAVES_TARGET_AVX2 inline void StepRowAVX2(
+        float* out, const float* up, const float* curr, const float* down,
+        int count, float k1, float k2, float k3)
+    {
+        const __m256 vk1 = _mm256_set1_ps(k1);
+        const __m256 vk2 = _mm256_set1_ps(k2);
+        const __m256 vk3 = _mm256_set1_ps(k3);
+
+        int j = 0;
+        for(; j + 8 <= count; j += 8)
+        {
+            __m256 sum = _mm256_add_ps(_mm256_loadu_ps(down + j), _mm256_loadu_ps(up + j));
+            sum = _mm256_add_ps(sum, _mm256_loadu_ps(curr + j + 1));
+            sum = _mm256_add_ps(sum, _mm256_loadu_ps(curr + j - 1));
+
+            // Kept as separate mul/add (no FMA) so every solver produces bit-identical heights.
+            __m256 r = _mm256_add_ps(
+                _mm256_mul_ps(vk1, _mm256_loadu_ps(out + j)),
+                _mm256_mul_ps(vk2, _mm256_loadu_ps(curr + j)));
+            r = _mm256_add_ps(r, _mm256_mul_ps(vk3, sum));
+
+            _mm256_storeu_ps(out + j, r);
+        }
+
+        StepRowSSE(out + j, up + j, curr + j, down + j, count - j, k1, k2, k3);
+    }
+#endif
+
+    template<typename VertexT>
+    float* VertexData(VertexT* vertices)
+    {
+        static_assert(sizeof(VertexT) == VertexFloats * sizeof(float), "Waves writes 32 byte vertices");
+        static_assert(offsetof(VertexT, Pos) == 0 && offsetof(VertexT, Normal) == 12 && offsetof(VertexT, TexC) == 24,
+            "Waves writes vertices as { float3 Pos; float3 Normal; float2 TexC; }");
+        return reinterpret_cast<float*>(vertices);
+    }
+
+    template<typename VertexT>
+    constexpr bool IsCompactVertex = std::is_same_v<VertexT, WavesCompactVertex> || std::is_same_v<VertexT, WavesCompactVertex16>;
+
+    // Inverse of the octahedral normal encoding, for code that reads compact vertices back.
+    inline float3 DecodeCompactNormal(float ex, float ez)
+    {
+        float ny = 1.0f - fabsf(ex) - fabsf(ez);
+        float fold = std::max(-ny, 0.0f);
+        float nx = ex + (ex >= 0.0f ? -fold : fold);
+        float nz = ez + (ez >= 0.0f ? -fold : fold);
+        float invLength = 1.0f / sqrtf(nx * nx + ny * ny + nz * nz);
+
+        return float3(nx * invLength, ny * invLength, nz * invLength);
+    }
+
+    inline WavesSolver ResolveSolver(WavesSolver solver)
+    {
+#ifdef WAVES_X86
+        static const bool hasAVX2 = CpuSupportsAVX2();
+
+        if(solver == WavesSolver::Auto)
+            return hasAVX2 ? WavesSolver::AVX2 : WavesSolver::SSE;
+        if(solver == WavesSolver::AVX2 && !hasAVX2)
+            return WavesSolver::SSE;
+        return solver;
+#else
+        return WavesSolver::Scalar;
+#endif
+    }
+
+    inline StepRowFn GetStepRow(WavesSolver solver)
+    {
+        switch(solver)
+        {
+#ifdef WAVES_X86
+        case WavesSolver::SSE:
+            return StepRowSSE;
+        case WavesSolver::AVX2:
+            return StepRowAVX2;
+#endif
+        default:
+            return StepRowScalar;
+        }
+    }
+
+    // ADI kernels. A step solves scale * (I - beta Lx)(I - beta Lz) d = rhs for the second
+    // difference in time d = next - 2 curr + prev, where Lx and Lz are the 1D second
+    // differences; see Waves::StepADI().
+
+    // rhs[j] = scale * (e * (5-point Laplacian of curr) - dampingDt * (curr[j] - prev[j])).
+    inline void AdiRhsRow(
+        float* rhs, const float* prev, const float* up, const float* curr, const float* down,
+        int count, float e, float dampingDt, float scale)
+    {
+        int j = 0;
+#if defined(WAVES_X86)
+        __m128 ve = _mm_set1_ps(e * scale);
+        __m128 vd = _mm_set1_ps(dampingDt * scale);
+        __m128 four = _mm_set1_ps(4.0f);
+        for(; j + 4 <= count; j += 4)
+        {
+            __m128 c = _mm_loadu_ps(curr + j);
+            __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(up + j), _mm_loadu_ps(down + j)),
+                                    _mm_add_ps(_mm_loadu_ps(curr + j - 1), _mm_loadu_ps(curr + j + 1)));
+            __m128 laplacian = _mm_sub_ps(sum, _mm_mul_ps(four, c));
+            __m128 velocity = _mm_sub_ps(c, _mm_loadu_ps(prev + j));
+            _mm_storeu_ps(rhs + j, _mm_sub_ps(_mm_mul_ps(ve, laplacian), _mm_mul_ps(vd, velocity)));
+        }
+#endif
+        for(; j < count; j++)
+        {
+            float laplacian = up[j] + down[j] + curr[j - 1] + curr[j + 1] - 4.0f * curr[j];
+            rhs[j] = scale * (e * laplacian - dampingDt * (curr[j] - prev[j]));
+        }
+    }
+
+    // Thomas algorithm for (I - beta L) x = x along a row, in place. The matrix is the same
+    // for every row, so its elimination factors are precomputed: inv[j] is the reciprocal
+    // pivot and upper[j] = beta * inv[j]. The forward recurrence is written as
+    // x * inv + upper * carry so only one multiply and one add sit on the dependency chain.
+    inline void AdiSolveRow(float* x, const float* inv, const float* upper, int count)
+    {
+        float carry = 0.0f;
+        for(int j = 0; j < count; j++)
+        {
+            carry = x[j] * inv[j] + upper[j] * carry;
+            x[j] = carry;
+        }
+
+        carry = 0.0f;
+        for(int j = count - 1; j >= 0; j--)
+        {
+            carry = x[j] + upper[j] * carry;
+            x[j] = carry;
+        }
+    }
+
+#if defined(WAVES_X86)
+    // AdiSolveRow for AdiGroupRows rows at once (rows + r * pitch), in two interleaved groups
+    // of four: 4x4 blocks are transposed so each lane carries one row's recurrence, and the
+    // two groups hide each other's latency.
+    constexpr int AdiGroupRows = 8;
+
+    inline void AdiSolveRows(float* rows, std::size_t pitch, const float* inv, const float* upper, int count)
+    {
+        int blockEnd = count & ~3;
+        float* r[AdiGroupRows];
+        for(int k = 0; k < AdiGroupRows; k++)
+            r[k] = rows + k * pitch;
+
+        __m128 carryA = _mm_setzero_ps();
+        __m128 carryB = _mm_setzero_ps();
+        for(int j = 0; j < blockEnd; j += 4)
+        {
+            __m128 a0 = _mm_loadu_ps(r[0] + j), a1 = _mm_loadu_ps(r[1] + j), a2 = _mm_loadu_ps(r[2] + j), a3 = _mm_loadu_ps(r[3] + j);
+            __m128 b0 = _mm_loadu_ps(r[4] + j), b1 = _mm_loadu_ps(r[5] + j), b2 = _mm_loadu_ps(r[6] + j), b3 = _mm_loadu_ps(r[7] + j);
+            _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+            _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+
+            __m128* a[4] = { &a0, &a1, &a2, &a3 };
+            __m128* b[4] = { &b0, &b1, &b2, &b3 };
+            for(int k = 0; k < 4; k++)
+            {
+                __m128 vi = _mm_set1_ps(inv[j + k]);
+                __m128 vu = _mm_set1_ps(upper[j + k]);
+                carryA = _mm_add_ps(_mm_mul_ps(*a[k], vi), _mm_mul_ps(vu, carryA));
+                carryB = _mm_add_ps(_mm_mul_ps(*b[k], vi), _mm_mul_ps(vu, carryB));
+                *a[k] = carryA;
+                *b[k] = carryB;
+            }
+
+            _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+            _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+            _mm_storeu_ps(r[0] + j, a0); _mm_storeu_ps(r[1] + j, a1); _mm_storeu_ps(r[2] + j, a2); _mm_storeu_ps(r[3] + j, a3);
+            _mm_storeu_ps(r[4] + j, b0); _mm_storeu_ps(r[5] + j, b1); _mm_storeu_ps(r[6] + j, b2); _mm_storeu_ps(r[7] + j, b3);
+        }
+
+        // The last count % 4 columns run per row, then the back substitution starts there.
+        alignas(16) float carry[AdiGroupRows];
+        _mm_store_ps(carry, carryA);
+        _mm_store_ps(carry + 4, carryB);
+        for(int k = 0; k < AdiGroupRows; k++)
+        {
+            float c = carry[k];
+            for(int j = blockEnd; j < count; j++)
+            {
+                c = r[k][j] * inv[j] + upper[j] * c;
+                r[k][j] = c;
+            }
+
+            c = 0.0f;
+            for(int j = count - 1; j >= blockEnd; j--)
+            {
+                c = r[k][j] + upper[j] * c;
+                r[k][j] = c;
+            }
+            carry[k] = c;
+        }
+
+        carryA = _mm_load_ps(carry);
+        carryB = _mm_load_ps(carry + 4);
+        for(int j = blockEnd - 4; j >= 0; j -= 4)
+        {
+            __m128 a0 = _mm_loadu_ps(r[0] + j), a1 = _mm_loadu_ps(r[1] + j), a2 = _mm_loadu_ps(r[2] + j), a3 = _mm_loadu_ps(r[3] + j);
+            __m128 b0 = _mm_loadu_ps(r[4] + j), b1 = _mm_loadu_ps(r[5] + j), b2 = _mm_loadu_ps(r[6] + j), b3 = _mm_loadu_ps(r[7] + j);
+            _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+            _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+
+            __m128* a[4] = { &a0, &a1, &a2, &a3 };
+            __m128* b[4] = { &b0, &b1, &b2, &b3 };
+            for(int k = 3; k >= 0; k--)
+            {
+                __m128 vu = _mm_set1_ps(upper[j + k]);
+                carryA = _mm_add_ps(*a[k], _mm_mul_ps(vu, carryA));
+                carryB = _mm_add_ps(*b[k], _mm_mul_ps(vu, carryB));
+                *a[k] = carryA;
+                *b[k] = carryB;
+            }
+
+            _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+            _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+            _mm_storeu_ps(r[0] + j, a0); _mm_storeu_ps(r[1] + j, a1); _mm_storeu_ps(r[2] + j, a2); _mm_storeu_ps(r[3] + j, a3);
+            _mm_storeu_ps(r[4] + j, b0); _mm_storeu_ps(r[5] + j, b1); _mm_storeu_ps(r[6] + j, b2); _mm_storeu_ps(r[7] + j, b3);
+        }
+    }
+#endif
+
+    // One row of the forward sweep of the column solves, vectorized across columns:
+    // x[j] = x[j] * inv + upper * above[j].
+    inline void AdiForwardRow(float* x, const float* above, float inv, float upper, int count)
+    {
+        int j = 0;
+#if defined(WAVES_X86)
+        __m128 vi = _mm_set1_ps(inv);
+        __m128 vu = _mm_set1_ps(upper);
+        for(; j + 4 <= count; j += 4)
+            _mm_storeu_ps(x + j, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + j), vi), _mm_mul_ps(vu, _mm_loadu_ps(above + j))));
+#endif
+        for(; j < count; j++)
+            x[j] = x[j] * inv + upper * above[j];
+    }
+
+    // One row of the back substitution of the column solves, fused with the update of the
+    // heights: x[j] += upper * below[j], then prev[j] = x[j] + 2 curr[j] - prev[j].
+    inline void AdiBackRow(float* x, const float* below, float upper, float* prev, const float* curr, int count)
+    {
+        int j = 0;
+#if defined(WAVES_X86)
+        __m128 vu = _mm_set1_ps(upper);
+        for(; j + 4 <= count; j += 4)
+        {
+            __m128 d = _mm_add_ps(_mm_loadu_ps(x + j), _mm_mul_ps(vu, _mm_loadu_ps(below + j)));
+            __m128 c = _mm_loadu_ps(curr + j);
+            _mm_storeu_ps(x + j, d);
+            _mm_storeu_ps(prev + j, _mm_sub_ps(_mm_add_ps(d, _mm_add_ps(c, c)), _mm_loadu_ps(prev + j)));
+        }
+#endif
+        for(; j < count; j++)
+        {
+            x[j] += upper * below[j];
+            prev[j] = x[j] + 2.0f * curr[j] - prev[j];
+        }
+    }
+}
+
+class WavesCheckpoint;
+
+class Waves
+{
+private:
+    friend class WavesCheckpoint;
+
+    int mNumRows = 0;
+    int mNumCols = 0;
+    int mRowPitch = 0;
+
+    int mVertexCount = 0;
+    int mTriangleCount = 0;
+
+    float mSpeed = 0.0f;
+    float mDamping = 0.0f;
+
+    float mK1 = 0.0f;
+    float mK2 = 0.0f;
+    float mK3 = 0.0f;
+
+    float mTimeStep = 0.0f;
+    float mSpatialStep = 0.0f;
+
+    // ADI integrator: mAdiBeta = theta * e / a and mAdiScale = 1 / a, with e the squared
+    // Courant number and a = 1 + damping * dt / 2. mAdiInv*/mAdiUpper* hold the Thomas
+    // factors for the row (X) and column (Z) systems; mAdiScratch holds the intermediate
+    // solution between the two sweeps.
+    WavesIntegrator mIntegrator = WavesIntegrator::Explicit;
+    float mAdiE = 0.0f;
+    float mAdiBeta = 0.0f;
+    float mAdiScale = 0.0f;
+    float mAdiDampingDt = 0.0f;
+    std::vector<float> mAdiInvX;
+    std::vector<float> mAdiUpperX;
+    std::vector<float> mAdiInvZ;
+    std::vector<float> mAdiUpperZ;
+
+    // Fixed-step scheduler: Update() adds dt to mAccumulator and runs whole steps from it,
+    // at most mMaxSubSteps per call. Steps over that budget are deferred to later calls, up
+    // to one more budget's worth; anything beyond is dropped. mCarriedSteps is the backlog
+    // the last call left in mAccumulator, so a step carried over several calls is counted
+    // in mDeferredSteps only once.
+    float mAccumulator = 0.0f;
+    int mMaxSubSteps = 4;
+    int mLastSubSteps = 0;
+    std::uint64_t mCarriedSteps = 0;
+    std::uint64_t mDeferredSteps = 0;
+    std::uint64_t mDroppedSteps = 0;
+
+    float mHalfWidth = 0.0f;
+    float mHalfDepth = 0.0f;
+
+    // Height that maps to +-1 in the compact vertex streams.
+    float mCompactHeightRange = DefaultCompactHeightRange;
+
+    // Change tracking for delta uploads. Every change to the heights bumps mSurfaceVersion
+    // and stamps the vertex rows whose positions or normals it affects; steps that touch the
+    // whole grid stamp mAllRowsVersion instead. The boundary rows never change.
+    std::uint64_t mSurfaceVersion = 0;
+    std::uint64_t mAllRowsVersion = 0;
+    std::vector<std::uint64_t> mRowVersion;
+    mutable std::vector<int> mChangedRows;
+    mutable std::uint64_t mVertexBytesWritten = 0;
+
+    WavesSolver mSolver = WavesSolver::Scalar;
+    WavesKernels::StepRowFn mStepRow = WavesKernels::StepRowScalar;
+
+    // Row-parallel passes run on mExecutor with at most mThreadCount threads (0: all).
+    WavesExecutor mExecutor = WavesExecutor::Serial;
+    int mThreadCount = 0;
+
+    std::uint64_t mStepCount = 0;
+
+    // Impulses from QueueDisturb(), applied at the start of the next step.
+    WavesKernels::ImpulseQueue mImpulseQueue;
+    std::vector<WavesKernels::Impulse> mImpulses;
+    std::uint64_t mImpulsesApplied = 0;
+
+    // Temporal blocking: Step(count) advances mTileRows x mTileCols tiles by up to
+    // mTileDepth sweeps each before moving on, reading a halo of mTileDepth cells.
+    // A size of 0 is derived from WavesKernels::TileCacheBytes. Grids whose two height planes
+    // take fewer than mTiledMinBytes are always swept whole.
+    int mTileRows = 0;
+    int mTileCols = 0;
+    int mTileDepth = 8;
+    std::size_t mTiledMinBytes = WavesKernels::LastLevelCacheBytes();
+
+    // Sparse stepping: the grid is split into mActiveTileSize^2 tiles and only tiles that
+    // are active, or next to an active tile, are stepped. A tile whose heights stay at or
+    // below mQuietHeight for two steps (both time levels) goes quiet; once no neighbour is
+    // active either it is zeroed, so skipping it is exact.
+    enum TileState : std::uint8_t
+    {
+        TileZero = 0,
+        TileActive,
+        TileCooling,
+        TileQuiet
+    };
+
+    // Absorbing boundary: a sponge layer mAbsorbWidth cells wide inside the fixed edge.
+    // Every step damps the velocity there: the change over the step, next - curr, is scaled
+    // by mAbsorbRows[i] * mAbsorbCols[j] (see WavesKernels::DampRow), which ramps from 1 at
+    // the inner edge of the layer down towards the boundary, so outgoing waves lose their
+    // energy instead of reflecting.
+    int mAbsorbWidth = 0;
+    float mAbsorbStrength = 0.0f;
+    std::vector<float> mAbsorbRows;
+    std::vector<float> mAbsorbCols;
+
+    bool mSparse = false;
+    int mActiveTileSize = 32;
+    int mActiveTilesX = 0;
+    int mActiveTilesY = 0;
+    float mQuietHeight = 1e-4f;
+    std::vector<std::uint8_t> mTileActive;
+    std::vector<std::uint8_t> mTileStepped;
+    int mActiveTileCount = 0;
+    std::size_t mSteppedCells = 0;
+
+    WavesKernels::AlignedFloatArray mAdiScratch;
+
+    // Heights live in contiguous float planes (row pitch padded to the SIMD width) so the
+    // stencil reads unit-stride rows. x/z/uv are implied by the grid and normals/tangents
+    // are derived from the current plane on demand.
+    WavesKernels::AlignedFloatArray mPrevSolution;
+    WavesKernels::AlignedFloatArray mCurrSolution;
+
+public:
+    Waves(
+        int m, int n, float dx, float dt, float speed, float damping,
+        WavesSolver solver = WavesSolver::Auto, WavesIntegrator integrator = WavesIntegrator::Auto);
+    Waves(const Waves&) = delete;
+    Waves& operator=(const Waves&) = delete;
+    ~Waves() {}
+
+    int RowCount() const { return mNumRows; }
+    int ColumnCount() const { return mNumCols; }
+    int RowPitch() const { return mRowPitch; }
+    int VertexCount() const { return mVertexCount; }
+    int TriangleCount() const { return mTriangleCount; }
+    float Width() const { return mNumCols * mSpatialStep; }
+    float Depth() const { return mNumRows * mSpatialStep; }
+
+    WavesSolver Solver() const { return mSolver; }
+    void SetSolver(WavesSolver solver);
+
+    // The integrator is fixed at construction. Tiling, sparse stepping and the fused vertex
+    // write only apply to the explicit one; ADI steps the whole grid with two sweeps.
+    WavesIntegrator Integrator() const { return mIntegrator; }
+
+    // Largest time step the explicit integrator is stable for.
+    static float MaxExplicitTimeStep(float dx, float speed) { return dx / (speed * 1.41421356f); }
+
+    WavesExecutor Executor() const { return mExecutor; }
+    void SetExecutor(WavesExecutor executor) { mExecutor = WavesKernels::ResolveExecutor(executor); }
+
+    // Caps the threads a pass may use; 0 means every thread of the executor. The PPL
+    // executor only honours 1 (run serially); limit it through its scheduler policy instead.
+    int ThreadCount() const { return mThreadCount; }
+    void SetThreadCount(int threadCount) { mThreadCount = std::max(threadCount, 0); }
+
+    bool Multithreaded() const { return mExecutor != WavesExecutor::Serial && mThreadCount != 1; }
+    void SetMultithreaded(bool multithreaded) { SetExecutor(multithreaded ? WavesExecutor::Auto : WavesExecutor::Serial); }
+
+    // Number of simulation steps taken since construction.
+    std::uint64_t StepCount() const { return mStepCount; }
+
+    // Time advanced by one Step(). With WavesIntegrator::Auto this is the constructor's dt
+    // divided into stable sub-steps, and MaxSubSteps() is scaled by the same factor.
+    float TimeStep() const { return mTimeStep; }
+    int MaxSubSteps() const { return mMaxSubSteps; }
+    void SetMaxSubSteps(int maxSubSteps) { mMaxSubSteps = std::max(maxSubSteps, 1); }
+
+    // Steps run by the last Update(), and running totals of steps pushed to a later Update()
+    // or discarded because the budget was exceeded. A step is counted as deferred once, when
+    // it first misses the budget, however many calls it then waits.
+    int LastSubSteps() const { return mLastSubSteps; }
+    std::uint64_t DeferredSteps() const { return mDeferredSteps; }
+    std::uint64_t DroppedSteps() const { return mDroppedSteps; }
+
+    // Fraction of a time step accumulated since the last step, in [0, 1]. A renderer can
+    // blend PreviousHeights() towards Heights() by this factor to draw between steps.
+    float InterpolationFactor() const { return std::min(mAccumulator / mTimeStep, 1.0f); }
+
+    int TileDepth() const { return mTileDepth; }
+    void SetTiling(int tileRows, int tileColumns, int depth);
+
+    // Smallest size of the two height planes, in bytes, at which Step(count) uses temporal
+    // blocking. Defaults to the last-level cache size (WavesKernels::LastLevelCacheBytes):
+    // smaller grids stay in cache between sweeps, and the halo cells a tile recomputes then
+    // cost more than the memory traffic blocking saves. WavesBench --compare measures the
+    // crossover per thread count.
+    std::size_t TiledMinBytes() const { return mTiledMinBytes; }
+    void SetTiledMinBytes(std::size_t bytes) { mTiledMinBytes = bytes; }
+
+    // Replaces the reflecting edge with a sponge layer `width` cells wide (0 turns it off).
+    // The per-step velocity factor falls off as exp(-strength * x^2), x running from 0 at
+    // the inner edge of the layer to 1 at the boundary. A strength of 0 picks
+    // AbsorbStrengthPerCell / width: stronger layers reflect off their own gradient,
+    // weaker ones let waves through. 16 cells removes most of the echo, 32 nearly all
+    // of it; WavesBench --compare measures both.
+    int AbsorbingWidth() const { return mAbsorbWidth; }
+    float AbsorbingStrength() const { return mAbsorbStrength; }
+    void SetAbsorbingBoundary(int width, float strength = 0.0f);
+
+    bool Sparse() const { return mSparse; }
+    void SetSparse(bool sparse, int tileSize = 32, float quietHeight = 1e-4f);
+    int ActiveTileCount() const { return mActiveTileCount; }
+    int ActiveTileTotal() const { return mActiveTilesX * mActiveTilesY; }
+
+    // Interior cells updated by the last step; less than the full grid in sparse mode.
+    std::size_t SteppedCellCount() const { return mSteppedCells; }
+
+    float Height(int row, int col) const { return mCurrSolution[row * mRowPitch + col]; }
+    const float* Heights() const { return mCurrSolution.get(); }
+    const float* PreviousHeights() const { return mPrevSolution.get(); }
+
+    float3 Position(int i) const;
+    float3 Normal(int i) const;
+    float3 TangentX(int i) const;
+    float2 TexC(int i) const;
+
+    // Surface queries in the grid's local space (the space of Position()), for buoyancy and
+    // picking. Between vertices the surface is the bilinear blend of the four heights around
+    // the point, and the normal blends the vertex normals' slopes the same way, so at a
+    // vertex the queries agree with Position() and Normal(). Points outside the grid are
+    // clamped to its edge, which stays flat. Queries read the current plane: do not overlap
+    // them with a step.
+    float SampleHeight(float x, float z) const;
+
+    // heights[k] and normals[k] at (x[k], z[k]) for k in [0, count); either output may be
+    // null. Large batches are split across the executor.
+    void SampleSurface(const float* x, const float* z, int count, float* heights, float3* normals = nullptr) const;
+
+    // First point of origin + t * direction, t in [0, maxDistance], that is at or below the
+    // surface inside the grid. hit.Distance is t, in units of direction's length.
+    bool IntersectRay(const float3& origin, const float3& direction, float maxDistance, WavesRayHit& hit) const;
+
+    // Writes VertexCount() vertices of the current surface to dst, typically the mapped
+    // memory of an upload buffer. Writes are sequential and use streaming stores.
+    template<typename VertexT>
+    void WriteVertices(VertexT* dst) const;
+
+    // Compact streams (see WavesCompactVertex): WriteStaticVertices fills the immutable
+    // x/z/uv stream once, WriteCompactVertices writes the heights and normals each frame.
+    // Heights beyond +-CompactHeightRange() saturate.
+    float CompactHeightRange() const { return mCompactHeightRange; }
+    void SetCompactHeightRange(float range) { mCompactHeightRange = range; }
+    void WriteStaticVertices(WavesStaticVertex* dst) const;
+    template<typename CompactVertexT>
+    void WriteCompactVertices(CompactVertexT* dst) const;
+
+    // Delta uploads. A vertex buffer that holds the surface as of SurfaceVersion() v only
+    // needs the rows RowChanged(row, v) reports to catch up. WriteChangedVertices writes
+    // those rows (every row when version is 0, for a buffer never written) of either vertex
+    // layout, sets version to SurfaceVersion() and returns the bytes written. Keep one
+    // version per buffer, e.g. per frame resource.
+    std::uint64_t SurfaceVersion() const { return mSurfaceVersion; }
+    bool RowChanged(int row, std::uint64_t version) const { return std::max(mRowVersion[row], mAllRowsVersion) > version; }
+    template<typename VertexT>
+    std::size_t WriteChangedVertices(VertexT* dst, std::uint64_t& version) const;
+
+    // Bytes written by all vertex writers so far.
+    std::uint64_t VertexBytesWritten() const { return mVertexBytesWritten; }
+
+    void Update(float dt);
+
+    // Same as Update(dt), then WriteChangedVertices(dst, version).
+    template<typename VertexT>
+    std::size_t Update(float dt, VertexT* dst, std::uint64_t& version);
+
+    // Same as Update(dt), then WriteVertices(dst) or, for the compact vertex types,
+    // WriteCompactVertices(dst). The last step and the full vertex pass run together, so
+    // each row is packed while the rows around it are still in cache.
+    template<typename VertexT>
+    void Update(float dt, VertexT* dst);
+
+    void Step();
+    void Step(int count);
+    void Disturb(int i, int j, float magnitude);
+
+    // Thread-safe: queues a bump of the given radius (in cells) at a possibly fractional grid
+    // position, to be added at the start of the next step. Returns false if the queue is full,
+    // any argument is not finite or the radius is not positive.
+    bool QueueDisturb(float row, float col, float magnitude, float radius = DefaultSplatRadius);
+
+    // Applies the queued impulses now. Steps do this themselves; simulation thread only.
+    void ApplyDisturbances();
+
+    // Impulses that changed at least one interior cell; ones that fell entirely outside the
+    // interior are drained from the queue but not counted.
+    std::uint64_t DisturbancesApplied() const { return mImpulsesApplied; }
+    std::uint64_t DisturbancesRejected() const { return mImpulseQueue.Rejected(); }
+
+    static constexpr float DefaultSplatRadius = 1.5f;
+    static constexpr std::size_t DisturbanceCapacity = 1 << 14;
+    static constexpr float AbsorbStrengthPerCell = 1.6f;
+    static constexpr int AdiStripColumns = 64;
+    static constexpr float DefaultCompactHeightRange = 4.0f;
+    static constexpr int SamplePointsPerTask = 4096;
+
+private:
+    int ScheduleSteps(float dt);
+    int ConcurrencyLevel() const;
+    template<typename Fn>
+    void ParallelFor(int count, const Fn& fn) const;
+    void StepRows(int begin, int end);
+    void StepADI();
+    void AbsorbRow(float* next, const float* curr, int row, int c0, int c1) const;
+    void StepSparse();
+    void UpdateTileActivity(int tileX, int tileY);
+    float TileAmplitude(int tileX, int tileY, const float* plane) const;
+    void ActivateTile(int row, int col);
+    void StepAndWriteVertices(float* dst);
+    void WriteVertexRows(float* dst) const;
+    void WriteVertexRow(const float* plane, int row, float* dst) const;
+    void SampleSurfaceRange(const float* x, const float* z, int begin, int end, float* heights, float3* normals) const;
+    void MarkRowsChanged(int begin, int end);
+    void RestoreState(WavesKernels::AlignedFloatArray prev, WavesKernels::AlignedFloatArray curr, float accumulator, std::uint64_t stepCount);
+    void MarkAllRowsChanged() { mAllRowsVersion = ++mSurfaceVersion; }
+    template<typename CompactVertexT>
+    void WriteCompactVertexRow(const float* plane, int row, CompactVertexT* dst) const;
+    void StepTiled(int depth);
+    void StepTile(
+        int r0, int r1, int c0, int c1, int depth,
+        const float* topHalo, const float* bottomHalo, const float* leftHalo,
+        float* saveTopHalo, float* saveLeftHalo);
+    void CopyRows(float* dst, int row, int count, int c0, int c1) const;
+};
+
+inline Waves::Waves(
+    int m, int n, float dx, float dt, float speed, float damping,
+    WavesSolver solver, WavesIntegrator integrator)
+    : mImpulseQueue(DisturbanceCapacity)
+{
+    mNumRows = m;
+    mNumCols = n;
+    mRowPitch = (n + 7) & ~7;
+
+    mVertexCount = m * n;
+    mTriangleCount = (m - 1) * (n - 1) * 2;
+
+    // Sub-steps keep Update(dt) covering the same simulated time per call.
+    if(integrator == WavesIntegrator::Auto)
+    {
+        integrator = WavesIntegrator::Explicit;
+        float maxStep = MaxExplicitTimeStep(dx, speed);
+        if(dt > maxStep)
+        {
+            int subSteps = (int)std::ceil(dt / maxStep);
+            dt /= subSteps;
+            mMaxSubSteps *= subSteps;
+        }
+    }
+    mIntegrator = integrator;
+
+    mTimeStep = dt;
+    mSpatialStep = dx;
+
+    mSpeed = speed;
+    mDamping = damping;
+
+    float d = damping * dt + 2.0f;
+    float e = speed * speed * dt * dt / (dx * dx);
+    mK1 = (damping * dt - 2.0f) / d;
+    mK2 = (4.0f - 8.0f * e) / d;
+    mK3 = (2.0f * e) / d;
+
+    mHalfWidth = (n - 1) * dx * 0.5f;
+    mHalfDepth = (m - 1) * dx * 0.5f;
+
+    mPrevSolution = WavesKernels::AllocateFloats((std::size_t)m * mRowPitch);
+    mCurrSolution = WavesKernels::AllocateFloats((std::size_t)m * mRowPitch);
+    mRowVersion.assign(m, 0);
+
+    if(integrator == WavesIntegrator::ADI)
+    {
+        // theta = 1/4 weights the new, current and old level 1:2:1 in the Laplacian, which
+        // is unconditionally stable; factoring the 2D operator into Lx and Lz sweeps adds
+        // an O(dt^4) term that keeps it so.
+        constexpr float theta = 0.25f;
+        float a = 1.0f + 0.5f * damping * dt;
+        mAdiE = e;
+        mAdiScale = 1.0f / a;
+        mAdiBeta = theta * e / a;
+        mAdiDampingDt = damping * dt;
+
+        auto factor = [this](int count, std::vector<float>& inv, std::vector<float>& upper)
+        {
+            inv.resize(std::max(count, 0));
+            upper.resize(inv.size());
+
+            float pivotUpper = 0.0f;
+            for(int j = 0; j < count; j++)
+            {
+                inv[j] = 1.0f / (1.0f + 2.0f * mAdiBeta - mAdiBeta * pivotUpper);
+                upper[j] = mAdiBeta * inv[j];
+                pivotUpper = upper[j];
+            }
+        };
+        factor(n - 2, mAdiInvX, mAdiUpperX);
+        factor(m - 2, mAdiInvZ, mAdiUpperZ);
+
+        mAdiScratch = WavesKernels::AllocateFloats((std::size_t)m * mRowPitch);
+    }
+
+    SetSolver(solver);
+    SetExecutor(WavesExecutor::Auto);
+}
+
+inline void Waves::SetSolver(WavesSolver solver)
+{
+    mSolver = WavesKernels::ResolveSolver(solver);
+    mStepRow = WavesKernels::GetStepRow(mSolver);
+}
+
+inline int Waves::ConcurrencyLevel() const
+{
+    int threads = 1;
+    switch(mExecutor)
+    {
+    case WavesExecutor::PPL:
+        threads = (int)std::thread::hardware_concurrency();
+        break;
+    case WavesExecutor::ThreadPool:
+        threads = TaskPool::ThreadPool::Shared().ThreadCount();
+        break;
+    case WavesExecutor::WorkStealing:
+        threads = TaskPool::WorkStealingPool::Shared().ThreadCount();
+        break;
+    default:
+        break;
+    }
+
+    if(mThreadCount > 0)
+        threads = std::min(threads, mThreadCount);
+    return std::max(threads, 1);
+}
+
+// Runs fn(i) for i in [0, count) on the selected executor.
+template<typename Fn>
+inline void Waves::ParallelFor(int count, const Fn& fn) const
+{
+    WavesKernels::ParallelFor(mExecutor, mThreadCount, count, fn);
+}
+
+inline void Waves::SetTiling(int tileRows, int tileColumns, int depth)
+{
+    assert(tileRows >= 0 && tileColumns >= 0);
+
+    mTileRows = tileRows;
+    mTileCols = tileColumns;
+    mTileDepth = std::max(depth, 1);
+}
+
+inline void Waves::SetAbsorbingBoundary(int width, float strength)
+{
+    assert(width >= 0 && strength >= 0.0f);
+
+    // Interior cells run from 1 to n - 2; the layer can cover at most half of them.
+    mAbsorbWidth = std::min(width, (std::min(mNumRows, mNumCols) - 2) / 2);
+    mAbsorbStrength = strength > 0.0f || mAbsorbWidth == 0 ? strength : AbsorbStrengthPerCell / mAbsorbWidth;
+    mAbsorbRows.clear();
+    mAbsorbCols.clear();
+    if(mAbsorbWidth == 0)
+        return;
+
+    auto profile = [this](int index, int count)
+    {
+        int d = std::min(index - 1, count - 2 - index);
+        if(d < 0 || d >= mAbsorbWidth)
+            return 1.0f;
+
+        float x = (float)(mAbsorbWidth - d) / mAbsorbWidth;
+        return std::exp(-mAbsorbStrength * x * x);
+    };
+
+    mAbsorbRows.resize(mNumRows);
+    for(int i = 0; i < mNumRows; i++)
+        mAbsorbRows[i] = profile(i, mNumRows);
+
+    mAbsorbCols.resize(mNumCols);
+    for(int j = 0; j < mNumCols; j++)
+        mAbsorbCols[j] = profile(j, mNumCols);
+}
+
+inline void Waves::SetSparse(bool sparse, int tileSize, float quietHeight)
+{
+    mSparse = sparse;
+    mTileActive.clear();
+    mTileStepped.clear();
+    mActiveTileCount = 0;
+    mActiveTilesX = 0;
+    mActiveTilesY = 0;
+    if(!sparse)
+        return;
+
+    assert(tileSize >= 8 && quietHeight >= 0.0f);
+
+    mActiveTileSize = tileSize;
+    mQuietHeight = quietHeight;
+    mActiveTilesX = (mNumCols + tileSize - 1) / tileSize;
+    mActiveTilesY = (mNumRows + tileSize - 1) / tileSize;
+    mTileActive.assign((std::size_t)mActiveTilesX * mActiveTilesY, 0);
+    mTileStepped.assign(mTileActive.size(), 0);
+
+    for(int ty = 0; ty < mActiveTilesY; ty++)
+    {
+        for(int tx = 0; tx < mActiveTilesX; tx++)
+        {
+            float amplitude = std::max(
+                TileAmplitude(tx, ty, mPrevSolution.get()),
+                TileAmplitude(tx, ty, mCurrSolution.get()));
+
+            TileState state = TileZero;
+            if(amplitude > quietHeight)
+                state = TileActive;
+            else if(amplitude > 0.0f)
+                state = TileQuiet;
+            mTileActive[ty * mActiveTilesX + tx] = state;
+        }
+    }
+
+    mActiveTileCount = (int)std::count(mTileActive.begin(), mTileActive.end(), TileActive);
+}
+
+inline float3 Waves::Position(int i) const
+{
+    int row = i / mNumCols;
+    int col = i - row * mNumCols;
+
+    return float3(
+        -mHalfWidth + col * mSpatialStep,
+        mCurrSolution[row * mRowPitch + col],
+        mHalfDepth - row * mSpatialStep);
+}
+
+inline float3 Waves::Normal(int i) const
+{
+    int row = i / mNumCols;
+    int col = i - row * mNumCols;
+
+    // Boundary heights are pinned to zero, so their normals stay straight up.
+    if(row == 0 || col == 0 || row == mNumRows - 1 || col == mNumCols - 1)
+        return float3(0.0f, 1.0f, 0.0f);
+
+    const float* h = &mCurrSolution[row * mRowPitch + col];
+    float l = h[-1];
+    float r = h[1];
+    float t = h[-mRowPitch];
+    float b = h[mRowPitch];
+
+    float3 n(l - r, 2.0f * mSpatialStep, b - t);
+    float invLength = 1.0f / sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+
+    return float3(n.x * invLength, n.y * invLength, n.z * invLength);
+}
+
+inline float3 Waves::TangentX(int i) const
+{
+    int row = i / mNumCols;
+    int col = i - row * mNumCols;
+
+    if(row == 0 || col == 0 || row == mNumRows - 1 || col == mNumCols - 1)
+        return float3(1.0f, 0.0f, 0.0f);
+
+    const float* h = &mCurrSolution[row * mRowPitch + col];
+    float x = 2.0f * mSpatialStep;
+    float y = h[1] - h[-1];
+    float invLength = 1.0f / sqrtf(x * x + y * y);
+
+    return float3(x * invLength, y * invLength, 0.0f);
+}
+
+inline float2 Waves::TexC(int i) const
+{
+    int row = i / mNumCols;
+    int col = i - row * mNumCols;
+
+    return float2((float)col / (mNumCols - 1), (float)row / (mNumRows - 1));
+}
+
+inline float Waves::SampleHeight(float x, float z) const
+{
+    float height = 0.0f;
+    SampleSurfaceRange(&x, &z, 0, 1, &height, nullptr);
+
+    return height;
+}
+
+inline void Waves::SampleSurface(const float* x, const float* z, int count, float* heights, float3* normals) const
+{
+    int pointsPerTask = Multithreaded() ? SamplePointsPerTask : std::max(count, 1);
+    ParallelFor((count + pointsPerTask - 1) / pointsPerTask, [=, this](int task)
+                {
+                    int begin = task * pointsPerTask;
+                    SampleSurfaceRange(x, z, begin, std::min(begin + pointsPerTask, count), heights, normals);
+                });
+}
+
+inline void Waves::SampleSurfaceRange(
+    const float* x, const float* z, int begin, int end, float* heights, float3* normals) const
+{
+    const float* h = mCurrSolution.get();
+    const int pitch = mRowPitch;
+    const float invDx = 1.0f / mSpatialStep;
+    const float maxU = (float)(mNumCols - 1);
+    const float maxV = (float)(mNumRows - 1);
+    const float lastCellU = (float)(mNumCols - 2);
+    const float lastCellV = (float)(mNumRows - 2);
+    const float ny = 2.0f * mSpatialStep;
+
+    // Offsets from a cell's top-left height to the column left of it, the column two to the
+    // right, the row above and the row two below, clamped to the grid. A clamped offset only
+    // feeds the slope of a boundary vertex, which is masked to zero.
+    struct CellOffsets
+    {
+        int Left;
+        int Right;
+        int Above;
+        int Below;
+    };
+    auto cellOffsets = [=, this](int r0, int c0)
+    {
+        return CellOffsets{
+            c0 > 0 ? -1 : 0,
+            c0 + 2 < mNumCols ? 2 : 1,
+            r0 > 0 ? -pitch : 0,
+            r0 + 2 < mNumRows ? 2 * pitch : pitch};
+    };
+
+    // Grid coordinates: u counts columns (+x), v counts rows (-z). The clamps are written
+    // like maxps/minps so both paths send NaN to the same place.
+    auto samplePoint = [&](int k)
+    {
+        float u = (x[k] + mHalfWidth) * invDx;
+        float v = (mHalfDepth - z[k]) * invDx;
+        u = u > 0.0f ? u : 0.0f;
+        u = u < maxU ? u : maxU;
+        v = v > 0.0f ? v : 0.0f;
+        v = v < maxV ? v : maxV;
+
+        float cu = (float)(int)u;
+        float cv = (float)(int)v;
+        cu = cu < lastCellU ? cu : lastCellU;
+        cv = cv < lastCellV ? cv : lastCellV;
+        float fu = u - cu;
+        float fv = v - cv;
+
+        int c0 = (int)cu;
+        int r0 = (int)cv;
+        const float* p = h + r0 * pitch + c0;
+        float h00 = p[0];
+        float h01 = p[1];
+        float h10 = p[pitch];
+        float h11 = p[pitch + 1];
+
+        if(heights)
+        {
+            float top = h00 + fu * (h01 - h00);
+            float bottom = h10 + fu * (h11 - h10);
+            heights[k] = top + fv * (bottom - top);
+        }
+
+        if(normals)
+        {
+            CellOffsets o = cellOffsets(r0, c0);
+            bool top = cv > 0.0f;
+            bool bottom = cv < lastCellV;
+            bool left = cu > 0.0f;
+            bool right = cu < lastCellU;
+
+            float sx00 = top && left ? p[o.Left] - h01 : 0.0f;
+            float sx01 = top && right ? h00 - p[o.Right] : 0.0f;
+            float sx10 = bottom && left ? p[pitch + o.Left] - h11 : 0.0f;
+            float sx11 = bottom && right ? h10 - p[pitch + o.Right] : 0.0f;
+            float sz00 = top && left ? h10 - p[o.Above] : 0.0f;
+            float sz01 = top && right ? h11 - p[o.Above + 1] : 0.0f;
+            float sz10 = bottom && left ? p[o.Below] - h00 : 0.0f;
+            float sz11 = bottom && right ? p[o.Below + 1] - h01 : 0.0f;
+
+            float sxTop = sx00 + fu * (sx01 - sx00);
+            float sxBottom = sx10 + fu * (sx11 - sx10);
+            float szTop = sz00 + fu * (sz01 - sz00);
+            float szBottom = sz10 + fu * (sz11 - sz10);
+            float sx = sxTop + fv * (sxBottom - sxTop);
+            float sz = szTop + fv * (szBottom - szTop);
+
+            float invLength = 1.0f / sqrtf(sx * sx + ny * ny + sz * sz);
+            normals[k] = float3(sx * invLength, ny * invLength, sz * invLength);
+        }
+    };
+
+    int k = begin;
+#ifdef WAVES_X86
+    if(mSolver != WavesSolver::Scalar)
+    {
+        // Four points at a time. The cell lookup, masks and blends run in vectors; the
+        // heights around each cell are gathered with scalar loads.
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 vInvDx = _mm_set1_ps(invDx);
+        const __m128 vHalfWidth = _mm_set1_ps(mHalfWidth);
+        const __m128 vHalfDepth = _mm_set1_ps(mHalfDepth);
+        const __m128 vMaxU = _mm_set1_ps(maxU);
+        const __m128 vMaxV = _mm_set1_ps(maxV);
+        const __m128 vLastCellU = _mm_set1_ps(lastCellU);
+        const __m128 vLastCellV = _mm_set1_ps(lastCellV);
+        const __m128 vny = _mm_set1_ps(ny);
+
+        auto lerp = [](__m128 a, __m128 b, __m128 t) { return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a))); };
+
+        for(; k + 4 <= end; k += 4)
+        {
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(x + k), vHalfWidth), vInvDx);
+            __m128 v = _mm_mul_ps(_mm_sub_ps(vHalfDepth, _mm_loadu_ps(z + k)), vInvDx);
+            u = _mm_min_ps(_mm_max_ps(u, zero), vMaxU);
+            v = _mm_min_ps(_mm_max_ps(v, zero), vMaxV);
+
+            __m128 cu = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(u)), vLastCellU);
+            __m128 cv = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(v)), vLastCellV);
+            __m128 fu = _mm_sub_ps(u, cu);
+            __m128 fv = _mm_sub_ps(v, cv);
+
+            alignas(16) int c0[4];
+            alignas(16) int r0[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(c0), _mm_cvttps_epi32(cu));
+            _mm_store_si128(reinterpret_cast<__m128i*>(r0), _mm_cvttps_epi32(cv));
+
+            const float* p[4];
+            for(int lane = 0; lane < 4; lane++)
+                p[lane] = h + r0[lane] * pitch + c0[lane];
+
+            __m128 h00 = _mm_setr_ps(p[0][0], p[1][0], p[2][0], p[3][0]);
+            __m128 h01 = _mm_setr_ps(p[0][1], p[1][1], p[2][1], p[3][1]);
+            __m128 h10 = _mm_setr_ps(p[0][pitch], p[1][pitch], p[2][pitch], p[3][pitch]);
+            __m128 h11 = _mm_setr_ps(p[0][pitch + 1], p[1][pitch + 1], p[2][pitch + 1], p[3][pitch + 1]);
+
+            if(heights)
+                _mm_storeu_ps(heights + k, lerp(lerp(h00, h01, fu), lerp(h10, h11, fu), fv));
+
+            if(!normals)
+                continue;
+
+            CellOffsets o[4];
+            for(int lane = 0; lane < 4; lane++)
+                o[lane] = cellOffsets(r0[lane], c0[lane]);
+
+            __m128 hl0 = _mm_setr_ps(p[0][o[0].Left], p[1][o[1].Left], p[2][o[2].Left], p[3][o[3].Left]);
+            __m128 hr0 = _mm_setr_ps(p[0][o[0].Right], p[1][o[1].Right], p[2][o[2].Right], p[3][o[3].Right]);
+            __m128 hl1 = _mm_setr_ps(
+                p[0][pitch + o[0].Left], p[1][pitch + o[1].Left], p[2][pitch + o[2].Left], p[3][pitch + o[3].Left]);
+            __m128 hr1 = _mm_setr_ps(
+                p[0][pitch + o[0].Right], p[1][pitch + o[1].Right], p[2][pitch + o[2].Right], p[3][pitch + o[3].Right]);
+            __m128 ha0 = _mm_setr_ps(p[0][o[0].Above], p[1][o[1].Above], p[2][o[2].Above], p[3][o[3].Above]);
+            __m128 ha1 = _mm_setr_ps(
+                p[0][o[0].Above + 1], p[1][o[1].Above + 1], p[2][o[2].Above + 1], p[3][o[3].Above + 1]);
+            __m128 hb0 = _mm_setr_ps(p[0][o[0].Below], p[1][o[1].Below], p[2][o[2].Below], p[3][o[3].Below]);
+            __m128 hb1 = _mm_setr_ps(
+                p[0][o[0].Below + 1], p[1][o[1].Below + 1], p[2][o[2].Below + 1], p[3][o[3].Below + 1]);
+
+            __m128 top = _mm_cmpgt_ps(cv, zero);
+            __m128 bottom = _mm_cmplt_ps(cv, vLastCellV);
+            __m128 left = _mm_cmpgt_ps(cu, zero);
+            __m128 right = _mm_cmplt_ps(cu, vLastCellU);
+            __m128 m00 = _mm_and_ps(top, left);
+            __m128 m01 = _mm_and_ps(top, right);
+            __m128 m10 = _mm_and_ps(bottom, left);
+            __m128 m11 = _mm_and_ps(bottom, right);
+
+            __m128 sx00 = _mm_and_ps(m00, _mm_sub_ps(hl0, h01));
+            __m128 sx01 = _mm_and_ps(m01, _mm_sub_ps(h00, hr0));
+            __m128 sx10 = _mm_and_ps(m10, _mm_sub_ps(hl1, h11));
+            __m128 sx11 = _mm_and_ps(m11, _mm_sub_ps(h10, hr1));
+            __m128 sz00 = _mm_and_ps(m00, _mm_sub_ps(h10, ha0));
+            __m128 sz01 = _mm_and_ps(m01, _mm_sub_ps(h11, ha1));
+            __m128 sz10 = _mm_and_ps(m10, _mm_sub_ps(hb0, h00));
+            __m128 sz11 = _mm_and_ps(m11, _mm_sub_ps(hb1, h01));
+
+            __m128 sx = lerp(lerp(sx00, sx01, fu), lerp(sx10, sx11, fu), fv);
+            __m128 sz = lerp(lerp(sz00, sz01, fu), lerp(sz10, sz11, fu), fv);
+
+            __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, sx), _mm_mul_ps(vny, vny)), _mm_mul_ps(sz, sz));
+            __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+
+            alignas(16) float nx[4];
+            alignas(16) float ny4[4];
+            alignas(16) float nz[4];
+            _mm_store_ps(nx, _mm_mul_ps(sx, invLength));
+            _mm_store_ps(ny4, _mm_mul_ps(vny, invLength));
+            _mm_store_ps(nz, _mm_mul_ps(sz, invLength));
+            for(int lane = 0; lane < 4; lane++)
+                normals[k + lane] = float3(nx[lane], ny4[lane], nz[lane]);
+        }
+    }
+#endif
+
+    for(; k < end; k++)
+        samplePoint(k);
+}
+
+inline bool Waves::IntersectRay(const float3& origin, const float3& direction, float maxDistance, WavesRayHit& hit) const
+{
+    // Walk the cells under the ray in grid coordinates (u along the columns, v along the
+    // rows), nearest first. Along the ray a cell's bilinear surface is a quadratic in t, so
+    // each cell is solved exactly rather than marched.
+    const double invDx = 1.0 / mSpatialStep;
+    const double u0 = (origin.x + mHalfWidth) * invDx;
+    const double v0 = (mHalfDepth - origin.z) * invDx;
+    const double du = direction.x * invDx;
+    const double dv = -direction.z * invDx;
+    const int lastCol = mNumCols - 2;
+    const int lastRow = mNumRows - 2;
+
+    // Clip the ray to the grid's footprint.
+    double tBegin = 0.0;
+    double tEnd = maxDistance;
+    auto clip = [&](double p, double d, double hi)
+    {
+        if(d == 0.0)
+            return p >= 0.0 && p <= hi;
+
+        double t0 = -p / d;
+        double t1 = (hi - p) / d;
+        if(t0 > t1)
+            std::swap(t0, t1);
+        tBegin = std::max(tBegin, t0);
+        tEnd = std::min(tEnd, t1);
+
+        return tBegin <= tEnd;
+    };
+    if(!clip(u0, du, mNumCols - 1.0) || !clip(v0, dv, mNumRows - 1.0))
+        return false;
+
+    const double infinity = std::numeric_limits<double>::infinity();
+    int col = std::clamp((int)(u0 + du * tBegin), 0, lastCol);
+    int row = std::clamp((int)(v0 + dv * tBegin), 0, lastRow);
+    int colStep = du > 0.0 ? 1 : -1;
+    int rowStep = dv > 0.0 ? 1 : -1;
+    double colDelta = du != 0.0 ? std::abs(1.0 / du) : infinity;
+    double rowDelta = dv != 0.0 ? std::abs(1.0 / dv) : infinity;
+    double nextColT = du != 0.0 ? (col + (du > 0.0 ? 1 : 0) - u0) / du : infinity;
+    double nextRowT = dv != 0.0 ? (row + (dv > 0.0 ? 1 : 0) - v0) / dv : infinity;
+
+    double t = tBegin;
+    for(;;)
+    {
+        double cellEnd = std::min(std::min(nextColT, nextRowT), tEnd);
+
+        // f(s) = ray height - surface height at t + s, with the surface
+        // h00 + B fu + C fv + D fu fv and fu = a0 + du s, fv = b0 + dv s.
+        const float* p = &mCurrSolution[row * mRowPitch + col];
+        double h00 = p[0];
+        double b = p[1] - h00;
+        double c = p[mRowPitch] - h00;
+        double d = p[mRowPitch + 1] - p[mRowPitch] - b;
+        double a0 = u0 + du * t - col;
+        double b0 = v0 + dv * t - row;
+
+        double f0 = origin.y + direction.y * t - (h00 + b * a0 + c * b0 + d * a0 * b0);
+        double f1 = direction.y - (b * du + c * dv + d * (a0 * dv + du * b0));
+        double f2 = -d * du * dv;
+
+        double s = -1.0;
+        if(f0 <= 0.0)
+        {
+            s = 0.0;
+        }
+        else
+        {
+            // f(0) > 0, so the first crossing is the smallest positive root. q is formed
+            // without cancellation; c0 / q is the small root when f2 is tiny.
+            double discriminant = f1 * f1 - 4.0 * f2 * f0;
+            if(discriminant >= 0.0)
+            {
+                double q = -0.5 * (f1 + std::copysign(std::sqrt(discriminant), f1));
+                if(q != 0.0)
+                {
+                    double roots[2] = { f0 / q, f2 != 0.0 ? q / f2 : -1.0 };
+                    for(double root : roots)
+                    {
+                        if(root >= 0.0 && root <= cellEnd - t && (s < 0.0 || root < s))
+                            s = root;
+                    }
+                }
+            }
+        }
+
+        if(s >= 0.0)
+        {
+            float distance = (float)(t + s);
+            hit.Distance = distance;
+            hit.Position = float3(
+                origin.x + direction.x * distance,
+                origin.y + direction.y * distance,
+                origin.z + direction.z * distance);
+            SampleSurfaceRange(&hit.Position.x, &hit.Position.z, 0, 1, nullptr, &hit.Normal);
+            return true;
+        }
+
+        if(cellEnd >= tEnd)
+            return false;
+
+        if(nextColT < nextRowT)
+        {
+            col += colStep;
+            nextColT += colDelta;
+        }
+        else
+        {
+            row += rowStep;
+            nextRowT += rowDelta;
+        }
+        t = cellEnd;
+
+        if(col < 0 || col > lastCol || row < 0 || row > lastRow)
+            return false;
+    }
+}
+
+inline int Waves::ScheduleSteps(float dt)
+{
+    // A paused or reversed clock does not run the simulation.
+    if(dt > 0.0f && std::isfinite(dt))
+        mAccumulator += dt;
+
+    std::uint64_t due = (std::uint64_t)(mAccumulator / mTimeStep);
+    int steps = (int)std::min<std::uint64_t>(due, mMaxSubSteps);
+
+    // A long frame would otherwise ask for more steps than the frame after it can afford,
+    // and so on: keep at most one more budget's worth of backlog and drop the rest.
+    std::uint64_t backlog = due - steps;
+    std::uint64_t deferred = std::min<std::uint64_t>(backlog, mMaxSubSteps);
+    mDeferredSteps += deferred - std::min(deferred, mCarriedSteps);
+    mCarriedSteps = deferred;
+    mDroppedSteps += backlog - deferred;
+
+    mAccumulator = fmodf(mAccumulator, mTimeStep) + deferred * mTimeStep;
+    mLastSubSteps = steps;
+
+    return steps;
+}
+
+inline void Waves::Update(float dt)
+{
+    Step(ScheduleSteps(dt));
+}
+
+template<typename VertexT>
+inline void Waves::Update(float dt, VertexT* dst)
+{
+    int steps = ScheduleSteps(dt);
+    if constexpr(WavesKernels::IsCompactVertex<VertexT>)
+    {
+        Step(steps);
+        WriteCompactVertices(dst);
+    }
+    else if(steps == 0 || mSparse || mIntegrator != WavesIntegrator::Explicit)
+    {
+        Step(steps);
+        WriteVertexRows(WavesKernels::VertexData(dst));
+    }
+    else
+    {
+        Step(steps - 1);
+        StepAndWriteVertices(WavesKernels::VertexData(dst));
+    }
+}
+
+template<typename VertexT>
+inline std::size_t Waves::Update(float dt, VertexT* dst, std::uint64_t& version)
+{
+    Update(dt);
+    return WriteChangedVertices(dst, version);
+}
+
+template<typename VertexT>
+inline void Waves::WriteVertices(VertexT* dst) const
+{
+    WriteVertexRows(WavesKernels::VertexData(dst));
+}
+
+template<typename VertexT>
+inline std::size_t Waves::WriteChangedVertices(VertexT* dst, std::uint64_t& version) const
+{
+    mChangedRows.clear();
+    for(int i = 0; i < mNumRows; i++)
+    {
+        if(version == 0 || RowChanged(i, version))
+            mChangedRows.push_back(i);
+    }
+    version = mSurfaceVersion;
+
+    const float* curr = mCurrSolution.get();
+    const int* rows = mChangedRows.data();
+    int rowCount = (int)mChangedRows.size();
+    int rowsPerTask = Multithreaded() ? WavesKernels::RowsPerTask : std::max(rowCount, 1);
+    ParallelFor((rowCount + rowsPerTask - 1) / rowsPerTask, [=, this](int task)
+                {
+                    int end = std::min((task + 1) * rowsPerTask, rowCount);
+                    for(int k = task * rowsPerTask; k < end; k++)
+                    {
+                        if constexpr(WavesKernels::IsCompactVertex<VertexT>)
+                            WriteCompactVertexRow(curr, rows[k], dst);
+                        else
+                            WriteVertexRow(curr, rows[k], WavesKernels::VertexData(dst));
+                    }
+                });
+
+    std::size_t bytes = (std::size_t)rowCount * mNumCols * sizeof(VertexT);
+    mVertexBytesWritten += bytes;
+
+    return bytes;
+}
+
+inline void Waves::WriteStaticVertices(WavesStaticVertex* dst) const
+{
+    for(int i = 0; i < mNumRows; i++)
+    {
+        float z = mHalfDepth - i * mSpatialStep;
+        float texV = (float)i / (mNumRows - 1);
+        for(int j = 0; j < mNumCols; j++)
+        {
+            WavesStaticVertex& v = dst[(std::size_t)i * mNumCols + j];
+            v.PosXZ = float2(-mHalfWidth + j * mSpatialStep, z);
+            v.TexC = float2((float)j / (mNumCols - 1), texV);
+        }
+    }
+}
+
+template<typename CompactVertexT>
+inline void Waves::WriteCompactVertices(CompactVertexT* dst) const
+{
+    static_assert(WavesKernels::IsCompactVertex<CompactVertexT>, "WriteCompactVertices writes WavesCompactVertex or WavesCompactVertex16");
+
+    const float* curr = mCurrSolution.get();
+    int rowsPerTask = Multithreaded() ? WavesKernels::RowsPerTask : mNumRows;
+    ParallelFor((mNumRows + rowsPerTask - 1) / rowsPerTask, [=, this](int task)
+                {
+                    int begin = task * rowsPerTask;
+                    int end = std::min(begin + rowsPerTask, mNumRows);
+                    for(int i = begin; i < end; i++)
+                        WriteCompactVertexRow(curr, i, dst);
+                });
+
+    mVertexBytesWritten += (std::size_t)mVertexCount * sizeof(CompactVertexT);
+}
+
+inline void Waves::Step()
+{
+    ApplyDisturbances();
+
+    if(mIntegrator == WavesIntegrator::ADI)
+    {
+        StepADI();
+        return;
+    }
+
+    if(mSparse)
+    {
+        StepSparse();
+        return;
+    }
+
+    // Only update interior points; we use zero boundary conditions.
+    if(Multithreaded())
+    {
+        using WavesKernels::RowsPerTask;
+        int taskCount = (mNumRows - 2 + RowsPerTask - 1) / RowsPerTask;
+        ParallelFor(taskCount, [this](int task)
+                    {
+                        int begin = 1 + task * RowsPerTask;
+                        StepRows(begin, std::min(begin + RowsPerTask, mNumRows - 1));
+                    });
+    }
+    else
+    {
+        StepRows(1, mNumRows - 1);
+    }
+
+    // We just overwrote the previous buffer with the new data, so
+    // this data needs to become the current solution and the old
+    // current solution becomes the new previous solution.
+    std::swap(mPrevSolution, mCurrSolution);
+    mStepCount++;
+    mSteppedCells = (std::size_t)(mNumRows - 2) * (mNumCols - 2);
+    MarkAllRowsChanged();
+}
+
+inline void Waves::Step(int count)
+{
+    std::size_t planeBytes = (std::size_t)mNumRows * mRowPitch * sizeof(float);
+    bool tiled = mIntegrator == WavesIntegrator::Explicit && !mSparse && mTileDepth > 1 &&
+        2 * planeBytes >= mTiledMinBytes;
+
+    while(count > 0)
+    {
+        if(!tiled || count == 1)
+        {
+            Step();
+            count--;
+        }
+        else
+        {
+            int depth = std::min(count, mTileDepth);
+            StepTiled(depth);
+            count -= depth;
+        }
+    }
+}
+
+inline void Waves::StepRows(int begin, int end)
+{
+    WavesKernels::DenormalGuard flushDenormals;
+
+    float* prev = mPrevSolution.get();
+    const float* curr = mCurrSolution.get();
+
+    for(int i = begin; i < end; i++)
+    {
+        // After this update we will be discarding the old previous
+        // buffer, so overwrite that buffer with the new update.
+        // Note j indexes x and i indexes z: h(x_j, z_i, t_k)
+        // Moreover, our +z axis goes "down"; this is just to
+        // keep consistent with our row indices going down.
+        std::size_t row = (std::size_t)i * mRowPitch + 1;
+        mStepRow(
+            prev + row,
+            curr + row - mRowPitch,
+            curr + row,
+            curr + row + mRowPitch,
+            mNumCols - 2,
+            mK1, mK2, mK3);
+        AbsorbRow(prev + row, curr + row, i, 1, mNumCols - 1);
+    }
+}
+
+// Lees' three-level scheme, damped and factored (D'yakonov form). With d = next - 2 curr + prev
+// and theta = 1/4:
+//
+//   a d + damping dt (curr - prev) = e L curr + theta e L d,     a = 1 + damping dt / 2
+//
+// and a (I - beta Lx)(I - beta Lz) d = e L curr - damping dt (curr - prev), beta = theta e / a.
+// The row pass builds the right-hand side and solves along x; the column pass solves along
+// z in strips of columns, vectorized across the strip, and writes next into the old level.
+inline void Waves::StepADI()
+{
+    using WavesKernels::RowsPerTask;
+
+    float* prev = mPrevSolution.get();
+    const float* curr = mCurrSolution.get();
+    float* scratch = mAdiScratch.get();
+    std::size_t pitch = mRowPitch;
+    int interiorCols = mNumCols - 2;
+
+    bool parallel = Multithreaded();
+    int rowsPerTask = parallel ? RowsPerTask : mNumRows - 2;
+    int rowTasks = (mNumRows - 2 + rowsPerTask - 1) / rowsPerTask;
+    ParallelFor(rowTasks, [=, this](int task)
+                {
+                    WavesKernels::DenormalGuard flushDenormals;
+
+                    int begin = 1 + task * rowsPerTask;
+                    int end = std::min(begin + rowsPerTask, mNumRows - 1);
+                    for(int i = begin; i < end; i++)
+                    {
+                        std::size_t row = i * pitch + 1;
+                        WavesKernels::AdiRhsRow(
+                            scratch + row, prev + row, curr + row - pitch, curr + row, curr + row + pitch,
+                            interiorCols, mAdiE, mAdiDampingDt, mAdiScale);
+                    }
+
+                    int i = begin;
+#if defined(WAVES_X86)
+                    for(; i + WavesKernels::AdiGroupRows <= end; i += WavesKernels::AdiGroupRows)
+                        WavesKernels::AdiSolveRows(scratch + i * pitch + 1, pitch, mAdiInvX.data(), mAdiUpperX.data(), interiorCols);
+#endif
+                    for(; i < end; i++)
+                        WavesKernels::AdiSolveRow(scratch + i * pitch + 1, mAdiInvX.data(), mAdiUpperX.data(), interiorCols);
+                });
+
+    // Strips of AdiStripColumns columns keep a column sweep's working set in cache while
+    // giving the executor enough tasks. Rows 0 and m - 1 of scratch stay zero: d is zero on
+    // the boundary.
+    int stripCols = parallel ? AdiStripColumns : interiorCols;
+    int stripCount = (interiorCols + stripCols - 1) / stripCols;
+    ParallelFor(stripCount, [=, this](int strip)
+                {
+                    WavesKernels::DenormalGuard flushDenormals;
+
+                    int c0 = 1 + strip * stripCols;
+                    int c1 = std::min(c0 + stripCols, mNumCols - 1);
+                    int count = c1 - c0;
+                    for(int i = 1; i < mNumRows - 1; i++)
+                    {
+                        std::size_t row = i * pitch + c0;
+                        WavesKernels::AdiForwardRow(scratch + row, scratch + row - pitch, mAdiInvZ[i - 1], mAdiUpperZ[i - 1], count);
+                    }
+
+                    for(int i = mNumRows - 2; i >= 1; i--)
+                    {
+                        std::size_t row = i * pitch + c0;
+                        WavesKernels::AdiBackRow(scratch + row, scratch + row + pitch, mAdiUpperZ[i - 1], prev + row, curr + row, count);
+                        AbsorbRow(prev + row, curr + row, i, c0, c1);
+                    }
+                });
+
+    std::swap(mPrevSolution, mCurrSolution);
+    mStepCount++;
+    mSteppedCells = (std::size_t)(mNumRows - 2) * (mNumCols - 2);
+    MarkAllRowsChanged();
+}
+
+// Applies the sponge layer to the freshly stepped cells [c0, c1) of row `row`; next and
+// curr point at column c0 of the new and current level. Only the new level is written, so
+// rows can be absorbed as soon as they are stepped, by whichever pass stepped them.
+inline void Waves::AbsorbRow(float* next, const float* curr, int row, int c0, int c1) const
+{
+    if(mAbsorbWidth == 0)
+        return;
+
+    const float* cols = mAbsorbCols.data();
+    float rowFactor = mAbsorbRows[row];
+    if(rowFactor < 1.0f)
+    {
+        WavesKernels::DampRow(next, curr, cols + c0, rowFactor, c1 - c0);
+        return;
+    }
+
+    // Outside the top and bottom of the layer only the left and right strips change.
+    int left = std::min(c1, 1 + mAbsorbWidth);
+    if(c0 < left)
+        WavesKernels::DampRow(next, curr, cols + c0, 1.0f, left - c0);
+
+    int right = std::max(c0, mNumCols - 1 - mAbsorbWidth);
+    if(right < c1)
+        WavesKernels::DampRow(next + (right - c0), curr + (right - c0), cols + right, 1.0f, c1 - right);
+}
+
+inline void Waves::StepSparse()
+{
+    int tilesX = mActiveTilesX;
+    int tilesY = mActiveTilesY;
+    int tileSize = mActiveTileSize;
+
+    // A tile next to an active one may receive a wave this step, so it is stepped too; its
+    // activity is re-evaluated afterwards, which is how waves wake their neighbours. Quiet
+    // tiles that are not stepped are flattened so the skipped region is exactly zero.
+    // Bands without stepped or flattened tiles keep their heights.
+    std::vector<std::uint8_t> bandChanged(tilesY, 0);
+    for(int ty = 0; ty < tilesY; ty++)
+    {
+        for(int tx = 0; tx < tilesX; tx++)
+        {
+            bool stepped = false;
+            for(int y = std::max(ty - 1, 0); y <= std::min(ty + 1, tilesY - 1) && !stepped; y++)
+            {
+                for(int x = std::max(tx - 1, 0); x <= std::min(tx + 1, tilesX - 1); x++)
+                {
+                    std::uint8_t state = mTileActive[y * tilesX + x];
+                    stepped |= state == TileActive || state == TileCooling;
+                }
+            }
+            mTileStepped[ty * tilesX + tx] = stepped;
+            bandChanged[ty] |= stepped;
+
+            if(!stepped && mTileActive[ty * tilesX + tx] == TileQuiet)
+            {
+                bandChanged[ty] = 1;
+                int r0 = ty * tileSize;
+                int r1 = std::min(mNumRows, r0 + tileSize);
+                int c0 = tx * tileSize;
+                int c1 = std::min(mNumCols, c0 + tileSize);
+                for(int i = r0; i < r1; i++)
+                {
+                    std::fill(&mPrevSolution[i * mRowPitch + c0], &mPrevSolution[i * mRowPitch + c1], 0.0f);
+                    std::fill(&mCurrSolution[i * mRowPitch + c0], &mCurrSolution[i * mRowPitch + c1], 0.0f);
+                }
+                mTileActive[ty * tilesX + tx] = TileZero;
+            }
+        }
+    }
+
+    float* prev = mPrevSolution.get();
+    const float* curr = mCurrSolution.get();
+    std::size_t pitch = mRowPitch;
+
+    auto stepBand = [=, this](int ty)
+    {
+        WavesKernels::DenormalGuard flushDenormals;
+
+        int r0 = std::max(1, ty * tileSize);
+        int r1 = std::min(mNumRows - 1, (ty + 1) * tileSize);
+        const std::uint8_t* stepped = &mTileStepped[ty * tilesX];
+
+        // Step runs of neighbouring tiles with one call per row.
+        std::size_t cells = 0;
+        for(int tx = 0; tx < tilesX;)
+        {
+            if(!stepped[tx])
+            {
+                tx++;
+                continue;
+            }
+
+            int first = tx;
+            while(tx < tilesX && stepped[tx])
+                tx++;
+
+            int c0 = std::max(1, first * tileSize);
+            int c1 = std::min(mNumCols - 1, tx * tileSize);
+            for(int i = r0; i < r1; i++)
+            {
+                std::size_t row = i * pitch + c0;
+                mStepRow(prev + row, curr + row - pitch, curr + row, curr + row + pitch, c1 - c0, mK1, mK2, mK3);
+                AbsorbRow(prev + row, curr + row, i, c0, c1);
+            }
+            cells += (std::size_t)std::max(r1 - r0, 0) * (c1 - c0);
+        }
+
+        return cells;
+    };
+
+    // Activity is measured on the new level in a second pass, once every band has stepped.
+    // The old level was measured the step before, when it was new.
+    auto updateBand = [=, this](int ty)
+    {
+        for(int tx = 0; tx < tilesX; tx++)
+        {
+            if(mTileStepped[ty * tilesX + tx])
+                UpdateTileActivity(tx, ty);
+        }
+    };
+
+    std::vector<std::size_t> bandCells(tilesY);
+    ParallelFor(tilesY, [&](int ty) { bandCells[ty] = stepBand(ty); });
+    ParallelFor(tilesY, updateBand);
+
+    std::size_t steppedCells = 0;
+    for(std::size_t cells : bandCells)
+        steppedCells += cells;
+
+    mActiveTileCount = (int)std::count(mTileActive.begin(), mTileActive.end(), TileActive);
+    mSteppedCells = steppedCells;
+
+    std::swap(mPrevSolution, mCurrSolution);
+    mStepCount++;
+
+    for(int ty = 0; ty < tilesY;)
+    {
+        if(!bandChanged[ty])
+        {
+            ty++;
+            continue;
+        }
+
+        int first = ty;
+        while(ty < tilesY && bandChanged[ty])
+            ty++;
+        MarkRowsChanged(first * tileSize, ty * tileSize);
+    }
+}
+
+inline void Waves::UpdateTileActivity(int tileX, int tileY)
+{
+    // Called before the planes swap, so the new level is still in mPrevSolution.
+    float amplitude = TileAmplitude(tileX, tileY, mPrevSolution.get());
+
+    std::uint8_t& state = mTileActive[tileY * mActiveTilesX + tileX];
+    if(amplitude > mQuietHeight)
+        state = TileActive;
+    else if(state == TileActive)
+        state = TileCooling;
+    else if(amplitude > 0.0f || state != TileZero)
+        state = TileQuiet;
+}
+
+inline float Waves::TileAmplitude(int tileX, int tileY, const float* plane) const
+{
+    int r0 = tileY * mActiveTileSize;
+    int r1 = std::min(mNumRows, r0 + mActiveTileSize);
+    int c0 = tileX * mActiveTileSize;
+    int c1 = std::min(mNumCols, c0 + mActiveTileSize);
+
+    float amplitude = 0.0f;
+    for(int i = r0; i < r1; i++)
+    {
+        const float* h = plane + (std::size_t)i * mRowPitch;
+
+        int j = c0;
+#ifdef WAVES_X86
+        // A serial max chain costs a few cycles per cell; keep four lanes of it instead.
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128 m = _mm_setzero_ps();
+        for(; j + 4 <= c1; j += 4)
+            m = _mm_max_ps(m, _mm_and_ps(_mm_loadu_ps(h + j), absMask));
+        m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+        amplitude = std::max(amplitude, _mm_cvtss_f32(m));
+#endif
+        for(; j < c1; j++)
+            amplitude = std::max(amplitude, fabsf(h[j]));
+    }
+
+    return amplitude;
+}
+
+inline void Waves::ActivateTile(int row, int col)
+{
+    std::uint8_t& state = mTileActive[(row / mActiveTileSize) * mActiveTilesX + col / mActiveTileSize];
+    mActiveTileCount += state != TileActive;
+    state = TileActive;
+}
+
+inline void Waves::StepAndWriteVertices(float* dst)
+{
+    using WavesKernels::RowsPerTask;
+
+    ApplyDisturbances();
+
+    // Row r can be packed once rows r - 1 and r + 1 of the new level exist, so each block
+    // packs its rows one behind the stencil. The first and last row of every block wait
+    // for the neighbouring blocks and are packed afterwards.
+    const float* next = mPrevSolution.get();
+    int interiorRows = mNumRows - 2;
+    int taskCount = (interiorRows + RowsPerTask - 1) / RowsPerTask;
+    bool parallel = Multithreaded();
+    if(!parallel)
+        taskCount = 1;
+    int rowsPerTask = parallel ? RowsPerTask : interiorRows;
+
+    auto stepBlock = [=, this](int task)
+    {
+        int begin = 1 + task * rowsPerTask;
+        int end = std::min(begin + rowsPerTask, mNumRows - 1);
+        for(int i = begin; i < end; i++)
+        {
+            StepRows(i, i + 1);
+            if(i - 1 > begin)
+                WriteVertexRow(next, i - 1, dst);
+        }
+    };
+
+    auto writeBlockEdges = [=, this](int task)
+    {
+        int begin = 1 + task * rowsPerTask;
+        int end = std::min(begin + rowsPerTask, mNumRows - 1);
+        WriteVertexRow(next, begin, dst);
+        if(end - 1 > begin)
+            WriteVertexRow(next, end - 1, dst);
+    };
+
+    ParallelFor(taskCount, stepBlock);
+    ParallelFor(taskCount, writeBlockEdges);
+
+    // The boundary rows never change, but every frame resource needs its own copy.
+    WriteVertexRow(next, 0, dst);
+    WriteVertexRow(next, mNumRows - 1, dst);
+
+    std::swap(mPrevSolution, mCurrSolution);
+    mStepCount++;
+    mSteppedCells = (std::size_t)(mNumRows - 2) * (mNumCols - 2);
+    MarkAllRowsChanged();
+    mVertexBytesWritten += (std::size_t)mVertexCount * WavesKernels::VertexFloats * sizeof(float);
+}
+
+inline void Waves::WriteVertexRows(float* dst) const
+{
+    const float* curr = mCurrSolution.get();
+    mVertexBytesWritten += (std::size_t)mVertexCount * WavesKernels::VertexFloats * sizeof(float);
+
+    if(Multithreaded())
+    {
+        using WavesKernels::RowsPerTask;
+        int taskCount = (mNumRows + RowsPerTask - 1) / RowsPerTask;
+        ParallelFor(taskCount, [=, this](int task)
+                    {
+                        int begin = task * RowsPerTask;
+                        int end = std::min(begin + RowsPerTask, mNumRows);
+                        for(int i = begin; i < end; i++)
+                            WriteVertexRow(curr, i, dst);
+                    });
+    }
+    else
+    {
+        for(int i = 0; i < mNumRows; i++)
+            WriteVertexRow(curr, i, dst);
+    }
+}
+
+inline void Waves::WriteVertexRow(const float* plane, int row, float* dst) const
+{
+    using WavesKernels::VertexFloats;
+
+    const float* h = plane + (std::size_t)row * mRowPitch;
+    float* v = dst + (std::size_t)row * mNumCols * VertexFloats;
+
+    float z = mHalfDepth - row * mSpatialStep;
+    float texV = (float)row / (mNumRows - 1);
+    float ny = 2.0f * mSpatialStep;
+    bool boundaryRow = row == 0 || row == mNumRows - 1;
+
+    // Same arithmetic as Position/Normal/TexC, so both paths give identical vertices.
+    auto writeVertex = [&](int col)
+    {
+        float* out = v + col * VertexFloats;
+        out[0] = -mHalfWidth + col * mSpatialStep;
+        out[1] = h[col];
+        out[2] = z;
+
+        if(boundaryRow || col == 0 || col == mNumCols - 1)
+        {
+            out[3] = 0.0f;
+            out[4] = 1.0f;
+            out[5] = 0.0f;
+        }
+        else
+        {
+            float nx = h[col - 1] - h[col + 1];
+            float nz = h[col + mRowPitch] - h[col - mRowPitch];
+            float invLength = 1.0f / sqrtf(nx * nx + ny * ny + nz * nz);
+            out[3] = nx * invLength;
+            out[4] = ny * invLength;
+            out[5] = nz * invLength;
+        }
+
+        out[6] = (float)col / (mNumCols - 1);
+        out[7] = texV;
+    };
+
+    int col = 0;
+#ifdef WAVES_X86
+    if(!boundaryRow && mSolver != WavesSolver::Scalar)
+    {
+        writeVertex(col++);
+
+        // Four vertices at a time: compute the eight components as vectors, transpose them
+        // into two halves per vertex and stream them out past the cache. Mapped upload
+        // memory is write-combined, so this also avoids partial-line flushes.
+        const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+        const __m128 dx = _mm_set1_ps(mSpatialStep);
+        const __m128 left = _mm_set1_ps(-mHalfWidth);
+        const __m128 uScale = _mm_set1_ps((float)(mNumCols - 1));
+        const __m128 vz = _mm_set1_ps(z);
+        const __m128 vny = _mm_set1_ps(ny);
+        const __m128 vv = _mm_set1_ps(texV);
+        const __m128 one = _mm_set1_ps(1.0f);
+        bool aligned = (reinterpret_cast<std::uintptr_t>(v) & 15) == 0;
+
+        for(; col + 4 <= mNumCols - 1; col += 4)
+        {
+            __m128 c = _mm_add_ps(_mm_set1_ps((float)col), lane);
+            __m128 x = _mm_add_ps(left, _mm_mul_ps(c, dx));
+            __m128 y = _mm_loadu_ps(h + col);
+            __m128 nx = _mm_sub_ps(_mm_loadu_ps(h + col - 1), _mm_loadu_ps(h + col + 1));
+            __m128 nz = _mm_sub_ps(_mm_loadu_ps(h + col + mRowPitch), _mm_loadu_ps(h + col - mRowPitch));
+
+            __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(vny, vny)), _mm_mul_ps(nz, nz));
+            __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+
+            __m128 a0 = x;
+            __m128 a1 = y;
+            __m128 a2 = vz;
+            __m128 a3 = _mm_mul_ps(nx, invLength);
+            __m128 b0 = _mm_mul_ps(vny, invLength);
+            __m128 b1 = _mm_mul_ps(nz, invLength);
+            __m128 b2 = _mm_div_ps(c, uScale);
+            __m128 b3 = vv;
+            _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+            _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+
+            float* out = v + col * VertexFloats;
+            if(aligned)
+            {
+                _mm_stream_ps(out, a0);
+                _mm_stream_ps(out + 4, b0);
+                _mm_stream_ps(out + 8, a1);
+                _mm_stream_ps(out + 12, b1);
+                _mm_stream_ps(out + 16, a2);
+                _mm_stream_ps(out + 20, b2);
+                _mm_stream_ps(out + 24, a3);
+                _mm_stream_ps(out + 28, b3);
+            }
+            else
+            {
+                _mm_storeu_ps(out, a0);
+                _mm_storeu_ps(out + 4, b0);
+                _mm_storeu_ps(out + 8, a1);
+                _mm_storeu_ps(out + 12, b1);
+                _mm_storeu_ps(out + 16, a2);
+                _mm_storeu_ps(out + 20, b2);
+                _mm_storeu_ps(out + 24, a3);
+                _mm_storeu_ps(out + 28, b3);
+            }
+        }
+    }
+#endif
+
+    for(; col < mNumCols; col++)
+        writeVertex(col);
+
+#ifdef WAVES_X86
+    // Order the streaming stores before the command list that reads them is submitted.
+    _mm_sfence();
+#endif
+}
+
+template<typename CompactVertexT>
+inline void Waves::WriteCompactVertexRow(const float* plane, int row, CompactVertexT* dst) const
+{
+    constexpr bool wideNormal = std::is_same_v<CompactVertexT, WavesCompactVertex16>;
+    using NormalT = std::conditional_t<wideNormal, std::int16_t, std::int8_t>;
+    constexpr float normalScale = wideNormal ? 32767.0f : 127.0f;
+
+    const float* h = plane + (std::size_t)row * mRowPitch;
+    CompactVertexT* v = dst + (std::size_t)row * mNumCols;
+
+    float heightScale = 32767.0f / mCompactHeightRange;
+    float ny = 2.0f * mSpatialStep;
+    bool boundaryRow = row == 0 || row == mNumRows - 1;
+
+    // The normal (l - r, 2 dx, b - t) only needs dividing by its L1 norm to land on the
+    // octahedron, and ny > 0 keeps it on the upper half, so there is nothing to fold.
+    auto writeVertex = [&](int col)
+    {
+        float ex = 0.0f;
+        float ez = 0.0f;
+        if(!boundaryRow && col != 0 && col != mNumCols - 1)
+        {
+            float nx = h[col - 1] - h[col + 1];
+            float nz = h[col + mRowPitch] - h[col - mRowPitch];
+            float s = normalScale / (fabsf(nx) + ny + fabsf(nz));
+            ex = nx * s;
+            ez = nz * s;
+        }
+
+        v[col].Height = (std::int16_t)std::lrint(std::min(std::max(h[col] * heightScale, -32767.0f), 32767.0f));
+        if constexpr(wideNormal)
+            v[col].Pad = 0;
+        v[col].Normal[0] = (NormalT)std::lrint(ex);
+        v[col].Normal[1] = (NormalT)std::lrint(ez);
+    };
+
+    int col = 0;
+#ifdef WAVES_X86
+    if(!boundaryRow && mSolver != WavesSolver::Scalar)
+    {
+        writeVertex(col++);
+
+        // Same arithmetic as writeVertex; _mm_cvtps_epi32 and lrint both round to nearest
+        // even, so the two paths agree bit for bit.
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 vny = _mm_set1_ps(ny);
+        const __m128 vNormalScale = _mm_set1_ps(normalScale);
+        const __m128 vHeightScale = _mm_set1_ps(heightScale);
+        const __m128 heightMax = _mm_set1_ps(32767.0f);
+        const __m128 heightMin = _mm_set1_ps(-32767.0f);
+        const __m128i low16 = _mm_set1_epi32(0xFFFF);
+        const __m128i low8 = _mm_set1_epi32(0xFF);
+
+        for(; col + 4 <= mNumCols - 1; col += 4)
+        {
+            __m128 nx = _mm_sub_ps(_mm_loadu_ps(h + col - 1), _mm_loadu_ps(h + col + 1));
+            __m128 nz = _mm_sub_ps(_mm_loadu_ps(h + col + mRowPitch), _mm_loadu_ps(h + col - mRowPitch));
+            __m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, nx), vny), _mm_andnot_ps(signMask, nz));
+            __m128 s = _mm_div_ps(vNormalScale, l1);
+            __m128i ex = _mm_cvtps_epi32(_mm_mul_ps(nx, s));
+            __m128i ez = _mm_cvtps_epi32(_mm_mul_ps(nz, s));
+
+            __m128 y = _mm_mul_ps(_mm_loadu_ps(h + col), vHeightScale);
+            __m128i height = _mm_and_si128(_mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(y, heightMin), heightMax)), low16);
+
+            if constexpr(wideNormal)
+            {
+                __m128i normal = _mm_or_si128(_mm_and_si128(ex, low16), _mm_slli_epi32(ez, 16));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(v + col), _mm_unpacklo_epi32(height, normal));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(v + col + 2), _mm_unpackhi_epi32(height, normal));
+            }
+            else
+            {
+                __m128i normal = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(ex, low8), 16), _mm_slli_epi32(ez, 24));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(v + col), _mm_or_si128(height, normal));
+            }
+        }
+    }
+#endif
+
+    for(; col < mNumCols; col++)
+        writeVertex(col);
+}
+
+inline void Waves::StepTiled(int depth)
+{
+    ApplyDisturbances();
+
+    // Tiles must at least cover the halo their neighbours take from them, and a thin
+    // tile spends most of its sweeps on halo cells.
+    int tileRows = std::max(mTileRows > 0 ? mTileRows : 64, 4 * depth);
+    int tileCols = mTileCols;
+    if(tileCols == 0)
+        tileCols = (int)(WavesKernels::TileCacheBytes / (2 * sizeof(float) * (tileRows + 2 * depth))) - 2 * depth;
+    tileCols = std::max(tileCols, 4 * depth);
+
+    int interiorRows = mNumRows - 2;
+    int bandCount = (interiorRows + tileRows - 1) / tileRows;
+    int tilesX = (mNumCols + tileCols - 1) / tileCols;
+    tileCols = (mNumCols + tilesX - 1) / tilesX;
+
+    int chunkCount = 1;
+    if(Multithreaded())
+        chunkCount = std::max(1, std::min(bandCount, ConcurrencyLevel()));
+
+    // Tiles are updated in place, band by band and left to right. A tile needs `depth`
+    // cells of the old state on every side. Cells below and to the right are still
+    // untouched when it runs; cells above and to the left were overwritten by earlier
+    // tiles, which save them before writing back. Bands are grouped into chunks that run
+    // concurrently, so the rows at chunk edges are captured before any tile is written.
+    std::size_t pitch = mRowPitch;
+    std::size_t stripSize = (std::size_t)2 * depth * pitch;
+    std::size_t columnSize = (std::size_t)2 * tileRows * depth;
+    std::size_t chunkSize = 3 * stripSize + 2 * columnSize;
+    std::vector<float> halos((std::size_t)chunkCount * chunkSize);
+
+    auto chunkBand = [bandCount, chunkCount](int chunk)
+    {
+        return (int)((long long)bandCount * chunk / chunkCount);
+    };
+    auto bandRow = [this, tileRows](int band)
+    {
+        return std::min(1 + band * tileRows, mNumRows - 1);
+    };
+
+    for(int chunk = 0; chunk < chunkCount; chunk++)
+    {
+        float* halo = &halos[chunk * chunkSize];
+
+        CopyRows(halo, bandRow(chunkBand(chunk)) - depth, depth, 0, mNumCols);
+        CopyRows(halo + stripSize, bandRow(chunkBand(chunk + 1)), depth, 0, mNumCols);
+    }
+
+    auto runChunk = [&](int chunk)
+    {
+        float* top = &halos[chunk * chunkSize];
+        const float* bottom = top + stripSize;
+        float* saveTop = top + 2 * stripSize;
+        float* left = top + 3 * stripSize;
+        float* saveLeft = left + columnSize;
+
+        int firstBand = chunkBand(chunk);
+        int lastBand = chunkBand(chunk + 1);
+        for(int band = firstBand; band < lastBand; band++)
+        {
+            bool lastInChunk = band == lastBand - 1;
+            int r0 = bandRow(band);
+            int r1 = bandRow(band + 1);
+
+            for(int tile = 0; tile < tilesX; tile++)
+            {
+                int c0 = tile * tileCols;
+                int c1 = std::min(c0 + tileCols, mNumCols);
+
+                StepTile(
+                    r0, r1, c0, c1, depth,
+                    top, lastInChunk ? bottom : nullptr, tile > 0 ? left : nullptr,
+                    lastInChunk ? nullptr : saveTop, tile < tilesX - 1 ? saveLeft : nullptr);
+                std::swap(left, saveLeft);
+            }
+
+            std::swap(top, saveTop);
+        }
+    };
+
+    ParallelFor(chunkCount, runChunk);
+
+    mStepCount += depth;
+    mSteppedCells = (std::size_t)(mNumRows - 2) * (mNumCols - 2);
+    MarkAllRowsChanged();
+}
+
+inline void Waves::StepTile(
+    int r0, int r1, int c0, int c1, int depth,
+    const float* topHalo, const float* bottomHalo, const float* leftHalo,
+    float* saveTopHalo, float* saveLeftHalo)
+{
+    // Local (0, 0) is global (r0 - depth, c0 - depth). Row halos are full-width strips of
+    // `depth` rows; the left halo holds `depth` columns of rows [r0, r1). Both store the
+    // previous level followed by the current level.
+    int gr0 = r0 - depth;
+    int gc0 = c0 - depth;
+    int rows = r1 - r0;
+    int localRows = rows + 2 * depth;
+    int localCols = (c1 - c0) + 2 * depth;
+    std::size_t pitch = (localCols + 7) & ~7;
+    std::size_t levelSize = (std::size_t)localRows * pitch;
+    std::size_t gridPitch = mRowPitch;
+    std::size_t stripLevel = (std::size_t)depth * gridPitch;
+    std::size_t leftLevel = (std::size_t)rows * depth;
+
+    WavesKernels::DenormalGuard flushDenormals;
+
+    thread_local std::vector<float> scratch;
+    if(scratch.size() < 2 * levelSize)
+        scratch.resize(2 * levelSize);
+
+    float* prev = scratch.data();
+    float* curr = prev + levelSize;
+
+    // Cells outside the grid are never read: the sweeps below stop at the boundary.
+    int loadColBegin = std::max(0, gc0);
+    int loadColEnd = std::min(mNumCols, c1 + depth);
+    int loadRowBegin = std::max(0, -gr0);
+    int loadRowEnd = std::min(localRows, mNumRows - gr0);
+    for(int r = loadRowBegin; r < loadRowEnd; r++)
+    {
+        int gr = gr0 + r;
+        float* dstPrev = prev + r * pitch - gc0;
+        float* dstCurr = curr + r * pitch - gc0;
+
+        const float* srcPrev = &mPrevSolution[gr * gridPitch];
+        const float* srcCurr = &mCurrSolution[gr * gridPitch];
+        int gridColBegin = loadColBegin;
+        if(gr < r0)
+        {
+            srcPrev = topHalo + r * gridPitch;
+            srcCurr = srcPrev + stripLevel;
+        }
+        else if(gr >= r1 && bottomHalo != nullptr)
+        {
+            srcPrev = bottomHalo + (gr - r1) * gridPitch;
+            srcCurr = srcPrev + stripLevel;
+        }
+        else if(gr < r1 && leftHalo != nullptr)
+        {
+            const float* haloPrev = leftHalo + (gr - r0) * depth;
+            std::copy(haloPrev, haloPrev + depth, dstPrev + gc0);
+            std::copy(haloPrev + leftLevel, haloPrev + leftLevel + depth, dstCurr + gc0);
+            gridColBegin = c0;
+        }
+
+        std::copy(srcPrev + gridColBegin, srcPrev + loadColEnd, dstPrev + gridColBegin);
+        std::copy(srcCurr + gridColBegin, srcCurr + loadColEnd, dstCurr + gridColBegin);
+    }
+
+    // Each sweep is valid one cell further inside the halo than the last; global
+    // boundary cells are never updated.
+    for(int s = 1; s <= depth; s++)
+    {
+        int rowBegin = std::max(s, 1 - gr0);
+        int rowEnd = std::min(localRows - s, mNumRows - 1 - gr0);
+        int colBegin = std::max(s, 1 - gc0);
+        int colEnd = std::min(localCols - s, mNumCols - 1 - gc0);
+
+        for(int r = rowBegin; r < rowEnd && colBegin < colEnd; r++)
+        {
+            const float* c = curr + r * pitch + colBegin;
+            mStepRow(prev + r * pitch + colBegin, c - pitch, c, c + pitch, colEnd - colBegin, mK1, mK2, mK3);
+            AbsorbRow(prev + r * pitch + colBegin, c, gr0 + r, gc0 + colBegin, gc0 + colEnd);
+        }
+
+        std::swap(prev, curr);
+    }
+
+    // Save what the tiles below and to the right still need before overwriting it.
+    if(saveTopHalo != nullptr)
+        CopyRows(saveTopHalo, r1 - depth, depth, c0, c1);
+
+    if(saveLeftHalo != nullptr)
+    {
+        for(int r = 0; r < rows; r++)
+        {
+            std::size_t src = (r0 + r) * gridPitch + c1 - depth;
+            std::copy(&mPrevSolution[src], &mPrevSolution[src + depth], saveLeftHalo + r * depth);
+            std::copy(&mCurrSolution[src], &mCurrSolution[src + depth], saveLeftHalo + leftLevel + r * depth);
+        }
+    }
+
+    for(int r = 0; r < rows; r++)
+    {
+        std::size_t dst = (r0 + r) * gridPitch + c0;
+        std::size_t src = (depth + r) * pitch + depth;
+        std::copy(prev + src, prev + src + (c1 - c0), &mPrevSolution[dst]);
+        std::copy(curr + src, curr + src + (c1 - c0), &mCurrSolution[dst]);
+    }
+}
+
+inline void Waves::CopyRows(float* dst, int row, int count, int c0, int c1) const
+{
+    // Copies columns [c0, c1) of rows [row, row + count) of both levels into a strip with
+    // the grid's row pitch, skipping rows outside the grid.
+    std::size_t pitch = mRowPitch;
+    for(int r = 0; r < count; r++)
+    {
+        int gr = row + r;
+        if(gr < 0 || gr >= mNumRows)
+            continue;
+
+        std::copy(&mPrevSolution[gr * pitch + c0], &mPrevSolution[gr * pitch + c1], dst + r * pitch + c0);
+        std::copy(&mCurrSolution[gr * pitch + c0], &mCurrSolution[gr * pitch + c1], dst + (count + r) * pitch + c0);
+    }
+}
+
+inline void Waves::Disturb(int i, int j, float magnitude)
+{
+    // Don't disturb boundaries.
+    assert(i > 1 && i < mNumRows - 2);
+    assert(j > 1 && j < mNumCols - 2);
+
+    float halfMag = 0.5f * magnitude;
+    float* h = &mCurrSolution[i * mRowPitch + j];
+
+    // Disturb the ijth vertex height and its neighbors.
+    h[0] += magnitude;
+    h[1] += halfMag;
+    h[-1] += halfMag;
+    h[mRowPitch] += halfMag;
+    h[-mRowPitch] += halfMag;
+    MarkRowsChanged(i - 1, i + 2);
+
+    if(mSparse)
+    {
+        ActivateTile(i, j);
+        ActivateTile(i, j - 1);
+        ActivateTile(i, j + 1);
+        ActivateTile(i - 1, j);
+        ActivateTile(i + 1, j);
+    }
+}
+
+// Replaces both height planes and the scheduler state, e.g. with a checkpoint's.
+inline void Waves::RestoreState(
+    WavesKernels::AlignedFloatArray prev, WavesKernels::AlignedFloatArray curr, float accumulator, std::uint64_t stepCount)
+{
+    mPrevSolution = std::move(prev);
+    mCurrSolution = std::move(curr);
+    mAccumulator = accumulator;
+    mCarriedSteps = std::min<std::uint64_t>((std::uint64_t)(accumulator / mTimeStep), mMaxSubSteps);
+    mStepCount = stepCount;
+
+    if(mSparse)
+        SetSparse(true, mActiveTileSize, mQuietHeight);
+
+    MarkAllRowsChanged();
+}
+
+// Heights in rows [begin, end) changed; normals reach one row further each way.
+inline void Waves::MarkRowsChanged(int begin, int end)
+{
+    std::uint64_t version = ++mSurfaceVersion;
+    int last = std::min(end + 1, mNumRows - 1);
+    for(int i = std::max(begin - 1, 1); i < last; i++)
+        mRowVersion[i] = version;
+}
+
+inline bool Waves::QueueDisturb(float row, float col, float magnitude, float radius)
+{
+    if(!std::isfinite(row) || !std::isfinite(col) || !std::isfinite(magnitude) || !std::isfinite(radius))
+        return false;
+    if(!(radius > 0.0f))
+        return false;
+
+    return mImpulseQueue.Push({ row, col, magnitude, radius });
+}
+
+inline void Waves::ApplyDisturbances()
+{
+    mImpulses.clear();
+    mImpulseQueue.Drain(mImpulses);
+    if(mImpulses.empty())
+        return;
+
+    WavesKernels::DenormalGuard flushDenormals;
+
+    for(const WavesKernels::Impulse& impulse : mImpulses)
+    {
+        if(!(impulse.Radius > 0.0f))
+            continue;
+
+        // Boundary heights stay pinned to zero, so the splat is clipped to the interior. The
+        // bounds are clipped as floats, so far-off impulses never overflow the int conversion.
+        float r0f = std::max(1.0f, ceilf(impulse.Row - impulse.Radius));
+        float r1f = std::min((float)(mNumRows - 2), floorf(impulse.Row + impulse.Radius));
+        float c0f = std::max(1.0f, ceilf(impulse.Col - impulse.Radius));
+        float c1f = std::min((float)(mNumCols - 2), floorf(impulse.Col + impulse.Radius));
+        if(!(r0f <= r1f && c0f <= c1f))
+            continue;
+
+        // The box can still miss the disc when the centre lies outside the interior.
+        float invRadius2 = 1.0f / (impulse.Radius * impulse.Radius);
+        float nearestDy = std::clamp(impulse.Row, r0f, r1f) - impulse.Row;
+        float nearestDx = std::clamp(impulse.Col, c0f, c1f) - impulse.Col;
+        if((nearestDy * nearestDy + nearestDx * nearestDx) * invRadius2 >= 1.0f)
+            continue;
+
+        int r0 = (int)r0f;
+        int r1 = (int)r1f;
+        int c0 = (int)c0f;
+        int c1 = (int)c1f;
+
+        for(int i = r0; i <= r1; i++)
+        {
+            float dy = i - impulse.Row;
+            WavesKernels::SplatRow(&mCurrSolution[i * mRowPitch], c0, c1 + 1, impulse.Col, dy * dy, invRadius2, impulse.Magnitude);
+        }
+        MarkRowsChanged(r0, r1 + 1);
+        mImpulsesApplied++;
+
+        if(mSparse)
+        {
+            for(int ty = r0 / mActiveTileSize; ty <= r1 / mActiveTileSize; ty++)
+            {
+                for(int tx = c0 / mActiveTileSize; tx <= c1 / mActiveTileSize; tx++)
+                    ActivateTile(ty * mActiveTileSize, tx * mActiveTileSize);
+            }
+        }
+    }
+}
+
+#endif
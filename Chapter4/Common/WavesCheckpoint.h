@@ -0,0 +1,356 @@
+#pragma once
+
+#ifndef D3D12BOOK_WAVESCHECKPOINT_H
+#define D3D12BOOK_WAVESCHECKPOINT_H
+
+#include "Waves.h"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Binary snapshot of a Waves surface: both height planes, the normals of the current one
+// and the fixed-step scheduler state, for warm starts and exact repro cases.
+//
+// Layout (little-endian): a WavesCheckpointHeader, then the previous plane, the current
+// plane and optionally the normals, each starting on a SectionAlignment boundary. Planes are
+// stored with the simulation's row pitch, so a mapped file can be handed to Waves as is.
+struct WavesCheckpointHeader
+{
+    char Magic[8];
+    std::uint32_t Version;
+    std::uint32_t HeaderBytes;
+
+    std::int32_t Rows;
+    std::int32_t Columns;
+    std::int32_t RowPitch;
+    std::uint32_t Integrator;
+
+    float SpatialStep;
+    float TimeStep;
+    float Speed;
+    float Damping;
+
+    float Accumulator;
+    std::uint32_t Flags;
+    std::uint64_t StepCount;
+
+    // Byte offsets from the start of the file; NormalsOffset is 0 without normals. Normals
+    // are a float3 per vertex, row by row.
+    std::uint64_t PreviousOffset;
+    std::uint64_t CurrentOffset;
+    std::uint64_t NormalsOffset;
+    std::uint64_t PlaneBytes;
+    std::uint64_t NormalsBytes;
+    std::uint64_t FileBytes;
+};
+
+namespace WavesKernels
+{
+    // Read-only view of a whole file. Pages are mapped copy-on-write, so whoever adopts
+    // them may write; the file itself is never modified.
+    class MappedFile
+    {
+    private:
+        void* mData = nullptr;
+        std::size_t mSize = 0;
+#ifdef _WIN32
+        HANDLE mMapping = nullptr;
+#endif
+
+    public:
+        MappedFile() {}
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile()
+        {
+#ifdef _WIN32
+            if(mData != nullptr)
+                UnmapViewOfFile(mData);
+            if(mMapping != nullptr)
+                CloseHandle(mMapping);
+#else
+            if(mData != nullptr)
+                munmap(mData, mSize);
+#endif
+        }
+
+        bool Open(const std::filesystem::path& path)
+        {
+#ifdef _WIN32
+            HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if(file == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER size = {};
+            if(GetFileSizeEx(file, &size) && size.QuadPart > 0)
+                mMapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+            CloseHandle(file);
+            if(mMapping == nullptr)
+                return false;
+
+            mData = MapViewOfFile(mMapping, FILE_MAP_COPY, 0, 0, 0);
+            mSize = (std::size_t)size.QuadPart;
+#else
+            int file = open(path.c_str(), O_RDONLY);
+            if(file < 0)
+                return false;
+
+            struct stat status = {};
+            if(fstat(file, &status) == 0 && status.st_size > 0)
+            {
+                mSize = (std::size_t)status.st_size;
+                mData = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+                if(mData == MAP_FAILED)
+                    mData = nullptr;
+            }
+            close(file);
+#endif
+            return mData != nullptr;
+        }
+
+        std::uint8_t* Data() const { return static_cast<std::uint8_t*>(mData); }
+        std::size_t Size() const { return mSize; }
+    };
+}
+
+class WavesCheckpoint
+{
+private:
+    std::filesystem::path mPath;
+    std::shared_ptr<WavesKernels::MappedFile> mFile;
+    const WavesCheckpointHeader* mHeader = nullptr;
+
+public:
+    static constexpr char Magic[8] = { 'W', 'A', 'V', 'E', 'S', 'C', 'K', 'P' };
+    static constexpr std::uint32_t FormatVersion = 1;
+    static constexpr std::uint32_t HasNormals = 1;
+
+    // Sections start on page boundaries, which also satisfies WavesKernels::Alignment.
+    static constexpr std::uint64_t SectionAlignment = 4096;
+
+    // Writes the current state of waves to path; normals are optional. Returns false if the
+    // file could not be written.
+    static bool Save(const Waves& waves, const std::filesystem::path& path, bool includeNormals = true);
+
+    // Maps a checkpoint and checks its header and section bounds. The file must not change
+    // while it is open or mapped by a Waves restored from it.
+    bool Open(const std::filesystem::path& path);
+    bool IsOpen() const { return mHeader != nullptr; }
+    void Close();
+
+    const WavesCheckpointHeader& Header() const { return *mHeader; }
+    const float* PreviousHeights() const { return Section<float>(mHeader->PreviousOffset); }
+    const float* Heights() const { return Section<float>(mHeader->CurrentOffset); }
+    const float3* Normals() const { return mHeader->NormalsOffset != 0 ? Section<float3>(mHeader->NormalsOffset) : nullptr; }
+
+    // True if waves was built with the parameters the checkpoint was saved with, so stepping
+    // on from the restored state reproduces the original run exactly.
+    bool Matches(const Waves& waves) const;
+
+    // Loads the checkpoint into waves, which needs the same grid size and spacing; its time
+    // step, speed and damping are kept, so a mismatch there gives a warm start rather than
+    // a replay. With adopt set, waves maps the file again and takes that private view's
+    // planes in place: loading costs nothing up front and pages are copied only as the
+    // simulation first writes them. The view is released with the planes. Otherwise the
+    // heights are copied into newly allocated planes.
+    bool Restore(Waves& waves, bool adopt = true) const;
+
+private:
+    template<typename T>
+    const T* Section(std::uint64_t offset) const
+    {
+        return reinterpret_cast<const T*>(mFile->Data() + offset);
+    }
+};
+
+inline bool WavesCheckpoint::Save(const Waves& waves, const std::filesystem::path& path, bool includeNormals)
+{
+    auto align = [](std::uint64_t offset) { return (offset + SectionAlignment - 1) & ~(SectionAlignment - 1); };
+
+    int m = waves.RowCount();
+    int n = waves.ColumnCount();
+
+    WavesCheckpointHeader header = {};
+    std::memcpy(header.Magic, Magic, sizeof(Magic));
+    header.Version = FormatVersion;
+    header.HeaderBytes = sizeof(WavesCheckpointHeader);
+    header.Rows = m;
+    header.Columns = n;
+    header.RowPitch = waves.RowPitch();
+    header.Integrator = (std::uint32_t)waves.Integrator();
+    header.SpatialStep = waves.mSpatialStep;
+    header.TimeStep = waves.mTimeStep;
+    header.Speed = waves.mSpeed;
+    header.Damping = waves.mDamping;
+    header.Accumulator = waves.mAccumulator;
+    header.Flags = includeNormals ? HasNormals : 0;
+    header.StepCount = waves.StepCount();
+    header.PlaneBytes = (std::uint64_t)m * waves.RowPitch() * sizeof(float);
+    header.NormalsBytes = includeNormals ? (std::uint64_t)waves.VertexCount() * sizeof(float3) : 0;
+    header.PreviousOffset = align(sizeof(WavesCheckpointHeader));
+    header.CurrentOffset = align(header.PreviousOffset + header.PlaneBytes);
+    header.NormalsOffset = includeNormals ? align(header.CurrentOffset + header.PlaneBytes) : 0;
+    header.FileBytes = includeNormals ? header.NormalsOffset + header.NormalsBytes : header.CurrentOffset + header.PlaneBytes;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file)
+        return false;
+
+    auto padTo = [&file](std::uint64_t offset)
+    {
+        static const char zeros[SectionAlignment] = {};
+        std::uint64_t position = (std::uint64_t)file.tellp();
+        file.write(zeros, (std::streamsize)(offset - position));
+    };
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    padTo(header.PreviousOffset);
+    file.write(reinterpret_cast<const char*>(waves.PreviousHeights()), (std::streamsize)header.PlaneBytes);
+    padTo(header.CurrentOffset);
+    file.write(reinterpret_cast<const char*>(waves.Heights()), (std::streamsize)header.PlaneBytes);
+
+    if(includeNormals)
+    {
+        padTo(header.NormalsOffset);
+
+        std::vector<float3> normals(n);
+        for(int i = 0; i < m; i++)
+        {
+            for(int j = 0; j < n; j++)
+                normals[j] = waves.Normal(i * n + j);
+            file.write(reinterpret_cast<const char*>(normals.data()), (std::streamsize)(n * sizeof(float3)));
+        }
+    }
+
+    return (bool)file.flush();
+}
+
+inline bool WavesCheckpoint::Open(const std::filesystem::path& path)
+{
+    Close();
+
+    std::shared_ptr<WavesKernels::MappedFile> file = std::make_shared<WavesKernels::MappedFile>();
+    if(!file->Open(path) || file->Size() < sizeof(WavesCheckpointHeader))
+        return false;
+
+    const WavesCheckpointHeader* header = reinterpret_cast<const WavesCheckpointHeader*>(file->Data());
+    if(std::memcmp(header->Magic, Magic, sizeof(Magic)) != 0 || header->Version != FormatVersion ||
+        header->HeaderBytes != sizeof(WavesCheckpointHeader) || header->FileBytes > file->Size())
+        return false;
+
+    if(header->Rows < 3 || header->Columns < 3 || header->RowPitch < header->Columns ||
+        header->PlaneBytes != (std::uint64_t)header->Rows * header->RowPitch * sizeof(float))
+        return false;
+
+    auto inBounds = [&](std::uint64_t offset, std::uint64_t bytes)
+    {
+        return offset % SectionAlignment == 0 && offset >= sizeof(WavesCheckpointHeader) &&
+            offset <= header->FileBytes && bytes <= header->FileBytes - offset;
+    };
+
+    if(!inBounds(header->PreviousOffset, header->PlaneBytes) || !inBounds(header->CurrentOffset, header->PlaneBytes))
+        return false;
+
+    if(header->Flags & HasNormals)
+    {
+        if(header->NormalsBytes != (std::uint64_t)header->Rows * header->Columns * sizeof(float3) ||
+            !inBounds(header->NormalsOffset, header->NormalsBytes))
+            return false;
+    }
+    else if(header->NormalsOffset != 0)
+    {
+        return false;
+    }
+
+    mPath = path;
+    mFile = std::move(file);
+    mHeader = header;
+
+    return true;
+}
+
+inline void WavesCheckpoint::Close()
+{
+    mHeader = nullptr;
+    mFile.reset();
+    mPath.clear();
+}
+
+inline bool WavesCheckpoint::Matches(const Waves& waves) const
+{
+    return IsOpen() &&
+        mHeader->Rows == waves.RowCount() && mHeader->Columns == waves.ColumnCount() &&
+        mHeader->SpatialStep == waves.mSpatialStep && mHeader->TimeStep == waves.mTimeStep &&
+        mHeader->Speed == waves.mSpeed && mHeader->Damping == waves.mDamping &&
+        mHeader->Integrator == (std::uint32_t)waves.Integrator();
+}
+
+inline bool WavesCheckpoint::Restore(Waves& waves, bool adopt) const
+{
+    if(!IsOpen() || mHeader->Rows != waves.RowCount() || mHeader->Columns != waves.ColumnCount() ||
+        mHeader->SpatialStep != waves.mSpatialStep)
+        return false;
+
+    using WavesKernels::AlignedFloatArray;
+
+    std::size_t pitch = waves.RowPitch();
+    std::size_t planeFloats = (std::size_t)waves.RowCount() * pitch;
+    AlignedFloatArray prev;
+    AlignedFloatArray curr;
+
+    // Each adopting Waves gets a view of its own: writes to copy-on-write pages are private
+    // to the mapping, so sharing mFile would let the simulation change what this
+    // checkpoint (and anything restored from it later) reads.
+    std::shared_ptr<WavesKernels::MappedFile> view;
+    if(adopt && (std::size_t)mHeader->RowPitch == pitch)
+    {
+        view = std::make_shared<WavesKernels::MappedFile>();
+        if(!view->Open(mPath) || view->Size() < mHeader->FileBytes)
+            view.reset();
+    }
+
+    if(view)
+    {
+        float* data = reinterpret_cast<float*>(view->Data());
+        std::shared_ptr<const void> owner = view;
+        prev = AlignedFloatArray(data + mHeader->PreviousOffset / sizeof(float), { owner });
+        curr = AlignedFloatArray(data + mHeader->CurrentOffset / sizeof(float), { owner });
+    }
+    else
+    {
+        prev = WavesKernels::AllocateFloats(planeFloats);
+        curr = WavesKernels::AllocateFloats(planeFloats);
+
+        std::size_t columns = waves.ColumnCount();
+        for(int i = 0; i < waves.RowCount(); i++)
+        {
+            std::memcpy(&prev[i * pitch], PreviousHeights() + i * (std::size_t)mHeader->RowPitch, columns * sizeof(float));
+            std::memcpy(&curr[i * pitch], Heights() + i * (std::size_t)mHeader->RowPitch, columns * sizeof(float));
+        }
+    }
+
+    waves.RestoreState(std::move(prev), std::move(curr), mHeader->Accumulator, mHeader->StepCount);
+
+    return true;
+}
+
+#endif
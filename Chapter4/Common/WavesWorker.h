@@ -0,0 +1,267 @@
+#pragma once
+
+#ifndef D3D12BOOK_WAVESWORKER_H
+#define D3D12BOOK_WAVESWORKER_H
+
+#include "Waves.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Vertex layout the worker publishes; matches the { Pos, Normal, TexC } vertex of the demos.
+struct WavesVertex
+{
+    float3 Pos;
+    float3 Normal;
+    float2 TexC;
+};
+
+struct WavesFrame
+{
+    std::vector<WavesVertex> Vertices;
+
+    // Waves::StepCount() and Waves::InterpolationFactor() after the frame was simulated.
+    std::uint64_t StepCount = 0;
+    float InterpolationFactor = 0.0f;
+
+    // steady_clock time (ns) of the Submit() this frame answers, and of its publication.
+    std::int64_t SubmitTime = 0;
+    std::int64_t PublishTime = 0;
+};
+
+struct WavesWorkerStats
+{
+    std::uint64_t FramesSubmitted = 0;
+    std::uint64_t FramesPublished = 0;
+    std::uint64_t FramesConsumed = 0;
+
+    // Published frames replaced by a newer one before the renderer acquired them.
+    std::uint64_t FramesDropped = 0;
+
+    std::uint64_t Steps = 0;
+
+    // Steps the fixed-step scheduler pushed to a later frame or discarded over budget. Each
+    // deferred step is counted once, however many frames it waits.
+    std::uint64_t DeferredSteps = 0;
+    std::uint64_t DroppedSteps = 0;
+
+    // Mean time the worker spent per published frame.
+    double SimulationMs = 0.0;
+
+    // Mean time from Submit() to the renderer acquiring the resulting frame.
+    double LatencyMs = 0.0;
+
+    // Simulation throughput over the worker's busy time.
+    double StepsPerSecond = 0.0;
+    double CellsPerSecond = 0.0;
+};
+
+// Runs a Waves simulation on its own thread, pipelined with rendering. Each frame the renderer
+// calls Submit(dt) and then Acquire(), which returns the most recent completed frame; the
+// worker meanwhile simulates the next one. Frames are handed over through a lock-free triple
+// buffer, so neither side ever waits for the other.
+//
+// The worker does not own the Waves instance. While the worker exists, only its const
+// accessors (grid size and the like) and the thread-safe QueueDisturb may be used from
+// other threads.
+class WavesWorker
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // mMiddle holds the index of the slot between the two threads, plus FreshBit when it holds
+    // a frame the renderer has not acquired yet.
+    static constexpr std::uint32_t IndexMask = 3;
+    static constexpr std::uint32_t FreshBit = 4;
+
+    Waves& mWaves;
+
+    WavesFrame mSlots[3];
+    std::uint32_t mBack = 0;
+    std::atomic<std::uint32_t> mMiddle = 1;
+    std::uint32_t mFront = 2;
+
+    std::atomic<std::uint32_t> mSubmitCount = 0;
+    std::atomic<float> mPendingTime = 0.0f;
+    std::atomic<std::int64_t> mSubmitTime = 0;
+    std::atomic<bool> mStop = false;
+
+    // Written by the worker only.
+    std::atomic<std::uint64_t> mFramesPublished = 0;
+    std::atomic<std::uint64_t> mFramesDropped = 0;
+    std::atomic<std::uint64_t> mSteps = 0;
+    std::atomic<std::uint64_t> mDeferredSteps = 0;
+    std::atomic<std::uint64_t> mDroppedSteps = 0;
+    std::atomic<std::int64_t> mBusyTime = 0;
+
+    // Written by the renderer only.
+    std::uint64_t mFramesSubmitted = 0;
+    std::uint64_t mFramesConsumed = 0;
+    std::int64_t mLatencyTime = 0;
+
+    std::thread mThread;
+
+public:
+    explicit WavesWorker(Waves& waves);
+    WavesWorker(const WavesWorker&) = delete;
+    WavesWorker& operator=(const WavesWorker&) = delete;
+    ~WavesWorker();
+
+    const Waves& Simulation() const { return mWaves; }
+
+    // Queues an impulse; it is applied at the start of the next simulated step.
+    bool Disturb(float row, float col, float magnitude, float radius = Waves::DefaultSplatRadius)
+    {
+        return mWaves.QueueDisturb(row, col, magnitude, radius);
+    }
+
+    // Hands dt of simulation time to the worker and wakes it. Time submitted while the worker
+    // is busy accumulates into its next frame.
+    void Submit(float dt);
+
+    // Returns the newest completed frame; before the first one is published, the surface as
+    // it was when the worker was created. The frame stays unchanged until the next Acquire().
+    const WavesFrame& Acquire();
+
+    // Acquire() and copy the vertices to dst, typically a mapped upload buffer.
+    template<typename VertexT>
+    void CopyVertices(VertexT* dst);
+
+    // Counters for the renderer; call from the thread that calls Submit() and Acquire().
+    WavesWorkerStats Stats() const;
+
+private:
+    static std::int64_t Now();
+    void Run();
+};
+
+inline WavesWorker::WavesWorker(Waves& waves)
+    : mWaves(waves)
+{
+    for(WavesFrame& slot : mSlots)
+        slot.Vertices.resize(waves.VertexCount());
+
+    WavesFrame& front = mSlots[mFront];
+    waves.WriteVertices(front.Vertices.data());
+    front.StepCount = waves.StepCount();
+    front.InterpolationFactor = waves.InterpolationFactor();
+    front.SubmitTime = Now();
+    front.PublishTime = front.SubmitTime;
+
+    mThread = std::thread(&WavesWorker::Run, this);
+}
+
+inline WavesWorker::~WavesWorker()
+{
+    mStop.store(true);
+    mSubmitCount.fetch_add(1, std::memory_order_release);
+    mSubmitCount.notify_one();
+
+    mThread.join();
+}
+
+inline void WavesWorker::Submit(float dt)
+{
+    mPendingTime.fetch_add(dt, std::memory_order_relaxed);
+    mSubmitTime.store(Now(), std::memory_order_relaxed);
+    mFramesSubmitted++;
+
+    mSubmitCount.fetch_add(1, std::memory_order_release);
+    mSubmitCount.notify_one();
+}
+
+inline const WavesFrame& WavesWorker::Acquire()
+{
+    if(mMiddle.load(std::memory_order_relaxed) & FreshBit)
+    {
+        mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & IndexMask;
+
+        mFramesConsumed++;
+        mLatencyTime += Now() - mSlots[mFront].SubmitTime;
+    }
+
+    return mSlots[mFront];
+}
+
+template<typename VertexT>
+inline void WavesWorker::CopyVertices(VertexT* dst)
+{
+    static_assert(sizeof(VertexT) == sizeof(WavesVertex), "Waves vertices are { float3 Pos; float3 Normal; float2 TexC; }");
+
+    const WavesFrame& frame = Acquire();
+    std::memcpy(dst, frame.Vertices.data(), frame.Vertices.size() * sizeof(WavesVertex));
+}
+
+inline WavesWorkerStats WavesWorker::Stats() const
+{
+    WavesWorkerStats stats;
+    stats.FramesSubmitted = mFramesSubmitted;
+    stats.FramesPublished = mFramesPublished.load(std::memory_order_relaxed);
+    stats.FramesConsumed = mFramesConsumed;
+    stats.FramesDropped = mFramesDropped.load(std::memory_order_relaxed);
+    stats.Steps = mSteps.load(std::memory_order_relaxed);
+    stats.DeferredSteps = mDeferredSteps.load(std::memory_order_relaxed);
+    stats.DroppedSteps = mDroppedSteps.load(std::memory_order_relaxed);
+
+    double busySeconds = mBusyTime.load(std::memory_order_relaxed) * 1e-9;
+    if(stats.FramesPublished > 0)
+        stats.SimulationMs = busySeconds * 1e3 / stats.FramesPublished;
+    if(stats.FramesConsumed > 0)
+        stats.LatencyMs = mLatencyTime * 1e-6 / stats.FramesConsumed;
+    if(busySeconds > 0.0)
+    {
+        stats.StepsPerSecond = stats.Steps / busySeconds;
+        stats.CellsPerSecond = stats.StepsPerSecond * mWaves.VertexCount();
+    }
+
+    return stats;
+}
+
+inline std::int64_t WavesWorker::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+inline void WavesWorker::Run()
+{
+    std::uint32_t seen = 0;
+
+    for(;;)
+    {
+        mSubmitCount.wait(seen, std::memory_order_acquire);
+        seen = mSubmitCount.load(std::memory_order_acquire);
+        if(mStop.load())
+            break;
+
+        std::int64_t start = Now();
+        std::int64_t submitTime = mSubmitTime.load(std::memory_order_relaxed);
+        float dt = mPendingTime.exchange(0.0f, std::memory_order_relaxed);
+
+        WavesFrame& frame = mSlots[mBack];
+        std::uint64_t stepsBefore = mWaves.StepCount();
+        mWaves.Update(dt, frame.Vertices.data());
+
+        std::int64_t end = Now();
+        frame.StepCount = mWaves.StepCount();
+        frame.InterpolationFactor = mWaves.InterpolationFactor();
+        frame.SubmitTime = submitTime;
+        frame.PublishTime = end;
+
+        mSteps.fetch_add(frame.StepCount - stepsBefore, std::memory_order_relaxed);
+        mDeferredSteps.store(mWaves.DeferredSteps(), std::memory_order_relaxed);
+        mDroppedSteps.store(mWaves.DroppedSteps(), std::memory_order_relaxed);
+        mBusyTime.fetch_add(end - start, std::memory_order_relaxed);
+        mFramesPublished.fetch_add(1, std::memory_order_relaxed);
+
+        // Publish: the finished slot becomes the middle one and the old middle slot is reused.
+        std::uint32_t previous = mMiddle.exchange(mBack | FreshBit, std::memory_order_acq_rel);
+        if(previous & FreshBit)
+            mFramesDropped.fetch_add(1, std::memory_order_relaxed);
+        mBack = previous & IndexMask;
+    }
+}
+
+#endif
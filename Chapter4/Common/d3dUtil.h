@@ -45,6 +45,9 @@ inline std::wstring AnsiToWString(const std::string& str)
 }
 #endif
 
+// Defined in Meshlets.h.
+struct MeshletData;
+
 namespace DirectXHelper
 {
     namespace Math
@@ -297,6 +300,19 @@ namespace DirectXHelper
             UINT memoryIndex = elementIndex * mElementByteSize;
             memcpy_s(&mMappedData[memoryIndex], mBufferWidth - memoryIndex, &data, sizeof(Data));
         }
+
+        // Direct access for writers that fill the whole buffer in one pass. Upload heaps are
+        // write-combined, so write sequentially and never read the memory back.
+        Data* MappedData() const
+        {
+            assert(!mIsConstantBuffer);
+            return reinterpret_cast<Data*>(mMappedData);
+        }
+
+        UINT ElementCount() const
+        {
+            return mBufferWidth / mElementByteSize;
+        }
     };
 
     inline Microsoft::WRL::ComPtr<ID3DBlob> CompileShader(
@@ -354,14 +370,56 @@ namespace DirectXHelper
         return hr;
     }
 
+    // Per-vertex input layout matching a GeometryGenerator::VertexLayout: one element per
+    // attribute, in the layout's order, at the member's offset in the vertex.
+    template <class Layout>
+    inline std::vector<D3D12_INPUT_ELEMENT_DESC> MakeInputLayout(UINT inputSlot = 0)
+    {
+        static constexpr DXGI_FORMAT FloatFormats[] =
+        {
+            DXGI_FORMAT_UNKNOWN,
+            DXGI_FORMAT_R32_FLOAT,
+            DXGI_FORMAT_R32G32_FLOAT,
+            DXGI_FORMAT_R32G32B32_FLOAT,
+            DXGI_FORMAT_R32G32B32A32_FLOAT
+        };
+
+        std::vector<D3D12_INPUT_ELEMENT_DESC> inputLayout;
+        inputLayout.reserve(Layout::ElementCount);
+
+        for(const auto& element : Layout::Describe())
+        {
+            inputLayout.push_back({
+                element.SemanticName, 0, FloatFormats[element.ComponentCount],
+                inputSlot, element.ByteOffset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 });
+        }
+
+        return inputLayout;
+    }
+
     struct MeshGeometry
     {
+        // One level of detail of a submesh: an index range over the submesh's vertices and its
+        // object-space error (see MeshSimplifier.h).
+        struct SubmeshLod
+        {
+            UINT IndexCount = 0;
+            UINT StartIndexLocation = 0;
+            float Error = 0.0f;
+        };
+
         struct SubmeshGeometry
         {
             UINT IndexCount = 0;
             UINT StartIndexLocation = 0;
             UINT BaseVertexLocation = 0;
             BoundingBox Bounds;
+
+            // Meshlets and their culling bounds, when built with MeshletBuilder.
+            std::shared_ptr<const MeshletData> Meshlets;
+
+            // Levels of detail, finest first; empty when only the full mesh exists.
+            std::vector<SubmeshLod> Lods;
         };
 
         std::wstring Name;
@@ -6,6 +6,7 @@
 
 #include "targetver.h"
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#define NOMINMAX                        // Keep std::min/std::max usable in the shared headers
 // Windows Header Files
 #include <Windows.h>
 // C RunTime Header Files
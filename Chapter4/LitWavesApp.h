@@ -7,7 +7,7 @@
 #include "Common/framework.h"
 #include "Common/d3dApp.h"
 #include "Common/GeometryGenerator.h"
-#include <ppl.h>
+#include "Common/Waves.h"
 
 #ifndef D3D12BOOK_LITWAVESAPP_H
 #define D3D12BOOK_LITWAVESAPP_H
@@ -105,187 +105,6 @@ struct RenderItem
     RenderItem() = default;
 };
 
-class Waves
-{
-private:
-    int mNumRows = 0;
-    int mNumCols = 0;
-
-    int mVertexCount = 0;
-    int mTriangleCount = 0;
-
-    float mSpeed = 0.0f;
-    float mDamping = 0.0f;
-
-    float mK1 = 0.0f;
-    float mK2 = 0.0f;
-    float mK3 = 0.0f;
-
-    float mTimeStep = 0.0f;
-    float mSpatialStep = 0.0f;
-
-    std::vector<float3> mPrevSolution;
-    std::vector<float3> mCurrSolution;
-    std::vector<float3> mNormals;
-    std::vector<float3> mTangentX;
-
-public:
-    Waves(int m, int n, float dx, float dt, float speed, float damping);
-    Waves(const Waves&) = delete;
-    Waves& operator=(const Waves&) = delete;
-    ~Waves() {}
-
-    int RowCount() const { return mNumRows; }
-    int ColumnCount() const { return mNumCols; }
-    int VertexCount() const { return mVertexCount; }
-    int TriangleCount() const { return mTriangleCount; }
-    float Width() const { return mNumCols * mSpatialStep; }
-    float Depth() const { return mNumRows * mSpatialStep; }
-
-    const float3& Position(int i) const { return mCurrSolution[i]; }
-    const float3& Normal(int i) const { return mNormals[i]; }
-    const float3& TangentX(int i) const { return mTangentX[i]; }
-
-    void Update(float dt);
-    void Disturb(int i, int j, float magnitude);
-};
-
-Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
-{
-    mNumRows = m;
-    mNumCols = n;
-
-    mVertexCount = m * n;
-    mTriangleCount = (m - 1) * (n - 1) * 2;
-
-    mTimeStep = dt;
-    mSpatialStep = dx;
-
-    mSpeed = speed;
-    mDamping = damping;
-
-    float d = damping * dt + 2.0f;
-    float e = speed * speed * dt * dt / (dx * dx);
-    mK1 = (damping * dt - 2.0f) / d;
-    mK2 = (4.0f - 8.0f * e) / d;
-    mK3 = (2.0f * e) / d;
-
-    mPrevSolution.resize(m * n);
-    mCurrSolution.resize(m * n);
-    mNormals.resize(m * n);
-    mTangentX.resize(m * n);
-
-    float halfWidth = (n - 1) * dx * 0.5f;
-    float halfDepth = (m - 1) * dx * 0.5f;
-    for(int i = 0; i < m; i++)
-    {
-        float z = halfDepth - i * dx;
-        for(int j = 0; j < n; j++)
-        {
-            float x = -halfWidth + j * dx;
-
-            mPrevSolution[i * n + j] = float3(x, 0.0f, z);
-            mCurrSolution[i * n + j] = float3(x, 0.0f, z);
-            mNormals[i * n + j] = float3(0, 1, 0);
-            mTangentX[i * n + j] = float3(1, 0, 0);
-        }
-    }
-}
-
-void Waves::Update(float dt)
-{
-    static float t = 0;
-
-    if(abs(dt) < 0.0001f)
-        return;
-
-    // Accumulate time.
-    t += dt;
-
-    // Only update the simulation at the specified time step.
-    if(t >= mTimeStep)
-    {
-        Start:
-        // Only update interior points; we use zero boundary conditions.
-        concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-                                  //for(int i = 1; i < mNumRows-1; ++i)
-                                  {
-                                      for(int j = 1; j < mNumCols - 1; ++j)
-                                      {
-                                          // After this update we will be discarding the old previous
-                                          // buffer, so overwrite that buffer with the new update.
-                                          // Note how we can do this inplace (read/write to same element) 
-                                          // because we won't need prev_ij again and the assignment happens last.
-
-                                          // Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-                                          // Moreover, our +z axis goes "down"; this is just to 
-                                          // keep consistent with our row indices going down.
-
-                                          mPrevSolution[i * mNumCols + j].y =
-                                              mK1 * mPrevSolution[i * mNumCols + j].y +
-                                              mK2 * mCurrSolution[i * mNumCols + j].y +
-                                              mK3 * (mCurrSolution[(i + 1) * mNumCols + j].y +
-                                                     mCurrSolution[(i - 1) * mNumCols + j].y +
-                                                     mCurrSolution[i * mNumCols + j + 1].y +
-                                                     mCurrSolution[i * mNumCols + j - 1].y);
-                                      }
-                                  });
-
-        // We just overwrote the previous buffer with the new data, so
-        // this data needs to become the current solution and the old
-        // current solution becomes the new previous solution.
-        std::swap(mPrevSolution, mCurrSolution);
-
-        t -= mTimeStep; // reset time
-        if(t < 0.0f)
-            t = 0.0f;
-
-        //
-        // Compute normals using finite difference scheme.
-        //
-        concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-                                  //for(int i = 1; i < mNumRows - 1; ++i)
-                                  {
-                                      for(int j = 1; j < mNumCols - 1; ++j)
-                                      {
-                                          float l = mCurrSolution[i * mNumCols + j - 1].y;
-                                          float r = mCurrSolution[i * mNumCols + j + 1].y;
-                                          float t = mCurrSolution[(i - 1) * mNumCols + j].y;
-                                          float b = mCurrSolution[(i + 1) * mNumCols + j].y;
-                                          mNormals[i * mNumCols + j].x = -r + l;
-                                          mNormals[i * mNumCols + j].y = 2.0f * mSpatialStep;
-                                          mNormals[i * mNumCols + j].z = b - t;
-
-                                          XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&mNormals[i * mNumCols + j]));
-                                          XMStoreFloat3(&mNormals[i * mNumCols + j], n);
-
-                                          mTangentX[i * mNumCols + j] = XMFLOAT3(2.0f * mSpatialStep, r - l, 0.0f);
-                                          XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&mTangentX[i * mNumCols + j]));
-                                          XMStoreFloat3(&mTangentX[i * mNumCols + j], T);
-                                      }
-                                  });
-
-        if(t > 0.0f)
-            goto Start;
-    }
-}
-
-void Waves::Disturb(int i, int j, float magnitude)
-{
-    // Don't disturb boundaries.
-    assert(i > 1 && i < mNumRows - 2);
-    assert(j > 1 && j < mNumCols - 2);
-
-    float halfMag = 0.5f * magnitude;
-
-    // Disturb the ijth vertex height and its neighbors.
-    mCurrSolution[i * mNumCols + j].y += magnitude;
-    mCurrSolution[i * mNumCols + j + 1].y += halfMag;
-    mCurrSolution[i * mNumCols + j - 1].y += halfMag;
-    mCurrSolution[(i + 1) * mNumCols + j].y += halfMag;
-    mCurrSolution[(i - 1) * mNumCols + j].y += halfMag;
-}
-
 enum class RenderLayer : int
 {
     Opaque = 0,
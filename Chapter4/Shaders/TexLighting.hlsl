@@ -76,6 +76,32 @@ VertexOut VS(VertexIn vin)
     return vout;
 }
 
+#ifdef WAVES_HEIGHT_RANGE
+// Compact waves vertex: x/z and uv from the static stream, a normalized height and an
+// octahedral normal from the per-frame stream (see WavesCompactVertex in Waves.h).
+struct WavesVertexIn
+{
+    float2 PosXZ : POSITION;
+    float2 TexC : TEXCOORD;
+    float Height : HEIGHT;
+    float2 NormalOct : NORMAL;
+};
+
+VertexOut WavesVS(WavesVertexIn vin)
+{
+    float3 n = float3(vin.NormalOct.x, 1.0f - abs(vin.NormalOct.x) - abs(vin.NormalOct.y), vin.NormalOct.y);
+    float fold = saturate(-n.y);
+    n.xz += n.xz >= 0.0f ? -fold : fold;
+
+    VertexIn expanded;
+    expanded.PosL = float3(vin.PosXZ.x, vin.Height * WAVES_HEIGHT_RANGE, vin.PosXZ.y);
+    expanded.NormalL = normalize(n);
+    expanded.TexC = vin.TexC;
+
+    return VS(expanded);
+}
+#endif
+
 float4 PS(VertexOut pin) : SV_Target
 {
     float4 diffuseAlbedo = gDiffuseMap.Sample(gsamLinearWrap, pin.TexC) * gDiffuseAlbedo;
@@ -7,6 +7,10 @@
 #include "Common/framework.h"
 #include "Common/d3dApp.h"
 #include "Common/GeometryGenerator.h"
+#include "Common/MeshOptimizer.h"
+#include "Common/Meshlets.h"
+#include "Common/MeshSimplifier.h"
+#include <cstdio>
 
 #ifndef D3D12BOOK_SKULLAPP_H
 #define D3D12BOOK_SKULLAPP_H
@@ -86,6 +90,12 @@ struct RenderItem
     UINT StartIndexLocation = 0;
     INT BaseVertexLocation = 0;
 
+    // Levels of detail of the submesh, the one drawn this frame, and the object-space bounds
+    // used to pick it.
+    std::vector<DirectXHelper::MeshGeometry::SubmeshLod> Lods;
+    std::size_t Lod = 0;
+    BoundingBox Bounds;
+
     RenderItem() = default;
 };
 
@@ -146,6 +156,7 @@ private:
     void UpdateCamera(const GameTimer<float>& gt);
     void UpdateObjectCBs(const GameTimer<float>& gt);
     void UpdateMainPassCB(const GameTimer<float>& gt);
+    void UpdateLods();
 
     void BuildDescriptorHeaps();
     void BuildConstantBufferViews();
@@ -233,6 +244,7 @@ void SkullApp::Update(GameTimer<float>& gt)
 
     UpdateObjectCBs(gt);
     UpdateMainPassCB(gt);
+    UpdateLods();
 }
 
 void SkullApp::Draw(const GameTimer<float>& gt)
@@ -404,6 +416,35 @@ void SkullApp::UpdateMainPassCB(const GameTimer<float>& gt)
     currPassCB->CopyData(0, mMainPassCB);
 }
 
+// Picks each render item's level of detail so that its simplification error stays under a pixel
+// on screen, using the camera of this frame's pass constants.
+void SkullApp::UpdateLods()
+{
+    float pixelsPerUnit = MeshSimplifier::PixelsPerUnitAtUnitDistance(mMainPassCB.Proj._22, mMainPassCB.RenderTargetSize.y);
+    XMVECTOR eye = XMLoadFloat3(&mMainPassCB.EyePosW);
+
+    for(auto& ri : mAllRItems)
+    {
+        if(ri->Lods.empty())
+            continue;
+
+        XMMATRIX world = XMLoadFloat4x4(&ri->World);
+        float scale = std::max({
+            XMVectorGetX(XMVector3Length(world.r[0])),
+            XMVectorGetX(XMVector3Length(world.r[1])),
+            XMVectorGetX(XMVector3Length(world.r[2]))
+        });
+
+        XMVECTOR center = XMVector3TransformCoord(XMLoadFloat3(&ri->Bounds.Center), world);
+        float radius = scale * XMVectorGetX(XMVector3Length(XMLoadFloat3(&ri->Bounds.Extents)));
+        float distance = std::max(XMVectorGetX(XMVector3Length(center - eye)) - radius, mMainPassCB.NearZ);
+
+        ri->Lod = MeshSimplifier::SelectLod(ri->Lods, ri->Lod, distance / scale, pixelsPerUnit);
+        ri->IndexCount = ri->Lods[ri->Lod].IndexCount;
+        ri->StartIndexLocation = ri->Lods[ri->Lod].StartIndexLocation;
+    }
+}
+
 void SkullApp::BuildDescriptorHeaps()
 {
     UINT objCnt = (UINT)mOpaqueRItems.size();
@@ -583,6 +624,28 @@ void SkullApp::BuildShapeGeometry()
             std::getline(fin, s);
             indices[i * 3 + 2] = std::stoi(s);
         }
+
+        std::size_t vertexCount = vertices.size();
+        MeshOptimizer::Report report = MeshOptimizer::Optimize(
+            vertices.data(), vertexCount, indices.data(), indices.size(), &Vertex::Pos);
+        vertices.resize(vertexCount);
+
+        char text[256];
+        std::snprintf(text, sizeof(text), "skull: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %zu clusters\n",
+            report.FifoBefore.ACMR, report.FifoAfter.ACMR, report.FifoBefore.ATVR, report.FifoAfter.ATVR, report.ClusterCount);
+        OutputDebugStringA(text);
+    }
+
+    std::size_t fullIndexCount = indices.size();
+    std::vector<MeshSimplifier::Level> levels = MeshSimplifier::BuildLodChain(
+        indices, fullIndexCount, vertices.data(), vertices.size(), &Vertex::Pos);
+
+    for(std::size_t i = 0; i < levels.size(); i++)
+    {
+        char text[128];
+        std::snprintf(text, sizeof(text), "skull LOD %zu: %zu triangles, error %.4f\n",
+            i, levels[i].IndexCount / 3, levels[i].Error);
+        OutputDebugStringA(text);
     }
     
     UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
@@ -620,8 +683,16 @@ void SkullApp::BuildShapeGeometry()
 
     DirectXHelper::MeshGeometry::SubmeshGeometry submesh = {};
     submesh.StartIndexLocation = 0;
-    submesh.IndexCount = (UINT)indices.size();
+    submesh.IndexCount = (UINT)fullIndexCount;
     submesh.BaseVertexLocation = 0;
+    submesh.Meshlets = std::make_shared<const MeshletData>(
+        MeshletBuilder::Build(indices.data(), fullIndexCount, vertices.data(), vertices.size(), &Vertex::Pos));
+
+    if(!vertices.empty())
+        BoundingBox::CreateFromPoints(submesh.Bounds, vertices.size(), &vertices[0].Pos, sizeof(Vertex));
+
+    for(const MeshSimplifier::Level& level : levels)
+        submesh.Lods.push_back({ (UINT)level.IndexCount, (UINT)level.StartIndex, level.Error });
     
     geo->DrawArgs[L"skull"] = submesh;
 
@@ -676,6 +747,8 @@ void SkullApp::BuildRenderItems()
     skull->IndexCount = skull->Geo->DrawArgs[L"skull"].IndexCount;
     skull->StartIndexLocation = skull->Geo->DrawArgs[L"skull"].StartIndexLocation;
     skull->BaseVertexLocation = skull->Geo->DrawArgs[L"skull"].BaseVertexLocation;
+    skull->Lods = skull->Geo->DrawArgs[L"skull"].Lods;
+    skull->Bounds = skull->Geo->DrawArgs[L"skull"].Bounds;
 
     mAllRItems.push_back(std::move(skull));
 
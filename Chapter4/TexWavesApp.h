@@ -8,7 +8,7 @@
 #include "Common/d3dApp.h"
 #include "Common/GeometryGenerator.h"
 #include "Common/DDSTextureLoader.h"
-#include <ppl.h>
+#include "Common/Waves.h"
 
 #ifndef D3D12BOOK_TEXWAVESAPP_H
 #define D3D12BOOK_TEXWAVESAPP_H
@@ -65,7 +65,11 @@ public:
     std::unique_ptr<DirectXHelper::UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
     std::unique_ptr<DirectXHelper::UploadBuffer<DirectXHelper::MaterialConstants>> MaterialCB = nullptr;
 
-    std::unique_ptr<DirectXHelper::UploadBuffer<Vertex>> WavesVB = nullptr;
+    // Heights and normals only; x/z and uv live in the app's static waves buffer.
+    std::unique_ptr<DirectXHelper::UploadBuffer<WavesCompactVertex>> WavesVB = nullptr;
+
+    // Waves::SurfaceVersion() WavesVB holds; only rows changed since then are rewritten.
+    std::uint64_t WavesVersion = 0;
 
     UINT64 Fence = 0;
 
@@ -80,7 +84,7 @@ public:
         ObjectCB = std::make_unique<DirectXHelper::UploadBuffer<ObjectConstants>>(device, objectCount, true);
         MaterialCB = std::make_unique<DirectXHelper::UploadBuffer<DirectXHelper::MaterialConstants>>(device, materialCount, true);
 
-        WavesVB = std::make_unique<DirectXHelper::UploadBuffer<Vertex>>(device, waveVertCount, false);
+        WavesVB = std::make_unique<DirectXHelper::UploadBuffer<WavesCompactVertex>>(device, waveVertCount, false);
     }
 
     FrameResource(const FrameResource&) = delete;
@@ -110,194 +114,10 @@ struct RenderItem
     RenderItem() = default;
 };
 
-class Waves
-{
-private:
-    int mNumRows = 0;
-    int mNumCols = 0;
-
-    int mVertexCount = 0;
-    int mTriangleCount = 0;
-
-    float mSpeed = 0.0f;
-    float mDamping = 0.0f;
-
-    float mK1 = 0.0f;
-    float mK2 = 0.0f;
-    float mK3 = 0.0f;
-
-    float mTimeStep = 0.0f;
-    float mSpatialStep = 0.0f;
-
-    std::vector<float3> mPrevSolution;
-    std::vector<float3> mCurrSolution;
-    std::vector<float3> mNormals;
-    std::vector<float2> mTexC;
-    std::vector<float3> mTangentX;
-
-public:
-    Waves(int m, int n, float dx, float dt, float speed, float damping);
-    Waves(const Waves&) = delete;
-    Waves& operator=(const Waves&) = delete;
-    ~Waves() {}
-
-    int RowCount() const { return mNumRows; }
-    int ColumnCount() const { return mNumCols; }
-    int VertexCount() const { return mVertexCount; }
-    int TriangleCount() const { return mTriangleCount; }
-    float Width() const { return mNumCols * mSpatialStep; }
-    float Depth() const { return mNumRows * mSpatialStep; }
-
-    const float3& Position(int i) const { return mCurrSolution[i]; }
-    const float3& Normal(int i) const { return mNormals[i]; }
-    const float3& TangentX(int i) const { return mTangentX[i]; }
-    const float2& TexC(int i) const { return mTexC[i]; }
-
-    void Update(float dt);
-    void Disturb(int i, int j, float magnitude);
-};
-
-Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
-{
-    mNumRows = m;
-    mNumCols = n;
-
-    mVertexCount = m * n;
-    mTriangleCount = (m - 1) * (n - 1) * 2;
-
-    mTimeStep = dt;
-    mSpatialStep = dx;
-
-    mSpeed = speed;
-    mDamping = damping;
-
-    float d = damping * dt + 2.0f;
-    float e = speed * speed * dt * dt / (dx * dx);
-    mK1 = (damping * dt - 2.0f) / d;
-    mK2 = (4.0f - 8.0f * e) / d;
-    mK3 = (2.0f * e) / d;
-
-    mPrevSolution.resize(m * n);
-    mCurrSolution.resize(m * n);
-    mNormals.resize(m * n);
-    mTangentX.resize(m * n);
-    mTexC.resize(m * n);
-
-    float halfWidth = (n - 1) * dx * 0.5f;
-    float halfDepth = (m - 1) * dx * 0.5f;
-    for(int i = 0; i < m; i++)
-    {
-        float z = halfDepth - i * dx;
-        for(int j = 0; j < n; j++)
-        {
-            float x = -halfWidth + j * dx;
-
-            mPrevSolution[i * n + j] = float3(x, 0.0f, z);
-            mCurrSolution[i * n + j] = float3(x, 0.0f, z);
-            mNormals[i * n + j] = float3(0, 1, 0);
-            mTangentX[i * n + j] = float3(1, 0, 0);
-            mTexC[i * n + j] = float2((float)j / (n - 1), (float)i / (m - 1));
-        }
-    }
-}
-
-void Waves::Update(float dt)
-{
-    static float t = 0;
-
-    if(abs(dt) < 0.0001f)
-        return;
-
-    // Accumulate time.
-    t += dt;
-
-    // Only update the simulation at the specified time step.
-    if(t >= mTimeStep)
-    {
-        Start:
-        // Only update interior points; we use zero boundary conditions.
-        concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-                                  //for(int i = 1; i < mNumRows-1; ++i)
-                                  {
-                                      for(int j = 1; j < mNumCols - 1; ++j)
-                                      {
-                                          // After this update we will be discarding the old previous
-                                          // buffer, so overwrite that buffer with the new update.
-                                          // Note how we can do this inplace (read/write to same element) 
-                                          // because we won't need prev_ij again and the assignment happens last.
-
-                                          // Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-                                          // Moreover, our +z axis goes "down"; this is just to 
-                                          // keep consistent with our row indices going down.
-
-                                          mPrevSolution[i * mNumCols + j].y =
-                                              mK1 * mPrevSolution[i * mNumCols + j].y +
-                                              mK2 * mCurrSolution[i * mNumCols + j].y +
-                                              mK3 * (mCurrSolution[(i + 1) * mNumCols + j].y +
-                                                     mCurrSolution[(i - 1) * mNumCols + j].y +
-                                                     mCurrSolution[i * mNumCols + j + 1].y +
-                                                     mCurrSolution[i * mNumCols + j - 1].y);
-                                      }
-                                  });
-
-        // We just overwrote the previous buffer with the new data, so
-        // this data needs to become the current solution and the old
-        // current solution becomes the new previous solution.
-        std::swap(mPrevSolution, mCurrSolution);
-
-        t -= mTimeStep; // reset time
-        if(t < 0.0f)
-            t = 0.0f;
-
-        //
-        // Compute normals using finite difference scheme.
-        //
-        concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-                                  //for(int i = 1; i < mNumRows - 1; ++i)
-                                  {
-                                      for(int j = 1; j < mNumCols - 1; ++j)
-                                      {
-                                          float l = mCurrSolution[i * mNumCols + j - 1].y;
-                                          float r = mCurrSolution[i * mNumCols + j + 1].y;
-                                          float t = mCurrSolution[(i - 1) * mNumCols + j].y;
-                                          float b = mCurrSolution[(i + 1) * mNumCols + j].y;
-                                          mNormals[i * mNumCols + j].x = -r + l;
-                                          mNormals[i * mNumCols + j].y = 2.0f * mSpatialStep;
-                                          mNormals[i * mNumCols + j].z = b - t;
-
-                                          XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&mNormals[i * mNumCols + j]));
-                                          XMStoreFloat3(&mNormals[i * mNumCols + j], n);
-
-                                          mTangentX[i * mNumCols + j] = XMFLOAT3(2.0f * mSpatialStep, r - l, 0.0f);
-                                          XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&mTangentX[i * mNumCols + j]));
-                                          XMStoreFloat3(&mTangentX[i * mNumCols + j], T);
-                                      }
-                                  });
-
-        if(t > 0.0f)
-            goto Start;
-    }
-}
-
-void Waves::Disturb(int i, int j, float magnitude)
-{
-    // Don't disturb boundaries.
-    assert(i > 1 && i < mNumRows - 2);
-    assert(j > 1 && j < mNumCols - 2);
-
-    float halfMag = 0.5f * magnitude;
-
-    // Disturb the ijth vertex height and its neighbors.
-    mCurrSolution[i * mNumCols + j].y += magnitude;
-    mCurrSolution[i * mNumCols + j + 1].y += halfMag;
-    mCurrSolution[i * mNumCols + j - 1].y += halfMag;
-    mCurrSolution[(i + 1) * mNumCols + j].y += halfMag;
-    mCurrSolution[(i - 1) * mNumCols + j].y += halfMag;
-}
-
 enum class RenderLayer : int
 {
     Opaque = 0,
+    Waves,
     Count
 };
 
@@ -320,9 +140,15 @@ private:
     std::unordered_map<std::wstring, ComPtr<ID3D12PipelineState>> mPSOs;
 
     std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
+    std::vector<D3D12_INPUT_ELEMENT_DESC> mWavesInputLayout;
 
     RenderItem* mWavesRItem = nullptr;
 
+    // Immutable x/z/uv stream of the waves, bound to slot 0 next to the per-frame stream.
+    ComPtr<ID3D12Resource> mWavesStaticVB = nullptr;
+    ComPtr<ID3D12Resource> mWavesStaticVBUploader = nullptr;
+    D3D12_VERTEX_BUFFER_VIEW mWavesStaticVBV = {};
+
     std::vector<std::unique_ptr<RenderItem>> mAllRItems;
     std::vector<RenderItem*> mRItemLayer[(int)RenderLayer::Count];
 
@@ -507,6 +333,9 @@ void TexWavesApp::Draw(const GameTimer<float>& gt)
 
     DrawRenderItems(mCommandList.Get(), mRItemLayer[(int)RenderLayer::Opaque]);
 
+    mCommandList->SetPipelineState(mPSOs[mIsWireframe ? L"waves_wireframe" : L"waves"].Get());
+    DrawRenderItems(mCommandList.Get(), mRItemLayer[(int)RenderLayer::Waves]);
+
     D3D12_RESOURCE_BARRIER rtPresent = CD3DX12_RESOURCE_BARRIER::Transition(
         CurrentBackBuffer(),
         D3D12_RESOURCE_STATE_RENDER_TARGET,
@@ -751,19 +580,10 @@ void TexWavesApp::UpdateWaves(const GameTimer<float>& gt)
         mWaves->Disturb(i, j, r);
     }
 
-    mWaves->Update(gt.DeltaTime());
-
-    DirectXHelper::UploadBuffer<Vertex>* currWavesVB = mCurrFrameResource->WavesVB.get();
-    for(int i = 0; i < mWaves->VertexCount(); i++)
-    {
-        Vertex v = {};
-
-        v.Pos = mWaves->Position(i);
-        v.Normal = mWaves->Normal(i);
-        v.TexC = mWaves->TexC(i);
-
-        currWavesVB->CopyData(i, v);
-    }
+    // Step the simulation and bring this frame's upload buffer up to date, rewriting only the
+    // rows that changed since it was last used.
+    DirectXHelper::UploadBuffer<WavesCompactVertex>* currWavesVB = mCurrFrameResource->WavesVB.get();
+    mWaves->Update(gt.DeltaTime(), currWavesVB->MappedData(), mCurrFrameResource->WavesVersion);
 
     mWavesRItem->Geo->VertexBufferGPU = currWavesVB->Resource();
 }
@@ -923,12 +743,36 @@ void TexWavesApp::BuildShadersAndInputLayout()
     );
 
 
+    const std::string wavesHeightRange = std::to_string(mWaves->CompactHeightRange());
+    const D3D_SHADER_MACRO wavesDefines[] = {
+        "WAVES_HEIGHT_RANGE", wavesHeightRange.c_str(),
+        nullptr, nullptr
+    };
+
+    mShaders[L"wavesVS"] = DirectXHelper::CompileShader(
+        L"Shaders\\TexLighting.hlsl",
+        wavesDefines,
+        D3D_COMPILE_STANDARD_FILE_INCLUDE,
+        "WavesVS",
+        "vs_5_0",
+        0, 0
+    );
+
     mInputLayout =
     {
         { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
         { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
         { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
     };
+
+    // Slot 0: WavesStaticVertex, slot 1: WavesCompactVertex.
+    mWavesInputLayout =
+    {
+        { "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 8, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "HEIGHT", 0, DXGI_FORMAT_R16_SNORM, 1, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "NORMAL", 0, DXGI_FORMAT_R8G8_SNORM, 1, 2, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
+    };
 }
 
 void TexWavesApp::BuildGeometry()
@@ -1074,7 +918,24 @@ void TexWavesApp::BuildWavesGeometryBuffers()
         }
     }
 
-    UINT vbByteSize = mWaves->VertexCount() * sizeof(Vertex);
+    std::vector<WavesStaticVertex> staticVertices(mWaves->VertexCount());
+    mWaves->WriteStaticVertices(staticVertices.data());
+    UINT staticVbByteSize = (UINT)staticVertices.size() * sizeof(WavesStaticVertex);
+
+    ThrowIfFailed(DirectXHelper::CreateDefaultBuffer(
+        md3dDevice.Get(),
+        mCommandList.Get(),
+        staticVertices.data(),
+        staticVbByteSize,
+        mWavesStaticVB.GetAddressOf(),
+        mWavesStaticVBUploader.GetAddressOf()
+    ));
+
+    mWavesStaticVBV.BufferLocation = mWavesStaticVB->GetGPUVirtualAddress();
+    mWavesStaticVBV.StrideInBytes = sizeof(WavesStaticVertex);
+    mWavesStaticVBV.SizeInBytes = staticVbByteSize;
+
+    UINT vbByteSize = mWaves->VertexCount() * sizeof(WavesCompactVertex);
     UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint32_t);
 
     std::unique_ptr<DirectXHelper::MeshGeometry> geo = std::make_unique<DirectXHelper::MeshGeometry>();
@@ -1095,7 +956,7 @@ void TexWavesApp::BuildWavesGeometryBuffers()
         geo->IndexUploader.GetAddressOf()
     ));
 
-    geo->VertexByteStride = sizeof(Vertex);
+    geo->VertexByteStride = sizeof(WavesCompactVertex);
     geo->VertexBufferByteSize = vbByteSize;
     geo->IndexFormat = DXGI_FORMAT_R32_UINT;
     geo->IndexBufferByteSize = ibByteSize;
@@ -1137,6 +998,19 @@ void TexWavesApp::BuildPSOs()
     opaqueWireframePsoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
 
     ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaqueWireframePsoDesc, IID_PPV_ARGS(mPSOs[L"opaque_wireframe"].GetAddressOf())));
+
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC wavesPsoDesc = opaquePsoDesc;
+    wavesPsoDesc.InputLayout.pInputElementDescs = mWavesInputLayout.data();
+    wavesPsoDesc.InputLayout.NumElements = mWavesInputLayout.size();
+    wavesPsoDesc.VS.pShaderBytecode = (BYTE*)mShaders[L"wavesVS"]->GetBufferPointer();
+    wavesPsoDesc.VS.BytecodeLength = mShaders[L"wavesVS"]->GetBufferSize();
+
+    ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&wavesPsoDesc, IID_PPV_ARGS(mPSOs[L"waves"].GetAddressOf())));
+
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC wavesWireframePsoDesc = wavesPsoDesc;
+    wavesWireframePsoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
+
+    ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&wavesWireframePsoDesc, IID_PPV_ARGS(mPSOs[L"waves_wireframe"].GetAddressOf())));
 }
 
 void TexWavesApp::BuildFrameResources()
@@ -1195,7 +1069,7 @@ void TexWavesApp::BuildRenderItems()
     waves->BaseVertexLocation = waves->Geo->DrawArgs[L"grid"].BaseVertexLocation;
 
     mWavesRItem = waves.get();
-    mRItemLayer[(int)RenderLayer::Opaque].push_back(waves.get());
+    mRItemLayer[(int)RenderLayer::Waves].push_back(waves.get());
 
     std::unique_ptr<RenderItem> grid = std::make_unique<RenderItem>();
     grid->World = DirectXHelper::Math::Identity4X4();
@@ -1238,9 +1112,12 @@ void TexWavesApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std:
     {
         RenderItem* ri = rItems[i];
 
-        D3D12_VERTEX_BUFFER_VIEW vbv = ri->Geo->VertexBufferView();
+        D3D12_VERTEX_BUFFER_VIEW vbv[] = { mWavesStaticVBV, ri->Geo->VertexBufferView() };
         D3D12_INDEX_BUFFER_VIEW ibv = ri->Geo->IndexBufferView();
-        cmdList->IASetVertexBuffers(0, 1, &vbv);
+        if(ri == mWavesRItem)
+            cmdList->IASetVertexBuffers(0, 2, vbv);
+        else
+            cmdList->IASetVertexBuffers(0, 1, &vbv[1]);
         cmdList->IASetIndexBuffer(&ibv);
         cmdList->IASetPrimitiveTopology(ri->PrimitiveType);
 
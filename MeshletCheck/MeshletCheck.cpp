@@ -0,0 +1,248 @@
+// MeshletCheck.cpp : Checks the invariants of MeshletBuilder's output.
+//
+// Splits the skull, a geosphere and a large grid into meshlets and checks that
+//
+//   - every triangle of the index list appears exactly once, in index-buffer order;
+//   - no meshlet has more than MaxVertices vertices or MaxTriangles triangles;
+//   - a meshlet's vertex list has no duplicates and every entry is used by one of its triangles;
+//   - the bounding sphere contains all of the meshlet's vertices;
+//   - a viewer that IsBackfacing() culls sees only back faces of the meshlet.
+//
+// Prints one line per mesh and exits with a non-zero code if any check fails.
+//
+//   MeshletCheck [path to skull.txt]
+
+#include "Common/MeshOptimizer.h"
+#include "Common/Meshlets.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+struct SkullVertex
+{
+    float3 Pos;
+    float3 Normal;
+};
+
+static int gFailures = 0;
+
+static void Fail(const char* mesh, std::size_t meshlet, const char* what)
+{
+    // Report the first few failures in full and only count the rest.
+    if(gFailures++ < 16)
+        std::printf("  FAILED %s, meshlet %zu: %s\n", mesh, meshlet, what);
+}
+
+static bool LoadSkull(const char* path, std::vector<SkullVertex>& vertices, std::vector<std::uint32_t>& indices)
+{
+    std::ifstream fin(path, std::ios::in);
+    if(!fin.is_open())
+        return false;
+
+    std::string s;
+    std::size_t vertCount = 0;
+    std::size_t triCount = 0;
+    fin >> s >> vertCount >> s >> triCount;
+
+    // "VertexList (pos, normal)" and "{"
+    fin >> s >> s >> s >> s;
+
+    vertices.resize(vertCount);
+    for(SkullVertex& v : vertices)
+        fin >> v.Pos.x >> v.Pos.y >> v.Pos.z >> v.Normal.x >> v.Normal.y >> v.Normal.z;
+
+    // "}", "TriangleList" and "{"
+    fin >> s >> s >> s;
+
+    indices.resize(triCount * 3);
+    for(std::uint32_t& index : indices)
+        fin >> index;
+
+    return (bool)fin;
+}
+
+static float Distance(const float3& a, const float3& b)
+{
+    float x = a.x - b.x;
+    float y = a.y - b.y;
+    float z = a.z - b.z;
+    return std::sqrt(x * x + y * y + z * z);
+}
+
+// True when the triangle p0 p1 p2 faces away from a viewer at eye, up to a small tolerance
+// for triangles seen edge-on.
+static bool IsBackFace(const float3& p0, const float3& p1, const float3& p2, const float3& eye)
+{
+    float ux = p1.x - p0.x, uy = p1.y - p0.y, uz = p1.z - p0.z;
+    float vx = p2.x - p0.x, vy = p2.y - p0.y, vz = p2.z - p0.z;
+    float nx = uy * vz - uz * vy;
+    float ny = uz * vx - ux * vz;
+    float nz = ux * vy - uy * vx;
+
+    float facing = nx * (p0.x - eye.x) + ny * (p0.y - eye.y) + nz * (p0.z - eye.z);
+    return facing >= -1e-4f * std::sqrt(nx * nx + ny * ny + nz * nz) * Distance(p0, eye);
+}
+
+// positions points at the first vertex's float3 position; vertexStride is the distance in
+// bytes between vertices. Eyes for the cone test are drawn from a cube of half size viewRange
+// around the origin.
+template <typename Index>
+static void CheckMeshlets(
+    const char* name, const Index* indices, std::size_t indexCount,
+    const void* positions, std::size_t vertexStride, std::size_t vertexCount, float viewRange)
+{
+    auto position = [&](std::uint32_t v) -> const float3&
+    {
+        return *reinterpret_cast<const float3*>(static_cast<const std::byte*>(positions) + v * vertexStride);
+    };
+
+    int failuresBefore = gFailures;
+    MeshletData data = MeshletBuilder::Build(indices, indexCount, positions, vertexStride, vertexCount);
+
+    if(data.Bounds.size() != data.Meshlets.size())
+        Fail(name, 0, "Bounds and Meshlets differ in size");
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coordinate(-viewRange, viewRange);
+    const int viewsPerMeshlet = 16;
+
+    std::size_t triangle = 0;
+    std::size_t culledViews = 0;
+    std::vector<bool> used;
+    std::vector<std::uint32_t> sorted;
+    for(std::size_t m = 0; m < data.Meshlets.size() && m < data.Bounds.size(); m++)
+    {
+        const Meshlet& meshlet = data.Meshlets[m];
+        const MeshletBounds& bounds = data.Bounds[m];
+
+        if(meshlet.PrimitiveCount == 0)
+            Fail(name, m, "no triangles");
+        if(meshlet.VertexCount > MeshletBuilder::MaxVertices)
+            Fail(name, m, "more than MaxVertices vertices");
+        if(meshlet.PrimitiveCount > MeshletBuilder::MaxTriangles)
+            Fail(name, m, "more than MaxTriangles triangles");
+        if((std::size_t)meshlet.VertexOffset + meshlet.VertexCount > data.VertexIndices.size() ||
+            (std::size_t)meshlet.PrimitiveOffset + meshlet.PrimitiveCount > data.PrimitiveIndices.size())
+        {
+            Fail(name, m, "range outside VertexIndices or PrimitiveIndices");
+            continue;
+        }
+
+        const std::uint32_t* local = data.VertexIndices.data() + meshlet.VertexOffset;
+
+        sorted.assign(local, local + meshlet.VertexCount);
+        std::sort(sorted.begin(), sorted.end());
+        if(std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+            Fail(name, m, "a vertex is listed twice");
+        if(!sorted.empty() && sorted.back() >= vertexCount)
+            Fail(name, m, "vertex index out of range");
+
+        used.assign(meshlet.VertexCount, false);
+        for(std::uint32_t p = 0; p < meshlet.PrimitiveCount; p++, triangle++)
+        {
+            std::uint32_t i0, i1, i2;
+            MeshletBuilder::UnpackTriangle(data.PrimitiveIndices[meshlet.PrimitiveOffset + p], i0, i1, i2);
+            if(i0 >= meshlet.VertexCount || i1 >= meshlet.VertexCount || i2 >= meshlet.VertexCount)
+            {
+                Fail(name, m, "local index outside the vertex list");
+                continue;
+            }
+
+            used[i0] = used[i1] = used[i2] = true;
+
+            if(triangle * 3 + 2 >= indexCount ||
+                local[i0] != (std::uint32_t)indices[triangle * 3] ||
+                local[i1] != (std::uint32_t)indices[triangle * 3 + 1] ||
+                local[i2] != (std::uint32_t)indices[triangle * 3 + 2])
+            {
+                Fail(name, m, "triangle does not match the index list");
+            }
+        }
+
+        if(std::find(used.begin(), used.end(), false) != used.end())
+            Fail(name, m, "a listed vertex is used by no triangle");
+
+        for(std::uint32_t v = 0; v < meshlet.VertexCount; v++)
+        {
+            if(local[v] < vertexCount && Distance(position(local[v]), bounds.Center) > bounds.Radius * 1.0001f + 1e-5f)
+            {
+                Fail(name, m, "vertex outside the bounding sphere");
+                break;
+            }
+        }
+
+        for(int view = 0; view < viewsPerMeshlet; view++)
+        {
+            float3 eye(coordinate(rng), coordinate(rng), coordinate(rng));
+            if(!MeshletBuilder::IsBackfacing(bounds, eye))
+                continue;
+
+            culledViews++;
+            for(std::uint32_t p = 0; p < meshlet.PrimitiveCount; p++)
+            {
+                std::uint32_t i0, i1, i2;
+                MeshletBuilder::UnpackTriangle(data.PrimitiveIndices[meshlet.PrimitiveOffset + p], i0, i1, i2);
+                if(i0 >= meshlet.VertexCount || i1 >= meshlet.VertexCount || i2 >= meshlet.VertexCount)
+                    continue;
+
+                if(!IsBackFace(position(local[i0]), position(local[i1]), position(local[i2]), eye))
+                {
+                    Fail(name, m, "cone-culled view sees a front face");
+                    break;
+                }
+            }
+        }
+    }
+
+    if(triangle != indexCount / 3)
+        Fail(name, data.Meshlets.size(), "triangle count differs from the index list");
+
+    std::printf("%-12s %9zu triangles %7zu meshlets  %5.1f%% of views cone-culled  %s\n",
+        name, indexCount / 3, data.Meshlets.size(),
+        data.Meshlets.empty() ? 0.0 : 100.0 * culledViews / (data.Meshlets.size() * viewsPerMeshlet),
+        gFailures == failuresBefore ? "ok" : "FAILED");
+}
+
+int main(int argc, char** argv)
+{
+    const char* skullPath = argc > 1 ? argv[1] : "../Chapter4/Models/skull.txt";
+
+    std::vector<SkullVertex> skullVertices;
+    std::vector<std::uint32_t> skullIndices;
+    if(!LoadSkull(skullPath, skullVertices, skullIndices))
+    {
+        std::printf("Could not read %s\n", skullPath);
+        return 1;
+    }
+
+    std::size_t skullVertexCount = skullVertices.size();
+    MeshOptimizer::Optimize(skullVertices.data(), skullVertexCount, skullIndices.data(), skullIndices.size(), &SkullVertex::Pos);
+    CheckMeshlets(
+        "skull", skullIndices.data(), skullIndices.size(),
+        &skullVertices[0].Pos, sizeof(SkullVertex), skullVertexCount, 40.0f);
+
+    GeometryGenerator::MeshData<std::uint32_t> geosphere = GeometryGenerator::CreateGeosphere<std::uint32_t>(10.0f, 6);
+    MeshOptimizer::Optimize(geosphere);
+    CheckMeshlets(
+        "geosphere", geosphere.Indices.data(), geosphere.Indices.size(),
+        &geosphere.Vertices[0].Position, sizeof(GeometryGenerator::Vertex), geosphere.Vertices.size(), 30.0f);
+
+    // Large enough to split into many parallel blocks of TrianglesPerTask triangles.
+    GeometryGenerator::MeshData<std::uint32_t> grid = GeometryGenerator::CreateGrid<std::uint32_t>(100.0f, 100.0f, 1024, 1024);
+    MeshOptimizer::Optimize(grid);
+    CheckMeshlets(
+        "grid", grid.Indices.data(), grid.Indices.size(),
+        &grid.Vertices[0].Position, sizeof(GeometryGenerator::Vertex), grid.Vertices.size(), 80.0f);
+
+    if(gFailures > 0)
+    {
+        std::printf("%d check(s) failed\n", gFailures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,959 @@
+// WavesBench.cpp : Headless throughput benchmark for the Waves simulation.
+//
+// Builds against Chapter4/Common/Waves.h only, with WAVES_HEADLESS defined, so it needs no
+// Windows or D3D headers and runs without a window or a D3D12 device. Outside Visual Studio:
+//
+//   g++ -std=c++20 -O2 -pthread -DWAVES_HEADLESS -I../Chapter4 WavesBench.cpp -o WavesBench
+//
+// By default it sweeps grid sizes, thread counts and disturbance rates and prints the results
+// as JSON; --compare prints the solver/tiling/fusion/sparse/absorbing/integrator comparison
+// tables instead. The tiling table runs at each --threads count on the --executor, so
+// --compare --executor ppl --threads 1,2,4,8 gives the ppl scaling rows.
+//
+//   WavesBench [--sizes 128,256,...] [--threads 1,2,...] [--disturb 0,1,16,...]
+//              [--seconds s] [--solver auto|scalar|sse|avx2] [--executor auto|ppl|pool|steal]
+//              [--out file.json] [--compare]
+
+#include "Common/OceanWaves.h"
+#include "Common/Waves.h"
+#include "Common/WavesCheckpoint.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(WAVES_HAS_PPL)
+#include <concrt.h>
+#endif
+
+// The original array-of-structures solver: heights live in the .y field of a float3,
+// so the stencil reads every value at a 12 byte stride. Kept here as the baseline.
+class LegacyWaves
+{
+private:
+    int mNumRows = 0;
+    int mNumCols = 0;
+
+    float mK1 = 0.0f;
+    float mK2 = 0.0f;
+    float mK3 = 0.0f;
+
+    std::vector<float3> mPrevSolution;
+    std::vector<float3> mCurrSolution;
+
+public:
+    LegacyWaves(int m, int n, float dx, float dt, float speed, float damping)
+        : mNumRows(m), mNumCols(n)
+    {
+        float d = damping * dt + 2.0f;
+        float e = speed * speed * dt * dt / (dx * dx);
+        mK1 = (damping * dt - 2.0f) / d;
+        mK2 = (4.0f - 8.0f * e) / d;
+        mK3 = (2.0f * e) / d;
+
+        mPrevSolution.assign(m * n, float3(0.0f, 0.0f, 0.0f));
+        mCurrSolution.assign(m * n, float3(0.0f, 0.0f, 0.0f));
+    }
+
+    float Height(int row, int col) const { return mCurrSolution[row * mNumCols + col].y; }
+
+    void Disturb(int i, int j, float magnitude)
+    {
+        float halfMag = 0.5f * magnitude;
+
+        mCurrSolution[i * mNumCols + j].y += magnitude;
+        mCurrSolution[i * mNumCols + j + 1].y += halfMag;
+        mCurrSolution[i * mNumCols + j - 1].y += halfMag;
+        mCurrSolution[(i + 1) * mNumCols + j].y += halfMag;
+        mCurrSolution[(i - 1) * mNumCols + j].y += halfMag;
+    }
+
+    void Step()
+    {
+        for(int i = 1; i < mNumRows - 1; i++)
+        {
+            for(int j = 1; j < mNumCols - 1; j++)
+            {
+                mPrevSolution[i * mNumCols + j].y =
+                    mK1 * mPrevSolution[i * mNumCols + j].y +
+                    mK2 * mCurrSolution[i * mNumCols + j].y +
+                    mK3 * (mCurrSolution[(i + 1) * mNumCols + j].y +
+                           mCurrSolution[(i - 1) * mNumCols + j].y +
+                           mCurrSolution[i * mNumCols + j + 1].y +
+                           mCurrSolution[i * mNumCols + j - 1].y);
+            }
+        }
+
+        std::swap(mPrevSolution, mCurrSolution);
+    }
+};
+
+static const char* ExecutorName(WavesExecutor executor)
+{
+    switch(executor)
+    {
+    case WavesExecutor::Serial:
+        return "serial";
+    case WavesExecutor::PPL:
+        return "ppl";
+    case WavesExecutor::ThreadPool:
+        return "pool";
+    case WavesExecutor::WorkStealing:
+        return "steal";
+    default:
+        return "auto";
+    }
+}
+
+static const char* SolverName(WavesSolver solver)
+{
+    switch(solver)
+    {
+    case WavesSolver::Scalar:
+        return "scalar";
+    case WavesSolver::SSE:
+        return "sse";
+    case WavesSolver::AVX2:
+        return "avx2";
+    default:
+        return "auto";
+    }
+}
+
+// Runs step() repeatedly for at least minSeconds and returns the achieved steps per second.
+template <class StepFn>
+static double MeasureStepsPerSecond(StepFn step, double minSeconds)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Warm caches and page in both planes before timing.
+    for(int i = 0; i < 8; i++)
+        step();
+
+    int steps = 0;
+    int batch = 8;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    while(elapsed < minSeconds)
+    {
+        for(int i = 0; i < batch; i++)
+            step();
+        steps += batch;
+        batch *= 2;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    return steps / elapsed;
+}
+
+struct Vertex
+{
+    float3 Pos;
+    float3 Normal;
+    float2 TexC;
+};
+
+// Compares a step followed by the per-vertex Position/Normal/TexC + memcpy loop the demos
+// used to fill their upload buffers with the fused Update(dt, vertices) pass.
+static void BenchmarkVertexWrite(double minSeconds)
+{
+    const int sizes[] = { 320, 640, 1024, 2048 };
+    constexpr float timeStep = 0.016f;
+
+    std::printf("\nWaves step + vertex write (frames/sec)\n");
+    std::printf("%-10s %-8s %14s %14s %10s\n", "grid", "threads", "per-vertex", "fused", "speedup");
+
+    for(int size : sizes)
+    {
+        Waves waves(size, size, 0.5f, timeStep, 5.0f, 0.4f);
+        waves.Disturb(size / 2, size / 2, 1.0f);
+
+        // Stands in for a mapped upload buffer.
+        std::vector<Vertex> vertices(waves.VertexCount());
+
+        const bool threadModes[] = { false, true };
+        for(bool multithreaded : threadModes)
+        {
+            waves.SetMultithreaded(multithreaded);
+
+            double perVertex = MeasureStepsPerSecond([&]()
+                {
+                    waves.Step();
+                    for(int i = 0; i < waves.VertexCount(); i++)
+                    {
+                        Vertex v = { waves.Position(i), waves.Normal(i), waves.TexC(i) };
+                        std::memcpy(&vertices[i], &v, sizeof(Vertex));
+                    }
+                }, minSeconds);
+            double fused = MeasureStepsPerSecond([&]() { waves.Update(timeStep, vertices.data()); }, minSeconds);
+
+            std::printf("%4dx%-5d %-8s %14.1f %14.1f %9.2fx\n", size, size, multithreaded ? ExecutorName(waves.Executor()) : "1",
+                perVertex, fused, fused / perVertex);
+        }
+    }
+}
+
+// Upload size and cost of a step plus vertex write for the full 32 byte vertex and the two
+// compact streams, which leave x/z/uv in a static buffer.
+static void BenchmarkCompactVertices(double minSeconds)
+{
+    const int sizes[] = { 320, 1024 };
+    constexpr float timeStep = 0.016f;
+
+    std::printf("\nWaves step + vertex write, full vs. compact streams (frames/sec)\n");
+    std::printf("%-10s %-10s %12s %14s\n", "grid", "vertex", "KB/frame", "frames/sec");
+
+    for(int size : sizes)
+    {
+        Waves waves(size, size, 0.5f, timeStep, 5.0f, 0.4f);
+        waves.SetMultithreaded(false);
+        waves.Disturb(size / 2, size / 2, 1.0f);
+
+        auto measure = [&](const char* name, auto* vertex)
+        {
+            using VertexT = std::remove_pointer_t<decltype(vertex)>;
+            std::vector<VertexT> vertices(waves.VertexCount());
+            double rate = MeasureStepsPerSecond([&]() { waves.Update(timeStep, vertices.data()); }, minSeconds);
+            std::printf("%4dx%-5d %-10s %12.1f %14.1f\n", size, size, name, vertices.size() * sizeof(VertexT) / 1024.0, rate);
+        };
+
+        measure("full", (Vertex*)nullptr);
+        measure("compact16", (WavesCompactVertex16*)nullptr);
+        measure("compact8", (WavesCompactVertex*)nullptr);
+    }
+}
+
+// Batched surface queries (height and normal) at random points of a 1024x1024 grid, as
+// buoyancy would issue them for many floating bodies, per solver.
+static void BenchmarkSurfaceQueries(double minSeconds)
+{
+    constexpr int size = 1024;
+    constexpr int pointCount = 10000;
+
+    std::printf("\nWaves surface queries, %d points on a %dx%d grid\n", pointCount, size, size);
+    std::printf("%-10s %14s\n", "solver", "ns/point");
+
+    Waves waves(size, size, 0.5f, 0.016f, 5.0f, 0.4f);
+    waves.SetMultithreaded(false);
+    waves.Disturb(size / 2, size / 2, 1.0f);
+    waves.Step(100);
+
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> coordinate(-0.5f * waves.Width(), 0.5f * waves.Width());
+    std::vector<float> x(pointCount);
+    std::vector<float> z(pointCount);
+    for(int k = 0; k < pointCount; k++)
+    {
+        x[k] = coordinate(random);
+        z[k] = coordinate(random);
+    }
+
+    std::vector<float> heights(pointCount);
+    std::vector<float3> normals(pointCount);
+    for(WavesSolver solver : { WavesSolver::Scalar, WavesSolver::SSE })
+    {
+        waves.SetSolver(solver);
+        double rate = MeasureStepsPerSecond(
+            [&]() { waves.SampleSurface(x.data(), z.data(), pointCount, heights.data(), normals.data()); }, minSeconds);
+        std::printf("%-10s %14.1f\n", SolverName(solver), 1e9 / (rate * pointCount));
+    }
+}
+
+// Delta uploads into three frame resources: bytes written per frame through
+// Update(dt, vertices, version) against rewriting every vertex, for display rates at and
+// above the simulation rate. Drops land every 0.25 s; sparse mode leaves calm bands alone.
+static void BenchmarkDeltaUploads()
+{
+    constexpr int size = 320;
+    constexpr int frameResourceCount = 3;
+    constexpr float seconds = 10.0f;
+    const int displayRates[] = { 60, 144, 240 };
+
+    std::printf("\nWaves delta uploads, %dx%d grid, %d frame resources\n", size, size, frameResourceCount);
+    std::printf("%-8s %-8s %14s %12s\n", "display", "mode", "KB/frame", "% of full");
+
+    for(int rate : displayRates)
+    {
+        for(bool sparse : { false, true })
+        {
+            Waves waves(size, size, 0.5f, 0.016f, 5.0f, 0.4f);
+            waves.SetMultithreaded(false);
+            waves.SetSparse(sparse);
+
+            std::vector<Vertex> buffers[frameResourceCount];
+            std::uint64_t versions[frameResourceCount] = {};
+            for(std::vector<Vertex>& buffer : buffers)
+                buffer.resize(waves.VertexCount());
+
+            int frameCount = (int)(seconds * rate);
+            int dropInterval = rate / 4;
+            std::uint64_t bytesBefore = waves.VertexBytesWritten();
+            for(int frame = 0; frame < frameCount; frame++)
+            {
+                if(frame % dropInterval == 0)
+                    waves.QueueDisturb(size * 0.5f + 100.0f * std::sin(frame * 0.37f), size * 0.5f + 100.0f * std::cos(frame * 0.61f), 0.5f, 2.0f);
+
+                int k = frame % frameResourceCount;
+                waves.Update(1.0f / rate, buffers[k].data(), versions[k]);
+            }
+
+            double bytesPerFrame = (double)(waves.VertexBytesWritten() - bytesBefore) / frameCount;
+            double fullBytes = (double)waves.VertexCount() * sizeof(Vertex);
+            std::printf("%4d Hz  %-8s %14.1f %11.1f%%\n", rate, sparse ? "sparse" : "dense", bytesPerFrame / 1024.0, 100.0 * bytesPerFrame / fullBytes);
+        }
+    }
+}
+
+// Checkpoint round trip of a large grid: save, restore by adopting the mapped planes and
+// by copying them, and the first step after each restore, which pays for the page faults
+// (and copy-on-write copies) a mapped restore defers.
+static void BenchmarkCheckpoint()
+{
+    constexpr int size = 4096;
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "WavesBench.ckpt";
+
+    std::printf("\nWaves checkpoint, %dx%d grid (ms)\n", size, size);
+    std::printf("%-10s %10s %12s %12s\n", "restore", "save", "restore", "first step");
+
+    auto elapsedMs = [](auto start) { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+
+    Waves source(size, size, 0.5f, 0.016f, 5.0f, 0.4f);
+    source.Disturb(size / 2, size / 2, 1.0f);
+    source.Step(4);
+
+    auto start = std::chrono::steady_clock::now();
+    bool saved = WavesCheckpoint::Save(source, path, false);
+    double saveMs = elapsedMs(start);
+
+    WavesCheckpoint checkpoint;
+    if(!saved || !checkpoint.Open(path))
+    {
+        std::printf("could not write %s\n", path.string().c_str());
+        return;
+    }
+
+    for(bool adopt : { true, false })
+    {
+        Waves waves(size, size, 0.5f, 0.016f, 5.0f, 0.4f);
+
+        start = std::chrono::steady_clock::now();
+        checkpoint.Restore(waves, adopt);
+        double restoreMs = elapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        waves.Step();
+        double stepMs = elapsedMs(start);
+
+        std::printf("%-10s %10.1f %12.2f %12.1f\n", adopt ? "mapped" : "copied", saveMs, restoreMs, stepMs);
+    }
+
+    checkpoint.Close();
+    std::error_code error;
+    std::filesystem::remove(path, error);
+}
+
+// A mostly calm scene: a drop every dropInterval steps somewhere on the grid. Sparse mode
+// only steps tiles near the spreading rings, so its cost follows the active area.
+static void BenchmarkSparse()
+{
+    const int sizes[] = { 1024, 2048 };
+    constexpr int stepCount = 1200;
+    constexpr int dropInterval = 400;
+
+    std::printf("\nWaves sparse stepping, %d steps, a drop every %d steps (steps/sec)\n", stepCount, dropInterval);
+    std::printf("%-10s %14s %14s %10s %10s\n", "grid", "dense", "sparse", "speedup", "stepped");
+
+    for(int size : sizes)
+    {
+        double rates[2] = {};
+        double steppedFraction = 0.0;
+        for(int sparse = 0; sparse < 2; sparse++)
+        {
+            Waves waves(size, size, 0.5f, 0.016f, 5.0f, 0.4f);
+            waves.SetMultithreaded(false);
+            waves.SetSparse(sparse != 0);
+
+            std::size_t steppedCells = 0;
+            auto start = std::chrono::steady_clock::now();
+            for(int step = 0; step < stepCount; step++)
+            {
+                if(step % dropInterval == 0)
+                {
+                    int k = step / dropInterval;
+                    waves.Disturb(size / 4 + k * size / 5, size / 3 + k * size / 7, 1.0f);
+                }
+
+                waves.Step();
+                steppedCells += waves.SteppedCellCount();
+            }
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            rates[sparse] = stepCount / elapsed;
+            steppedFraction = (double)steppedCells / ((double)stepCount * (size - 2) * (size - 2));
+        }
+
+        std::printf("%4dx%-5d %14.1f %14.1f %9.2fx %9.1f%%\n", size, size,
+            rates[0], rates[1], rates[1] / rates[0], 100.0 * steppedFraction);
+    }
+}
+
+// Edge echoes: a drop on a small grid against the same drop on a grid wide enough that no
+// reflection gets back in time. The echo is the RMS slope difference inside the sponge,
+// relative to the reference slopes and averaged over snapshots; slopes are what the normals,
+// and so the shading, see.
+static void BenchmarkAbsorbingBoundary(double minSeconds)
+{
+    constexpr int size = 128;
+    constexpr int margin = 256;
+    constexpr int stepCount = 3000;
+    constexpr int snapshotInterval = 100;
+    const int widths[] = { 0, 8, 16, 24, 32 };
+
+    std::printf("\nWaves absorbing boundary, %dx%d grid, %d steps, undamped\n", size, size, stepCount);
+    std::printf("%-8s %10s %10s %14s\n", "width", "strength", "echo", "steps/sec");
+
+    auto makeWaves = [](int n)
+    {
+        auto waves = std::make_unique<Waves>(n, n, 0.5f, 0.016f, 5.0f, 0.0f);
+        waves->SetMultithreaded(false);
+        waves->Disturb(n / 2 + 10, n / 2 - 7, 1.0f);
+        return waves;
+    };
+
+    // Reference slopes of the small grid's window, per snapshot.
+    std::vector<std::vector<float>> reference;
+    auto referenceWaves = makeWaves(size + 2 * margin);
+    for(int step = 1; step <= stepCount; step++)
+    {
+        referenceWaves->Step();
+        if(step % snapshotInterval != 0)
+            continue;
+
+        std::vector<float>& heights = reference.emplace_back((std::size_t)size * size);
+        for(int i = 0; i < size; i++)
+            for(int j = 0; j < size; j++)
+                heights[i * size + j] = referenceWaves->Height(margin + i, margin + j);
+    }
+
+    for(int width : widths)
+    {
+        auto waves = makeWaves(size);
+        waves->SetAbsorbingBoundary(width);
+
+        double echo = 0.0;
+        int snapshot = 0;
+        for(int step = 1; step <= stepCount; step++)
+        {
+            waves->Step();
+            if(step % snapshotInterval != 0)
+                continue;
+
+            const std::vector<float>& heights = reference[snapshot++];
+            double error = 0.0;
+            double norm = 0.0;
+            for(int i = width + 1; i < size - 2 - width; i++)
+            {
+                for(int j = width + 1; j < size - 2 - width; j++)
+                {
+                    float h = heights[i * size + j];
+                    float rx = heights[i * size + j + 1] - h;
+                    float rz = heights[(i + 1) * size + j] - h;
+                    float dx = waves->Height(i, j + 1) - waves->Height(i, j) - rx;
+                    float dz = waves->Height(i + 1, j) - waves->Height(i, j) - rz;
+                    error += dx * dx + dz * dz;
+                    norm += rx * rx + rz * rz;
+                }
+            }
+            echo += std::sqrt(error / norm);
+        }
+        echo /= snapshot;
+
+        double rate = MeasureStepsPerSecond([&]() { waves->Step(); }, minSeconds);
+        std::printf("%-8d %10.3f %10.3f %14.1f\n", width, waves->AbsorbingStrength(), echo, rate);
+    }
+}
+
+// Explicit vs. ADI at growing time steps: the error after a fixed stretch of simulated time
+// against an explicit run at 1/16 of the base step, and the cost of simulating one second.
+// The drop is smooth and starts at rest, so every run sees the same initial condition.
+static void BenchmarkIntegrators()
+{
+    constexpr int size = 256;
+    constexpr float baseStep = 0.016f;
+    constexpr float duration = 3.072f;
+    const int multiples[] = { 1, 2, 4, 8 };
+
+    std::printf("\nWaves integrators, %dx%d grid, %.2f s simulated, single thread\n", size, size, duration);
+    std::printf("%-10s %8s %10s %16s\n", "integrator", "dt", "error", "ms per sim sec");
+
+    auto simulate = [](float dt, WavesIntegrator integrator, double& msPerSecond)
+    {
+        Waves waves(size, size, 0.5f, dt, 5.0f, 0.4f, WavesSolver::Auto, integrator);
+        waves.SetMultithreaded(false);
+        waves.QueueDisturb(size / 2 + 0.3f, size / 2 - 0.2f, 1.0f, 6.0f);
+        waves.ApplyDisturbances();
+        std::vector<float> heights(waves.Heights(), waves.Heights() + (std::size_t)size * waves.RowPitch());
+        std::memcpy(const_cast<float*>(waves.PreviousHeights()), heights.data(), heights.size() * sizeof(float));
+
+        // Auto may split dt into several explicit steps.
+        int stepCount = (int)std::lround(duration / waves.TimeStep());
+        auto start = std::chrono::steady_clock::now();
+        waves.Step(stepCount);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        msPerSecond = seconds * 1e3 / duration;
+
+        heights.assign(waves.Heights(), waves.Heights() + heights.size());
+        return heights;
+    };
+
+    double unused = 0.0;
+    std::vector<float> reference = simulate(baseStep / 16, WavesIntegrator::Explicit, unused);
+    double referenceNorm = 0.0;
+    for(float h : reference)
+        referenceNorm += (double)h * h;
+
+    for(int multiple : multiples)
+    {
+        float dt = baseStep * multiple;
+        bool stable = dt <= Waves::MaxExplicitTimeStep(0.5f, 5.0f);
+        for(WavesIntegrator integrator : { WavesIntegrator::Explicit, WavesIntegrator::Auto, WavesIntegrator::ADI })
+        {
+            // Below the limit Auto is the plain explicit integrator.
+            if(integrator == WavesIntegrator::Auto && stable)
+                continue;
+
+            if(integrator == WavesIntegrator::Explicit && !stable)
+            {
+                std::printf("%-10s %8.3f %10s %16s\n", "explicit", dt, "unstable", "-");
+                continue;
+            }
+
+            double msPerSecond = 0.0;
+            std::vector<float> heights = simulate(dt, integrator, msPerSecond);
+            double error = 0.0;
+            for(std::size_t i = 0; i < heights.size(); i++)
+                error += ((double)heights[i] - reference[i]) * ((double)heights[i] - reference[i]);
+
+            const char* name = integrator == WavesIntegrator::ADI ? "adi" :
+                integrator == WavesIntegrator::Auto ? "auto" : "explicit";
+            std::printf("%-10s %8.3f %10.4f %16.2f\n", name, dt, std::sqrt(error / referenceNorm), msPerSecond);
+        }
+    }
+}
+
+// FFT ocean: the cost of one Update (spectra, three packed 2D inverse FFTs and the vertex
+// write) per grid size, serial and threaded.
+static void BenchmarkOcean(double minSeconds)
+{
+    const int sizes[] = { 128, 256, 512 };
+
+    std::printf("\nOceanWaves::Update with vertex write\n");
+    std::printf("%-10s %-8s %14s %12s\n", "grid", "threads", "updates/sec", "ms/update");
+
+    for(int size : sizes)
+    {
+        OceanWaves ocean(size, 250.0f);
+        std::vector<Vertex> vertices(ocean.VertexCount());
+        for(bool multithreaded : { false, true })
+        {
+            ocean.SetMultithreaded(multithreaded);
+            double rate = MeasureStepsPerSecond([&]() { ocean.Update(0.016f, vertices.data()); }, minSeconds);
+            std::printf("%4dx%-5d %-8s %14.1f %12.3f\n", size, size, multithreaded ? "all" : "1", rate, 1e3 / rate);
+        }
+    }
+}
+
+struct SuiteOptions
+{
+    std::vector<int> Sizes = { 128, 256, 512, 1024, 2048, 4096 };
+    std::vector<int> Threads;
+    std::vector<int> DisturbRates = { 0, 1, 16, 256 };
+    double MinSeconds = 0.5;
+    WavesSolver Solver = WavesSolver::Auto;
+    WavesExecutor Executor = WavesExecutor::Auto;
+    const char* OutPath = nullptr;
+    bool Compare = false;
+};
+
+struct SuiteResult
+{
+    int Size = 0;
+    int Threads = 0;
+    int DisturbRate = 0;
+    std::uint64_t Steps = 0;
+    double Seconds = 0.0;
+    double StepsPerSecond = 0.0;
+    double NsPerCell = 0.0;
+    double BandwidthGBps = 0.0;
+    double NsPerDisturb = 0.0;
+};
+
+#if defined(WAVES_HAS_PPL)
+// Limits the ppl scheduler used by Waves to a fixed number of threads while in scope. The
+// std::thread executors take the count from Waves::SetThreadCount() instead.
+class ScopedThreadCount
+{
+public:
+    explicit ScopedThreadCount(int threads)
+    {
+        concurrency::SchedulerPolicy policy(2,
+            concurrency::MinConcurrency, (unsigned)threads,
+            concurrency::MaxConcurrency, (unsigned)threads);
+        concurrency::CurrentScheduler::Create(policy);
+    }
+
+    ~ScopedThreadCount()
+    {
+        concurrency::CurrentScheduler::Detach();
+    }
+};
+#endif
+
+static std::vector<int> ParseList(const char* text)
+{
+    std::vector<int> values;
+    for(const char* p = text; *p != '\0';)
+    {
+        char* end = nullptr;
+        long value = std::strtol(p, &end, 10);
+        if(end == p)
+            break;
+
+        values.push_back((int)value);
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    return values;
+}
+
+static bool ParseOptions(int argc, char** argv, SuiteOptions& options)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if(arg == "--compare")
+        {
+            options.Compare = true;
+            continue;
+        }
+
+        if(value == nullptr)
+        {
+            std::fprintf(stderr, "missing value for %s\n", arg.c_str());
+            return false;
+        }
+        i++;
+
+        if(arg == "--sizes")
+            options.Sizes = ParseList(value);
+        else if(arg == "--threads")
+            options.Threads = ParseList(value);
+        else if(arg == "--disturb")
+            options.DisturbRates = ParseList(value);
+        else if(arg == "--seconds")
+            options.MinSeconds = std::atof(value);
+        else if(arg == "--out")
+            options.OutPath = value;
+        else if(arg == "--solver")
+        {
+            std::string name = value;
+            if(name == "scalar")
+                options.Solver = WavesSolver::Scalar;
+            else if(name == "sse")
+                options.Solver = WavesSolver::SSE;
+            else if(name == "avx2")
+                options.Solver = WavesSolver::AVX2;
+            else
+                options.Solver = WavesSolver::Auto;
+        }
+        else if(arg == "--executor")
+        {
+            std::string name = value;
+            if(name == "ppl")
+                options.Executor = WavesExecutor::PPL;
+            else if(name == "pool")
+                options.Executor = WavesExecutor::ThreadPool;
+            else if(name == "steal")
+                options.Executor = WavesExecutor::WorkStealing;
+            else
+                options.Executor = WavesExecutor::Auto;
+        }
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if(options.Threads.empty())
+    {
+        options.Threads.push_back(1);
+        int hardwareThreads = (int)std::thread::hardware_concurrency();
+        for(int threads = 2; threads < hardwareThreads; threads *= 2)
+            options.Threads.push_back(threads);
+        if(hardwareThreads > 1)
+            options.Threads.push_back(hardwareThreads);
+    }
+
+    return true;
+}
+
+// One suite point: QueueDisturb() disturbRate times at pseudo-random interior positions, then
+// Update() by one time step, which applies the batch, repeated for at least minSeconds.
+static SuiteResult RunSuitePoint(int size, int threads, int disturbRate, const SuiteOptions& options)
+{
+    constexpr float timeStep = 0.016f;
+
+    Waves waves(size, size, 0.5f, timeStep, 5.0f, 0.4f, options.Solver);
+    waves.SetExecutor(threads > 1 ? options.Executor : WavesExecutor::Serial);
+    waves.SetThreadCount(threads);
+
+    // Small linear congruential generator so every run disturbs the same cells.
+    std::uint32_t seed = 12345u;
+    auto next = [&seed](int range)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return (int)((seed >> 8) % (std::uint32_t)range);
+    };
+    auto disturb = [&]()
+    {
+        for(int k = 0; k < disturbRate; k++)
+        {
+            float row = 2.0f + next(size - 4);
+            float col = 2.0f + next(size - 4);
+            waves.QueueDisturb(row, col, (next(2) * 2 - 1) * 0.01f);
+        }
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    SuiteResult result;
+    result.Size = size;
+    result.Threads = threads;
+    result.DisturbRate = disturbRate;
+
+    // Warm up, then run doubling batches until the time budget is spent.
+    for(int i = 0; i < 4; i++)
+    {
+        disturb();
+        waves.Update(timeStep);
+    }
+
+    std::uint64_t startSteps = waves.StepCount();
+    Clock::time_point start = Clock::now();
+    int batch = 4;
+    while(result.Seconds < options.MinSeconds)
+    {
+        for(int i = 0; i < batch; i++)
+        {
+            disturb();
+            waves.Update(timeStep);
+        }
+        batch *= 2;
+        result.Seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    result.Steps = waves.StepCount() - startSteps;
+
+    double cells = (double)(size - 2) * (size - 2);
+    result.StepsPerSecond = result.Steps / result.Seconds;
+    result.NsPerCell = 1e9 / (result.StepsPerSecond * cells);
+
+    // Each interior cell reads the previous and current heights and writes the new one;
+    // the neighbours come from cache. Bandwidth is reported against that 12 byte minimum.
+    result.BandwidthGBps = result.StepsPerSecond * cells * 3 * sizeof(float) * 1e-9;
+
+    if(disturbRate > 0)
+    {
+        constexpr int disturbCount = 1 << 20;
+        Clock::time_point disturbStart = Clock::now();
+        for(int k = 0; k < disturbCount; k += disturbRate)
+        {
+            disturb();
+            waves.ApplyDisturbances();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - disturbStart).count();
+        result.NsPerDisturb = seconds * 1e9 / disturbCount;
+    }
+
+    return result;
+}
+
+static void WriteSuiteJson(std::FILE* file, const SuiteOptions& options, WavesSolver solver, const std::vector<SuiteResult>& results)
+{
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"benchmark\": \"Waves\",\n");
+    std::fprintf(file, "  \"solver\": \"%s\",\n", SolverName(solver));
+    std::fprintf(file, "  \"executor\": \"%s\",\n", ExecutorName(WavesKernels::ResolveExecutor(options.Executor)));
+    std::fprintf(file, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+    std::fprintf(file, "  \"min_seconds\": %g,\n", options.MinSeconds);
+    std::fprintf(file, "  \"results\": [\n");
+
+    for(std::size_t i = 0; i < results.size(); i++)
+    {
+        const SuiteResult& r = results[i];
+        std::fprintf(file,
+            "    { \"rows\": %d, \"cols\": %d, \"threads\": %d, \"disturbances_per_step\": %d, "
+            "\"steps\": %llu, \"seconds\": %.6f, \"steps_per_sec\": %.3f, \"ns_per_cell\": %.4f, "
+            "\"bandwidth_gbps\": %.3f, \"ns_per_disturb\": %.3f }%s\n",
+            r.Size, r.Size, r.Threads, r.DisturbRate,
+            (unsigned long long)r.Steps, r.Seconds, r.StepsPerSecond, r.NsPerCell,
+            r.BandwidthGBps, r.NsPerDisturb,
+            i + 1 < results.size() ? "," : "");
+    }
+
+    std::fprintf(file, "  ]\n}\n");
+}
+
+static int RunSuite(const SuiteOptions& options)
+{
+    std::vector<SuiteResult> results;
+    for(int size : options.Sizes)
+    {
+        for(int threads : options.Threads)
+        {
+#if defined(WAVES_HAS_PPL)
+            std::unique_ptr<ScopedThreadCount> threadCount;
+            if(WavesKernels::ResolveExecutor(options.Executor) == WavesExecutor::PPL)
+                threadCount = std::make_unique<ScopedThreadCount>(threads);
+#endif
+            for(int disturbRate : options.DisturbRates)
+            {
+                results.push_back(RunSuitePoint(size, threads, disturbRate, options));
+
+                const SuiteResult& r = results.back();
+                std::fprintf(stderr, "%4dx%-5d threads %-3d disturb %-5d %10.1f steps/s %8.3f ns/cell %7.2f GB/s\n",
+                    r.Size, r.Size, r.Threads, r.DisturbRate, r.StepsPerSecond, r.NsPerCell, r.BandwidthGBps);
+            }
+        }
+    }
+
+    std::FILE* file = stdout;
+    if(options.OutPath != nullptr)
+    {
+        file = std::fopen(options.OutPath, "w");
+        if(file == nullptr)
+        {
+            std::fprintf(stderr, "cannot open %s\n", options.OutPath);
+            return 1;
+        }
+    }
+
+    WriteSuiteJson(file, options, WavesKernels::ResolveSolver(options.Solver), results);
+
+    if(file != stdout)
+        std::fclose(file);
+
+    return 0;
+}
+
+// Compares catching up several steps with one full-grid sweep per step against
+// Step(count), which fuses up to TileDepth() sweeps per cache-sized tile, at each thread
+// count of the suite on its executor. Tiling is forced on for every grid so the table shows
+// where it starts to pay off; the last column says whether Step(count) tiles that grid with
+// the default TiledMinBytes().
+static void BenchmarkTemporalBlocking(const SuiteOptions& options)
+{
+    constexpr int stepsPerCall = 8;
+    const int sizes[] = { 1024, 2048, 4096, 8192 };
+    WavesExecutor executor = WavesKernels::ResolveExecutor(options.Executor);
+
+    std::printf("\nWaves::Step(%d), temporal blocking, %s executor, %.0f MB last-level cache (steps/sec)\n",
+        stepsPerCall, ExecutorName(executor), WavesKernels::LastLevelCacheBytes() / (1024.0 * 1024.0));
+    std::printf("%-10s %-8s %14s %14s %10s %8s\n", "grid", "threads", "row sweeps", "tiled", "speedup", "default");
+
+    for(int size : sizes)
+    {
+        Waves waves(size, size, 0.5f, 0.016f, 5.0f, 0.4f);
+        waves.Disturb(size / 2, size / 2, 1.0f);
+
+        std::size_t planeBytes = (std::size_t)waves.RowCount() * waves.RowPitch() * sizeof(float);
+        bool tiledByDefault = 2 * planeBytes >= waves.TiledMinBytes();
+        waves.SetTiledMinBytes(0);
+
+        for(int threads : options.Threads)
+        {
+#if defined(WAVES_HAS_PPL)
+            std::unique_ptr<ScopedThreadCount> threadCount;
+            if(executor == WavesExecutor::PPL && threads > 1)
+                threadCount = std::make_unique<ScopedThreadCount>(threads);
+#endif
+            waves.SetExecutor(threads > 1 ? executor : WavesExecutor::Serial);
+            waves.SetThreadCount(threads);
+
+            double rowSweeps = stepsPerCall * MeasureStepsPerSecond([&]()
+                {
+                    for(int i = 0; i < stepsPerCall; i++)
+                        waves.Step();
+                }, options.MinSeconds);
+            double tiled = stepsPerCall * MeasureStepsPerSecond([&]() { waves.Step(stepsPerCall); }, options.MinSeconds);
+
+            std::printf("%4dx%-5d %-8d %14.1f %14.1f %9.2fx %8s\n", size, size, threads,
+                rowSweeps, tiled, tiled / rowSweeps, tiledByDefault ? "tiled" : "rows");
+        }
+    }
+}
+
+static void RunComparisons(const SuiteOptions& options)
+{
+    double minSeconds = options.MinSeconds;
+
+    const int sizes[] = { 320, 640, 1024, 2048 };
+    const WavesSolver solvers[] = { WavesSolver::Scalar, WavesSolver::SSE, WavesSolver::AVX2 };
+
+    std::printf("Waves::Step, single thread (steps/sec, speedup vs. float3 layout)\n");
+    std::printf("%-10s %-8s %14s %10s\n", "grid", "solver", "steps/sec", "speedup");
+
+    for(int size : sizes)
+    {
+        LegacyWaves legacy(size, size, 0.5f, 0.016f, 5.0f, 0.4f);
+        legacy.Disturb(size / 2, size / 2, 1.0f);
+        double baseline = MeasureStepsPerSecond([&]() { legacy.Step(); }, minSeconds);
+        std::printf("%4dx%-5d %-8s %14.1f %9.2fx\n", size, size, "legacy", baseline, 1.0);
+
+        for(WavesSolver solver : solvers)
+        {
+            Waves waves(size, size, 0.5f, 0.016f, 5.0f, 0.4f, solver);
+            if(waves.Solver() != solver)
+                continue;
+
+            waves.SetMultithreaded(false);
+            waves.Disturb(size / 2, size / 2, 1.0f);
+
+            double rate = MeasureStepsPerSecond([&]() { waves.Step(); }, minSeconds);
+            std::printf("%4dx%-5d %-8s %14.1f %9.2fx\n", size, size, SolverName(solver), rate, rate / baseline);
+        }
+    }
+
+    BenchmarkTemporalBlocking(options);
+    BenchmarkVertexWrite(minSeconds);
+    BenchmarkCompactVertices(minSeconds);
+    BenchmarkDeltaUploads();
+    BenchmarkSurfaceQueries(minSeconds);
+    BenchmarkCheckpoint();
+    BenchmarkSparse();
+    BenchmarkAbsorbingBoundary(minSeconds);
+    BenchmarkIntegrators();
+    BenchmarkOcean(minSeconds);
+}
+
+int main(int argc, char** argv)
+{
+    SuiteOptions options;
+    if(!ParseOptions(argc, argv, options))
+        return 1;
+
+    if(options.Compare)
+    {
+        RunComparisons(options);
+        return 0;
+    }
+
+    return RunSuite(options);
+}